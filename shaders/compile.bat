@@ -1,3 +1,5 @@
 "D:\Programs\Vulkan SDK\Bin\glslc.exe" shader.vert -o vert.spv
 "D:\Programs\Vulkan SDK\Bin\glslc.exe" shader.frag -o frag.spv
+"D:\Programs\Vulkan SDK\Bin\glslc.exe" cull.comp -o cull.spv
+"D:\Programs\Vulkan SDK\Bin\glslc.exe" cull_meshlets.comp -o cull_meshlets.spv
 pause
\ No newline at end of file
@@ -1,11 +1,15 @@
 #version 450
 
+// Compact vertices are quantized, see Vertex_Quantization
+layout(constant_id = 0) const bool COMPACT_VERTICES = false;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTextureIndex;
 
 layout(binding = 0) uniform UniformBufferObject
 {
@@ -14,9 +18,37 @@ layout(binding = 0) uniform UniformBufferObject
     mat4 proj;
 } ubo;
 
+struct DrawData
+{
+    mat4 model;
+    vec4 bounding_sphere;
+    vec4 position_scale;
+    vec4 position_offset;
+    vec4 tex_coord_transform;
+    uint first_lod;
+    uint lod_count;
+    uint texture_index;
+};
+
+// firstInstance of every indirect draw is the index of its DrawData
+layout(std430, binding = 1) readonly buffer DrawDataBuffer
+{
+    DrawData draws[];
+};
+
 void main()
 {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    vec3 position = inPosition;
+    vec2 tex_coord = inTexCoord;
+
+    if (COMPACT_VERTICES)
+    {
+        position = draws[gl_InstanceIndex].position_offset.xyz + draws[gl_InstanceIndex].position_scale.xyz * position;
+        tex_coord = draws[gl_InstanceIndex].tex_coord_transform.zw + draws[gl_InstanceIndex].tex_coord_transform.xy * tex_coord;
+    }
+
+    gl_Position = ubo.proj * ubo.view * ubo.model * draws[gl_InstanceIndex].model * vec4(position, 1.0);
     fragColor = inColor;
-    fragTexCoord = inTexCoord;
+    fragTexCoord = tex_coord;
+    fragTextureIndex = draws[gl_InstanceIndex].texture_index;
 }
\ No newline at end of file
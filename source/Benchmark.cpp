@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+
+#include "Benchmark.hpp"
+#include "Json.hpp"
+
+void Benchmark::run(const Benchmark_Config& config, std::ostream& output)
+{
+	if (config.frame_count == 0)
+		throw std::runtime_error("A benchmark needs at least one frame.");
+
+	Renderer renderer;
+	renderer.set_headless(config.width, config.height);
+	renderer.set_synthetic_scene(config.object_count, config.triangle_count, config.texture_count);
+	renderer.set_recording_mode(config.recording_mode);
+	renderer.set_frames_in_flight(config.frames_in_flight);
+	renderer.set_low_latency(config.low_latency);
+	renderer.set_fixed_time_step(1.0f / 60.0f);
+
+	auto setup_start = std::chrono::steady_clock::now();
+	renderer.init_vulkan();
+	double setup_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - setup_start).count();
+
+	for (uint32_t i = 0; i < config.warmup_frame_count; i++)
+		renderer.draw_frame();
+
+	std::vector<double> cpu_frame_times;
+	std::vector<double> gpu_frame_times;
+	cpu_frame_times.reserve(config.frame_count);
+	gpu_frame_times.reserve(config.frame_count);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (uint32_t i = 0; i < config.frame_count; i++)
+	{
+		auto frame_start = std::chrono::steady_clock::now();
+		renderer.draw_frame();
+		cpu_frame_times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count());
+
+		// The GPU time of an earlier frame, read once its fence was waited on
+		double gpu_milliseconds;
+		if (renderer.get_gpu_frame_time(gpu_milliseconds))
+			gpu_frame_times.push_back(gpu_milliseconds);
+	}
+
+	vkDeviceWaitIdle(renderer.get_device());
+	double total_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::string device_name = renderer.get_device_name();
+	std::vector<GpuProfiler::Pass_Results> passes = renderer.get_gpu_profiler().get_results();
+	renderer.cleanup();
+
+	output << std::fixed << std::setprecision(4);
+	output << "{\n";
+	output << "  \"device\": \"" << Json::escape(device_name) << "\",\n";
+	output << "  \"config\": {\n";
+	output << "    \"frames\": " << config.frame_count << ",\n";
+	output << "    \"warmup_frames\": " << config.warmup_frame_count << ",\n";
+	output << "    \"width\": " << config.width << ",\n";
+	output << "    \"height\": " << config.height << ",\n";
+	output << "    \"objects\": " << config.object_count << ",\n";
+	output << "    \"triangles_per_object\": " << config.triangle_count << ",\n";
+	output << "    \"textures\": " << config.texture_count << ",\n";
+	output << "    \"recording_mode\": \"" << get_recording_mode_name(config.recording_mode) << "\",\n";
+	output << "    \"frames_in_flight\": " << config.frames_in_flight << ",\n";
+	output << "    \"low_latency\": " << (config.low_latency ? "true" : "false") << "\n";
+	output << "  },\n";
+	output << "  \"setup_ms\": " << setup_milliseconds << ",\n";
+	output << "  \"total_ms\": " << total_milliseconds << ",\n";
+	write_statistics(output, "cpu_frame_ms", std::move(cpu_frame_times));
+	output << ",\n";
+	write_statistics(output, "gpu_frame_ms", std::move(gpu_frame_times));
+	output << ",\n";
+	write_passes(output, passes);
+	output << "\n}\n";
+
+	if (!output)
+		throw std::runtime_error("Failed to write the benchmark results.");
+}
+
+const char* Benchmark::get_recording_mode_name(Renderer::RecordingMode mode)
+{
+	switch (mode)
+	{
+	case Renderer::RecordingMode::Immediate:
+		return "immediate";
+	case Renderer::RecordingMode::Cached:
+		return "cached";
+	case Renderer::RecordingMode::Parallel:
+		return "parallel";
+	}
+
+	return "unknown";
+}
+
+bool Benchmark::parse_recording_mode(const std::string& name, Renderer::RecordingMode& mode)
+{
+	for (auto candidate : { Renderer::RecordingMode::Immediate, Renderer::RecordingMode::Cached, Renderer::RecordingMode::Parallel })
+	{
+		if (name == get_recording_mode_name(candidate))
+		{
+			mode = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// The percentiles are nearest rank, they are always one of the measured times. Null without samples, e.g. when the
+// device can't write timestamps.
+void Benchmark::write_statistics(std::ostream& output, const char* name, std::vector<double> milliseconds)
+{
+	output << "  \"" << name << "\": ";
+
+	if (milliseconds.empty())
+	{
+		output << "null";
+		return;
+	}
+
+	std::sort(milliseconds.begin(), milliseconds.end());
+
+	double sum = 0.0;
+	for (double time : milliseconds)
+		sum += time;
+
+	auto percentile = [&milliseconds](double p)
+	{
+		size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * milliseconds.size()));
+		return milliseconds[std::max<size_t>(rank, 1) - 1];
+	};
+
+	output << "{\n";
+	output << "    \"samples\": " << milliseconds.size() << ",\n";
+	output << "    \"mean\": " << sum / milliseconds.size() << ",\n";
+	output << "    \"min\": " << milliseconds.front() << ",\n";
+	output << "    \"p50\": " << percentile(50.0) << ",\n";
+	output << "    \"p95\": " << percentile(95.0) << ",\n";
+	output << "    \"p99\": " << percentile(99.0) << ",\n";
+	output << "    \"max\": " << milliseconds.back() << "\n";
+	output << "  }";
+}
+
+// Averages over the last frames of the run, see GpuProfiler::ROLLING_FRAME_COUNT
+void Benchmark::write_passes(std::ostream& output, const std::vector<GpuProfiler::Pass_Results>& passes)
+{
+	output << "  \"passes\": [";
+
+	bool first = true;
+
+	for (const GpuProfiler::Pass_Results& pass : passes)
+	{
+		if (!pass.has_timings)
+			continue;
+
+		output << (first ? "\n" : ",\n");
+		output << "    { \"name\": \"" << Json::escape(pass.name) << "\", \"gpu_ms\": " << pass.milliseconds;
+
+		if (pass.has_statistics)
+		{
+			output << ", \"vertex_invocations\": " << std::setprecision(0) << pass.vertex_invocations
+				<< ", \"fragment_invocations\": " << pass.fragment_invocations << std::setprecision(4);
+		}
+
+		output << " }";
+		first = false;
+	}
+
+	output << (first ? "]" : "\n  ]");
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Renderer.hpp"
+
+struct Benchmark_Config
+{
+	// Frames that are measured, after the warmup ones
+	uint32_t frame_count = 1000;
+	// Frames drawn before measuring, so the textures are streamed in and the pipelines and command buffers are warm
+	uint32_t warmup_frame_count = 60;
+	uint32_t width = 1920;
+	uint32_t height = 1080;
+	uint32_t object_count = 1024;
+	uint32_t triangle_count = 2000;
+	uint32_t texture_count = 16;
+	Renderer::RecordingMode recording_mode = Renderer::RecordingMode::Cached;
+	// See Renderer::set_frames_in_flight and Renderer::set_low_latency
+	uint32_t frames_in_flight = 2;
+	bool low_latency = false;
+};
+
+// Draws a synthetic scene headless for a fixed number of frames and writes the frame times as JSON.
+//
+// The scene and the camera path only depend on the config: the objects are generated (see SyntheticScene) and the
+// camera orbit advances by a fixed step per frame, so two runs with the same config draw the same frames and can be
+// compared. Without a display it runs on build machines too, e.g. on lavapipe.
+class Benchmark
+{
+public:
+
+	static void run(const Benchmark_Config& config, std::ostream& output);
+
+	static const char* get_recording_mode_name(Renderer::RecordingMode mode);
+	// False when the name isn't one of get_recording_mode_name
+	static bool parse_recording_mode(const std::string& name, Renderer::RecordingMode& mode);
+
+private:
+
+	static void write_statistics(std::ostream& output, const char* name, std::vector<double> milliseconds);
+	static void write_passes(std::ostream& output, const std::vector<GpuProfiler::Pass_Results>& passes);
+};
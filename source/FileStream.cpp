@@ -1,7 +1,12 @@
+#include <filesystem>
+
 #include "FileStream.hpp"
+#include "Trace.hpp"
 
 std::vector<char> FileStream::read_file(const std::string& filename)
 {
+	TRACE_SCOPE("FileStream::read_file");
+
 	// We start reading at the end of the file so we can easily determine the size of the file and allocate a buffer
 	std::ifstream input(filename, std::ios::ate | std::ios::binary);
 
@@ -20,3 +25,32 @@ std::vector<char> FileStream::read_file(const std::string& filename)
 
 	return buffer;
 }
+
+bool FileStream::get_file_info(const std::string& path, File_Info& info)
+{
+	std::error_code error;
+
+	uintmax_t size = std::filesystem::file_size(path, error);
+	if (error)
+		return false;
+
+	std::filesystem::file_time_type modification_time = std::filesystem::last_write_time(path, error);
+	if (error)
+		return false;
+
+	info.size = size;
+	info.modification_time = static_cast<int64_t>(modification_time.time_since_epoch().count());
+
+	return true;
+}
+
+std::string FileStream::replace_extension(const std::string& path, const std::string& extension)
+{
+	size_t dot = path.find_last_of('.');
+	size_t directory = path.find_last_of("/\\");
+
+	if (dot == std::string::npos || (directory != std::string::npos && dot < directory))
+		return path + extension;
+
+	return path.substr(0, dot) + extension;
+}
@@ -1,10 +1,22 @@
 #pragma once
 
+#include <cstdint>
+#include <string>
 #include <vector>
 #include <fstream>
 
+// Identifies the version of a file, the caches compare it with what they were made from
+struct File_Info
+{
+	uint64_t size = 0;
+	int64_t modification_time = 0;
+};
+
 class FileStream
 {
 public:
 	static std::vector<char> read_file(const std::string& filename);
+	static bool get_file_info(const std::string& path, File_Info& info);
+	// textures/name.png, ".ktx2" -> textures/name.ktx2, the extension is appended when the file name has none
+	static std::string replace_extension(const std::string& path, const std::string& extension);
 };
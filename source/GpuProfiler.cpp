@@ -0,0 +1,227 @@
+#include <cstdio>
+#include <stdexcept>
+
+#include "GpuProfiler.hpp"
+
+// The order of the statistics in the results follows the bits, vertex invocations first
+static const VkQueryPipelineStatisticFlags STATISTIC_FLAGS =
+	VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+uint32_t GpuProfiler::add_pass(const std::string& name)
+{
+	if (device != VK_NULL_HANDLE)
+		throw std::runtime_error("Profiler passes have to be added before init.");
+
+	Pass_Results pass;
+	pass.name = name;
+	results.push_back(pass);
+	histories.emplace_back();
+
+	return get_pass_count() - 1;
+}
+
+void GpuProfiler::init(VkPhysicalDevice physical_device, VkDevice device, uint32_t queue_family_index, uint32_t frames_in_flight, bool pipeline_statistics)
+{
+	this->device = device;
+	this->frames_in_flight = frames_in_flight;
+	frames_submitted.assign(frames_in_flight, false);
+
+	uint32_t queue_family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, nullptr);
+
+	std::vector<VkQueueFamilyProperties> queue_families_properties(queue_family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_families_properties.data());
+
+	uint32_t valid_bits = queue_families_properties[queue_family_index].timestampValidBits;
+
+	if (valid_bits == 0 || results.empty())
+		return;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+	timestamp_period = properties.limits.timestampPeriod;
+	timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+	VkQueryPoolCreateInfo pool_info{};
+	pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	pool_info.queryCount = 2 * get_pass_count() * frames_in_flight;
+
+	if (vkCreateQueryPool(device, &pool_info, nullptr, &timestamp_query_pool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create timestamp query pool.");
+
+	if (!pipeline_statistics)
+		return;
+
+	pool_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	pool_info.queryCount = get_pass_count() * frames_in_flight;
+	pool_info.pipelineStatistics = STATISTIC_FLAGS;
+
+	if (vkCreateQueryPool(device, &pool_info, nullptr, &statistics_query_pool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create pipeline statistics query pool.");
+}
+
+void GpuProfiler::cleanup()
+{
+	if (timestamp_query_pool != VK_NULL_HANDLE)
+		vkDestroyQueryPool(device, timestamp_query_pool, nullptr);
+
+	if (statistics_query_pool != VK_NULL_HANDLE)
+		vkDestroyQueryPool(device, statistics_query_pool, nullptr);
+
+	timestamp_query_pool = VK_NULL_HANDLE;
+	statistics_query_pool = VK_NULL_HANDLE;
+}
+
+VkQueryPipelineStatisticFlags GpuProfiler::get_statistic_flags() const
+{
+	return has_pipeline_statistics() ? STATISTIC_FLAGS : 0;
+}
+
+void GpuProfiler::reset(VkCommandBuffer command_buffer, uint32_t frame)
+{
+	if (!is_enabled())
+		return;
+
+	vkCmdResetQueryPool(command_buffer, timestamp_query_pool, 2 * get_pass_count() * frame, 2 * get_pass_count());
+
+	if (has_pipeline_statistics())
+		vkCmdResetQueryPool(command_buffer, statistics_query_pool, get_pass_count() * frame, get_pass_count());
+}
+
+void GpuProfiler::begin_pass(VkCommandBuffer command_buffer, uint32_t frame, uint32_t pass, bool statistics)
+{
+	if (!is_enabled())
+		return;
+
+	vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_query_pool, 2 * (get_pass_count() * frame + pass));
+
+	if (statistics && has_pipeline_statistics())
+	{
+		if (statistics_pass != NO_PASS)
+			throw std::runtime_error("Only one profiler pass can count pipeline statistics at a time.");
+
+		vkCmdBeginQuery(command_buffer, statistics_query_pool, get_pass_count() * frame + pass, 0);
+		statistics_pass = pass;
+	}
+}
+
+void GpuProfiler::end_pass(VkCommandBuffer command_buffer, uint32_t frame, uint32_t pass)
+{
+	if (!is_enabled())
+		return;
+
+	if (statistics_pass == pass)
+	{
+		vkCmdEndQuery(command_buffer, statistics_query_pool, get_pass_count() * frame + pass);
+		statistics_pass = NO_PASS;
+	}
+
+	vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_query_pool, 2 * (get_pass_count() * frame + pass) + 1);
+}
+
+void GpuProfiler::frame_submitted(uint32_t frame)
+{
+	if (is_enabled())
+		frames_submitted[frame] = true;
+}
+
+void GpuProfiler::read_results(uint32_t frame)
+{
+	for (Pass_Results& pass : results)
+		pass.last_milliseconds = -1.0;
+
+	if (!is_enabled() || !frames_submitted[frame])
+		return;
+
+	// The fence of the frame was waited on, so every query its command buffer wrote is available. The passes that weren't
+	// recorded stay unavailable, which is why the results are read with their availability instead of waiting.
+	// VK_NOT_READY just means that some are.
+	std::vector<uint64_t> timestamps(2 * 2 * get_pass_count());
+
+	VkResult result = vkGetQueryPoolResults(device, timestamp_query_pool, 2 * get_pass_count() * frame, 2 * get_pass_count(),
+		timestamps.size() * sizeof(uint64_t), timestamps.data(), 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	if (result != VK_SUCCESS && result != VK_NOT_READY)
+		throw std::runtime_error("Failed to read the timestamp queries.");
+
+	for (uint32_t pass = 0; pass < get_pass_count(); pass++)
+	{
+		const uint64_t* begin = &timestamps[4 * pass];
+		const uint64_t* end = &timestamps[4 * pass + 2];
+
+		if (begin[1] == 0 || end[1] == 0)
+			continue;
+
+		// The counter can wrap around between the two
+		uint64_t ticks = (end[0] - begin[0]) & timestamp_mask;
+		double milliseconds = ticks * timestamp_period / 1000000.0;
+
+		results[pass].last_milliseconds = milliseconds;
+		results[pass].has_timings = true;
+		histories[pass].milliseconds.add(milliseconds);
+		results[pass].milliseconds = histories[pass].milliseconds.get();
+	}
+
+	if (!has_pipeline_statistics())
+		return;
+
+	// Vertex invocations, fragment invocations and the availability of every query
+	std::vector<uint64_t> statistics(3 * get_pass_count());
+
+	result = vkGetQueryPoolResults(device, statistics_query_pool, get_pass_count() * frame, get_pass_count(),
+		statistics.size() * sizeof(uint64_t), statistics.data(), 3 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	if (result != VK_SUCCESS && result != VK_NOT_READY)
+		throw std::runtime_error("Failed to read the pipeline statistics queries.");
+
+	for (uint32_t pass = 0; pass < get_pass_count(); pass++)
+	{
+		const uint64_t* pass_statistics = &statistics[3 * pass];
+
+		if (pass_statistics[2] == 0)
+			continue;
+
+		results[pass].has_statistics = true;
+		histories[pass].vertex_invocations.add(static_cast<double>(pass_statistics[0]));
+		histories[pass].fragment_invocations.add(static_cast<double>(pass_statistics[1]));
+		results[pass].vertex_invocations = histories[pass].vertex_invocations.get();
+		results[pass].fragment_invocations = histories[pass].fragment_invocations.get();
+	}
+}
+
+std::string GpuProfiler::get_report() const
+{
+	std::string report;
+
+	for (const Pass_Results& pass : results)
+	{
+		if (!pass.has_timings)
+			continue;
+
+		char line[256];
+
+		if (pass.has_statistics)
+			snprintf(line, sizeof(line), "%-16s %8.3f ms %14.0f vertices %14.0f fragments\n", pass.name.c_str(), pass.milliseconds,
+				pass.vertex_invocations, pass.fragment_invocations);
+		else
+			snprintf(line, sizeof(line), "%-16s %8.3f ms\n", pass.name.c_str(), pass.milliseconds);
+
+		report += line;
+	}
+
+	return report;
+}
+
+void GpuProfiler::Rolling_Average::add(double sample)
+{
+	if (count == ROLLING_FRAME_COUNT)
+		sum -= samples[next];
+	else
+		count++;
+
+	samples[next] = sample;
+	sum += sample;
+	next = (next + 1) % ROLLING_FRAME_COUNT;
+}
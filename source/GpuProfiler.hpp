@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Measures passes of the frame on the GPU: every pass is wrapped in a pair of timestamps, and the passes that ask for it
+// count their vertex and fragment shader invocations with a pipeline statistics query.
+//
+// Every frame in flight has its own queries. The command buffer of a frame resets them itself before writing any, so
+// cached command buffers keep being measured. The results are read once the fence of the frame was waited on, they lag
+// frames_in_flight frames behind but reading them never stalls. A pass that wasn't recorded in a frame leaves its
+// queries unavailable and just gets no sample for it.
+class GpuProfiler
+{
+public:
+
+	struct Pass_Results
+	{
+		std::string name;
+		// Averages over the last ROLLING_FRAME_COUNT frames the pass was measured in
+		double milliseconds = 0.0;
+		double vertex_invocations = 0.0;
+		double fragment_invocations = 0.0;
+		// GPU time in the last frame that was read, negative when the pass wasn't measured in it
+		double last_milliseconds = -1.0;
+		bool has_timings = false;
+		bool has_statistics = false;
+	};
+
+	static const uint32_t ROLLING_FRAME_COUNT = 64;
+
+	// Passes are added before init, the returned index identifies the pass when recording
+	uint32_t add_pass(const std::string& name);
+
+	// Stays disabled (and records nothing) when the queue family can't write timestamps. Pipeline statistics need the
+	// pipelineStatisticsQuery feature to be enabled on the device.
+	void init(VkPhysicalDevice physical_device, VkDevice device, uint32_t queue_family_index, uint32_t frames_in_flight, bool pipeline_statistics);
+	void cleanup();
+
+	bool is_enabled() const { return timestamp_query_pool != VK_NULL_HANDLE; }
+	bool has_pipeline_statistics() const { return statistics_query_pool != VK_NULL_HANDLE; }
+	// What secondary command buffers executed inside a pass with statistics inherit, see VkCommandBufferInheritanceInfo
+	VkQueryPipelineStatisticFlags get_statistic_flags() const;
+
+	// Resets the queries of the frame, has to be recorded before any pass of the frame and outside of a render pass
+	void reset(VkCommandBuffer command_buffer, uint32_t frame);
+	// Only one pass can count statistics at a time, and it has to begin and end in the same subpass or outside of render passes
+	void begin_pass(VkCommandBuffer command_buffer, uint32_t frame, uint32_t pass, bool statistics = false);
+	void end_pass(VkCommandBuffer command_buffer, uint32_t frame, uint32_t pass);
+
+	// Call after the command buffer that reset the queries of the frame was submitted
+	void frame_submitted(uint32_t frame);
+	// Call once the fence of the frame was waited on
+	void read_results(uint32_t frame);
+
+	const std::vector<Pass_Results>& get_results() const { return results; }
+	// One line per pass
+	std::string get_report() const;
+
+private:
+
+	struct Rolling_Average
+	{
+		std::array<double, ROLLING_FRAME_COUNT> samples{};
+		uint32_t count = 0;
+		uint32_t next = 0;
+		double sum = 0.0;
+
+		void add(double sample);
+		double get() const { return count > 0 ? sum / count : 0.0; }
+	};
+
+	struct Pass_History
+	{
+		Rolling_Average milliseconds;
+		Rolling_Average vertex_invocations;
+		Rolling_Average fragment_invocations;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	uint32_t frames_in_flight = 0;
+	// A begin and an end timestamp per pass and frame in flight
+	VkQueryPool timestamp_query_pool = VK_NULL_HANDLE;
+	// A query per pass and frame in flight
+	VkQueryPool statistics_query_pool = VK_NULL_HANDLE;
+	// Nanoseconds per tick
+	double timestamp_period = 0.0;
+	// The bits of the timestamps that are valid
+	uint64_t timestamp_mask = 0;
+	// Whether the queries of the frame were reset by a submitted command buffer, they can't be read before that
+	std::vector<bool> frames_submitted;
+
+	// The pass with an active statistics query while recording
+	static const uint32_t NO_PASS = UINT32_MAX;
+	uint32_t statistics_pass = NO_PASS;
+
+	std::vector<Pass_Results> results;
+	std::vector<Pass_History> histories;
+
+	uint32_t get_pass_count() const { return static_cast<uint32_t>(results.size()); }
+};
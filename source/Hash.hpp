@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// 64-bit hash over raw bytes, 8 bytes at a time with a strong final mix (splitmix64 finalizer).
+// Fast enough to run over whole vertex and index blobs, not meant to be cryptographic.
+class Hash
+{
+public:
+
+	static uint64_t mix(uint64_t value)
+	{
+		value ^= value >> 30;
+		value *= 0xBF58476D1CE4E5B9ull;
+		value ^= value >> 27;
+		value *= 0x94D049BB133111EBull;
+		value ^= value >> 31;
+		return value;
+	}
+
+	static uint64_t bytes(const void* data, size_t size, uint64_t seed = 0)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		uint64_t result = seed ^ (size * PRIME);
+
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, bytes + i, 8);
+			result = rotate_left(result ^ mix(word), 27) * PRIME;
+		}
+
+		if (i < size)
+		{
+			uint64_t word = 0;
+			memcpy(&word, bytes + i, size - i);
+			result = rotate_left(result ^ mix(word), 27) * PRIME;
+		}
+
+		return mix(result);
+	}
+
+private:
+
+	static const uint64_t PRIME = 0x9E3779B97F4A7C15ull;
+
+	static uint64_t rotate_left(uint64_t value, int shift)
+	{
+		return (value << shift) | (value >> (64 - shift));
+	}
+};
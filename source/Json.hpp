@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+// Helpers for the JSON files written by hand (benchmark reports, traces)
+class Json
+{
+public:
+
+	// Text ready to go between double quotes, control characters become \u00XX
+	static std::string escape(const std::string& text)
+	{
+		std::string escaped;
+
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				escaped += '\\';
+				escaped += c;
+			}
+			else if (static_cast<unsigned char>(c) < 0x20)
+			{
+				char code[8];
+				snprintf(code, sizeof(code), "\\u%04x", c);
+				escaped += code;
+			}
+			else
+				escaped += c;
+		}
+
+		return escaped;
+	}
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file, the pages are loaded by the OS as they are touched
+class MappedFile
+{
+public:
+
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Returns false if the file can't be opened or is empty
+	bool open(const std::string& path);
+	void close();
+
+	const void* get_data() const { return data; }
+	size_t get_size() const { return size; }
+
+private:
+
+	const void* data = nullptr;
+	size_t size = 0;
+
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+};
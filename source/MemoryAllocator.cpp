@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include "MemoryAllocator.hpp"
+
+void MemoryAllocator::init(VkPhysicalDevice physical_device, VkDevice device)
+{
+	this->device = device;
+
+	vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+	VkPhysicalDeviceProperties properties{};
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	buffer_image_granularity = properties.limits.bufferImageGranularity;
+
+	// Buffers and optimally tiled images placed next to each other in the same memory have to be at least
+	// bufferImageGranularity apart. Instead of padding every allocation we keep them in separate pools.
+	pools.resize(memory_properties.memoryTypeCount * 2);
+
+	for (uint32_t i = 0; i < static_cast<uint32_t>(pools.size()); i++)
+	{
+		Pool& pool = pools[i];
+		pool.memory_type = i / 2;
+
+		// Small heaps (like the 256 MB host visible device local heap) would be eaten by a couple of default sized blocks
+		VkDeviceSize heap_size = memory_properties.memoryHeaps[memory_properties.memoryTypes[pool.memory_type].heapIndex].size;
+		pool.block_size = DEFAULT_BLOCK_SIZE;
+
+		while (pool.block_size > MIN_ALLOCATION_SIZE && pool.block_size > heap_size / 8)
+			pool.block_size /= 2;
+
+		pool.max_order = get_order(pool.block_size);
+	}
+}
+
+void MemoryAllocator::cleanup()
+{
+	for (auto& pool : pools)
+	{
+		for (auto& block : pool.blocks)
+		{
+			if (block.memory == VK_NULL_HANDLE)
+				continue;
+
+			if (block.allocation_count != 0)
+				std::cerr << "MemoryAllocator: " << block.allocation_count << " allocations were not freed.\n";
+
+			destroy_block(block);
+		}
+	}
+
+	if (dedicated_allocation_count != 0)
+		std::cerr << "MemoryAllocator: " << dedicated_allocation_count << " dedicated allocations were not freed.\n";
+
+	pools.clear();
+}
+
+MemoryAllocation MemoryAllocator::allocate_for_buffer(VkBuffer buffer, VkMemoryPropertyFlags properties)
+{
+	VkMemoryDedicatedRequirements dedicated_requirements{};
+	dedicated_requirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+	VkMemoryRequirements2 requirements{};
+	requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+	requirements.pNext = &dedicated_requirements;
+
+	VkBufferMemoryRequirementsInfo2 info{};
+	info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+	info.buffer = buffer;
+
+	vkGetBufferMemoryRequirements2(device, &info, &requirements);
+
+	bool dedicated = dedicated_requirements.requiresDedicatedAllocation || dedicated_requirements.prefersDedicatedAllocation;
+
+	return allocate(requirements.memoryRequirements, properties, ResourceKind::Linear, dedicated, buffer, VK_NULL_HANDLE);
+}
+
+MemoryAllocation MemoryAllocator::allocate_for_image(VkImage image, VkMemoryPropertyFlags properties, bool prefer_dedicated)
+{
+	VkMemoryDedicatedRequirements dedicated_requirements{};
+	dedicated_requirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+	VkMemoryRequirements2 requirements{};
+	requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+	requirements.pNext = &dedicated_requirements;
+
+	VkImageMemoryRequirementsInfo2 info{};
+	info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+	info.image = image;
+
+	vkGetImageMemoryRequirements2(device, &info, &requirements);
+
+	bool dedicated = prefer_dedicated || dedicated_requirements.requiresDedicatedAllocation || dedicated_requirements.prefersDedicatedAllocation;
+
+	// NOTE: We only create optimally tiled images, linear ones would have to go to the linear pools
+	return allocate(requirements.memoryRequirements, properties, ResourceKind::Optimal, dedicated, VK_NULL_HANDLE, image);
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+	ResourceKind kind, bool dedicated, VkBuffer dedicated_buffer, VkImage dedicated_image)
+{
+	uint32_t memory_type = find_memory_type(requirements.memoryTypeBits, properties);
+
+	uint32_t pool_index = get_pool_index(memory_type, kind);
+	Pool& pool = pools[pool_index];
+
+	// Buddy ranges are aligned to their own size, so rounding the size up to the alignment is enough to satisfy it
+	VkDeviceSize size = std::max(requirements.size, requirements.alignment);
+
+	if (dedicated || size > pool.block_size / 2)
+		return allocate_dedicated(requirements, memory_type, dedicated_buffer, dedicated_image);
+
+	uint32_t order = get_order(size);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	MemoryAllocation allocation{};
+	allocation.pool_index = pool_index;
+
+	for (uint32_t i = 0; i < static_cast<uint32_t>(pool.blocks.size()); i++)
+	{
+		if (pool.blocks[i].memory != VK_NULL_HANDLE && allocate_from_block(pool, i, order, requirements.size, allocation))
+			return allocation;
+	}
+
+	uint32_t block_index = create_block(pool);
+
+	if (!allocate_from_block(pool, block_index, order, requirements.size, allocation))
+		throw std::runtime_error("Failed to sub-allocate from a new memory block.");
+
+	return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocate_dedicated(const VkMemoryRequirements& requirements, uint32_t memory_type,
+	VkBuffer buffer, VkImage image)
+{
+	// Lets the driver place the resource optimally, e.g. use a compressed layout for render targets
+	VkMemoryDedicatedAllocateInfo dedicated_info{};
+	dedicated_info.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+	dedicated_info.buffer = buffer;
+	dedicated_info.image = image;
+
+	VkMemoryAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.pNext = &dedicated_info;
+	alloc_info.allocationSize = requirements.size;
+	alloc_info.memoryTypeIndex = memory_type;
+
+	MemoryAllocation allocation{};
+	allocation.size = requirements.size;
+	allocation.memory_type = memory_type;
+
+	if (vkAllocateMemory(device, &alloc_info, nullptr, &allocation.memory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate dedicated device memory.");
+
+	if (is_host_visible(memory_type))
+		vkMapMemory(device, allocation.memory, 0, VK_WHOLE_SIZE, 0, &allocation.mapped_data);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	dedicated_allocation_count++;
+	dedicated_bytes += allocation.size;
+
+	return allocation;
+}
+
+bool MemoryAllocator::allocate_from_block(Pool& pool, uint32_t block_index, uint32_t order, VkDeviceSize requested_size, MemoryAllocation& allocation)
+{
+	Block& block = pool.blocks[block_index];
+
+	uint32_t free_order = order;
+	while (free_order <= pool.max_order && block.free_lists[free_order].empty())
+		free_order++;
+
+	if (free_order > pool.max_order)
+		return false;
+
+	VkDeviceSize offset = *block.free_lists[free_order].begin();
+	block.free_lists[free_order].erase(block.free_lists[free_order].begin());
+
+	// Split the range in halves until it has the requested size, the upper halves become free buddies
+	while (free_order > order)
+	{
+		free_order--;
+		block.free_lists[free_order].insert(offset + (MIN_ALLOCATION_SIZE << free_order));
+	}
+
+	VkDeviceSize size = MIN_ALLOCATION_SIZE << order;
+
+	block.used_bytes += size;
+	block.requested_bytes += requested_size;
+	block.allocation_count++;
+
+	allocation.memory = block.memory;
+	allocation.offset = offset;
+	allocation.size = requested_size;
+	allocation.mapped_data = block.mapped_data ? static_cast<char*>(block.mapped_data) + offset : nullptr;
+	allocation.memory_type = pool.memory_type;
+	allocation.block_index = block_index;
+	allocation.order = order;
+
+	return true;
+}
+
+void MemoryAllocator::free(MemoryAllocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+		return;
+
+	if (allocation.is_dedicated())
+	{
+		vkFreeMemory(device, allocation.memory, nullptr);
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		dedicated_allocation_count--;
+		dedicated_bytes -= allocation.size;
+
+		allocation = MemoryAllocation{};
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Pool& pool = pools[allocation.pool_index];
+	Block& block = pool.blocks[allocation.block_index];
+
+	VkDeviceSize offset = allocation.offset;
+	uint32_t order = allocation.order;
+
+	block.used_bytes -= MIN_ALLOCATION_SIZE << order;
+	block.requested_bytes -= allocation.size;
+	block.allocation_count--;
+
+	// Merge with the buddy as long as it is free as well
+	while (order < pool.max_order)
+	{
+		VkDeviceSize buddy = offset ^ (MIN_ALLOCATION_SIZE << order);
+
+		if (block.free_lists[order].erase(buddy) == 0)
+			break;
+
+		offset = std::min(offset, buddy);
+		order++;
+	}
+
+	block.free_lists[order].insert(offset);
+
+	// Give empty blocks back to the driver, but keep one around so we don't thrash when allocating and freeing in a loop
+	if (block.allocation_count == 0)
+	{
+		uint32_t live_blocks = 0;
+		for (const auto& pool_block : pool.blocks)
+		{
+			if (pool_block.memory != VK_NULL_HANDLE)
+				live_blocks++;
+		}
+
+		if (live_blocks > 1)
+			destroy_block(block);
+	}
+
+	allocation = MemoryAllocation{};
+}
+
+uint32_t MemoryAllocator::create_block(Pool& pool)
+{
+	VkMemoryAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = pool.block_size;
+	alloc_info.memoryTypeIndex = pool.memory_type;
+
+	Block block{};
+
+	if (vkAllocateMemory(device, &alloc_info, nullptr, &block.memory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate a device memory block.");
+
+	// Host visible blocks stay mapped for their whole lifetime, mapping the same memory twice is not allowed anyway
+	if (is_host_visible(pool.memory_type))
+		vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped_data);
+
+	block.free_lists.resize(pool.max_order + 1);
+	block.free_lists[pool.max_order].insert(0);
+
+	// Reuse the slot of a destroyed block so the indices stored in live allocations stay valid
+	for (uint32_t i = 0; i < static_cast<uint32_t>(pool.blocks.size()); i++)
+	{
+		if (pool.blocks[i].memory == VK_NULL_HANDLE)
+		{
+			pool.blocks[i] = std::move(block);
+			return i;
+		}
+	}
+
+	pool.blocks.push_back(std::move(block));
+	return static_cast<uint32_t>(pool.blocks.size() - 1);
+}
+
+void MemoryAllocator::destroy_block(Block& block)
+{
+	vkFreeMemory(device, block.memory, nullptr);
+	block = Block{};
+}
+
+uint32_t MemoryAllocator::find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+	{
+		if (type_filter & (1 << i) && (memory_properties.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+	}
+
+	throw std::runtime_error("Failed to find sustainable memory type.");
+}
+
+uint32_t MemoryAllocator::get_pool_index(uint32_t memory_type, ResourceKind kind) const
+{
+	// When the granularity is not bigger than our smallest range, neighbours can never share a granularity page
+	if (buffer_image_granularity <= MIN_ALLOCATION_SIZE)
+		return memory_type * 2;
+
+	return memory_type * 2 + (kind == ResourceKind::Optimal ? 1 : 0);
+}
+
+bool MemoryAllocator::is_host_visible(uint32_t memory_type) const
+{
+	return memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+uint32_t MemoryAllocator::get_order(VkDeviceSize size)
+{
+	uint32_t order = 0;
+	while ((MIN_ALLOCATION_SIZE << order) < size)
+		order++;
+
+	return order;
+}
+
+MemoryAllocatorStats MemoryAllocator::get_stats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	MemoryAllocatorStats stats{};
+
+	for (const auto& pool : pools)
+	{
+		for (const auto& block : pool.blocks)
+		{
+			if (block.memory == VK_NULL_HANDLE)
+				continue;
+
+			stats.block_count++;
+			stats.allocation_count += block.allocation_count;
+			stats.reserved_bytes += pool.block_size;
+			stats.used_bytes += block.used_bytes;
+			stats.requested_bytes += block.requested_bytes;
+			stats.free_bytes += pool.block_size - block.used_bytes;
+
+			for (uint32_t order = pool.max_order + 1; order-- > 0;)
+			{
+				if (!block.free_lists[order].empty())
+				{
+					stats.largest_free_range = std::max(stats.largest_free_range, MIN_ALLOCATION_SIZE << order);
+					break;
+				}
+			}
+		}
+	}
+
+	stats.dedicated_allocation_count = dedicated_allocation_count;
+	stats.allocation_count += dedicated_allocation_count;
+	stats.reserved_bytes += dedicated_bytes;
+	stats.used_bytes += dedicated_bytes;
+	stats.requested_bytes += dedicated_bytes;
+
+	if (stats.used_bytes > 0)
+		stats.internal_fragmentation = 1.0f - static_cast<float>(stats.requested_bytes) / static_cast<float>(stats.used_bytes);
+
+	if (stats.free_bytes > 0)
+		stats.external_fragmentation = 1.0f - static_cast<float>(stats.largest_free_range) / static_cast<float>(stats.free_bytes);
+
+	return stats;
+}
+
+void MemoryAllocator::print_stats()
+{
+	MemoryAllocatorStats stats = get_stats();
+
+	std::cout << "Device memory:\n"
+		<< "  blocks: " << stats.block_count << ", dedicated allocations: " << stats.dedicated_allocation_count
+		<< ", allocations: " << stats.allocation_count << "\n"
+		<< "  reserved: " << stats.reserved_bytes / 1024 << " KB, used: " << stats.used_bytes / 1024
+		<< " KB, requested: " << stats.requested_bytes / 1024 << " KB\n"
+		<< "  free: " << stats.free_bytes / 1024 << " KB, largest free range: " << stats.largest_free_range / 1024 << " KB\n"
+		<< "  internal fragmentation: " << stats.internal_fragmentation * 100.0f
+		<< "%, external fragmentation: " << stats.external_fragmentation * 100.0f << "%\n\n";
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Handle to a piece of device memory returned by the MemoryAllocator.
+// Pooled allocations live at (block, offset) inside a larger VkDeviceMemory, dedicated allocations own their memory.
+struct MemoryAllocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	// Non-null for host visible memory, blocks are persistently mapped so this already points at offset
+	void* mapped_data = nullptr;
+	uint32_t memory_type = 0;
+	uint32_t pool_index = 0;
+	uint32_t block_index = UINT32_MAX;
+	uint32_t order = 0;
+
+	bool is_dedicated() const { return block_index == UINT32_MAX; }
+};
+
+struct MemoryAllocatorStats
+{
+	uint32_t block_count = 0;
+	uint32_t dedicated_allocation_count = 0;
+	uint32_t allocation_count = 0;
+	VkDeviceSize reserved_bytes = 0;
+	VkDeviceSize used_bytes = 0;
+	VkDeviceSize requested_bytes = 0;
+	VkDeviceSize free_bytes = 0;
+	VkDeviceSize largest_free_range = 0;
+
+	// Memory lost to rounding allocations up to the buddy sizes
+	float internal_fragmentation = 0.0f;
+	// 1 - largest free range / total free, 0 means all the free memory is in one piece
+	float external_fragmentation = 0.0f;
+};
+
+// https://vulkan-tutorial.com/en/Vertex_buffers/Staging_buffer#page_Conclusion
+// Sub-allocates buffers and images from large VkDeviceMemory blocks instead of calling vkAllocateMemory per resource,
+// the number of live allocations is limited by maxMemoryAllocationCount which can be as low as 4096.
+// Every memory type has its own pool of blocks and the offsets inside a block are handed out by a buddy allocator.
+class MemoryAllocator
+{
+public:
+
+	void init(VkPhysicalDevice physical_device, VkDevice device);
+	void cleanup();
+
+	MemoryAllocation allocate_for_buffer(VkBuffer buffer, VkMemoryPropertyFlags properties);
+	// Render targets and other big images should pass prefer_dedicated so they get their own VkDeviceMemory
+	MemoryAllocation allocate_for_image(VkImage image, VkMemoryPropertyFlags properties, bool prefer_dedicated = false);
+	void free(MemoryAllocation& allocation);
+
+	uint32_t find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties) const;
+	MemoryAllocatorStats get_stats();
+	void print_stats();
+
+	// Smallest piece of memory handed out by a block, smaller requests are rounded up to it
+	static constexpr VkDeviceSize MIN_ALLOCATION_SIZE = 256;
+	static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+private:
+
+	enum class ResourceKind
+	{
+		Linear,
+		Optimal
+	};
+
+	struct Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void* mapped_data = nullptr;
+		VkDeviceSize used_bytes = 0;
+		VkDeviceSize requested_bytes = 0;
+		uint32_t allocation_count = 0;
+		// free_lists[order] holds offsets of free ranges of size MIN_ALLOCATION_SIZE << order
+		std::vector<std::set<VkDeviceSize>> free_lists;
+	};
+
+	struct Pool
+	{
+		uint32_t memory_type = 0;
+		VkDeviceSize block_size = 0;
+		uint32_t max_order = 0;
+		std::vector<Block> blocks;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memory_properties{};
+	VkDeviceSize buffer_image_granularity = 1;
+	std::vector<Pool> pools;
+	std::mutex mutex;
+
+	uint32_t dedicated_allocation_count = 0;
+	VkDeviceSize dedicated_bytes = 0;
+
+	MemoryAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+		ResourceKind kind, bool dedicated, VkBuffer dedicated_buffer, VkImage dedicated_image);
+	MemoryAllocation allocate_dedicated(const VkMemoryRequirements& requirements, uint32_t memory_type,
+		VkBuffer buffer, VkImage image);
+	bool allocate_from_block(Pool& pool, uint32_t block_index, uint32_t order, VkDeviceSize requested_size, MemoryAllocation& allocation);
+	uint32_t create_block(Pool& pool);
+	void destroy_block(Block& block);
+	uint32_t get_pool_index(uint32_t memory_type, ResourceKind kind) const;
+	bool is_host_visible(uint32_t memory_type) const;
+	static uint32_t get_order(VkDeviceSize size);
+};
@@ -0,0 +1,154 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "Hash.hpp"
+#include "MappedFile.hpp"
+#include "MeshCache.hpp"
+#include "Trace.hpp"
+
+bool MeshCache::read(const std::string& path, const File_Info* source, uint32_t flags,
+	std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, glm::vec4& bounding_sphere)
+{
+	TRACE_SCOPE("MeshCache::read");
+
+	MappedFile file;
+
+	if (!file.open(path))
+		return false;
+
+	const char* data = static_cast<const char*>(file.get_data());
+	FileHeader header;
+
+	if (file.get_size() < sizeof(header))
+		return false;
+
+	memcpy(&header, data, sizeof(header));
+
+	if (header.magic != FILE_MAGIC || header.version != FILE_VERSION || header.vertex_stride != sizeof(Vertex))
+		return false;
+
+	if (source != nullptr && (header.source_size != source->size || header.source_modification_time != source->modification_time
+		|| header.flags != flags))
+		return false;
+
+	// The counts of a damaged header can be so large that the sizes below wrap around and pass the checks after them
+	if (header.vertex_count > file.get_size() / sizeof(Vertex) || header.index_count > file.get_size() / sizeof(uint32_t))
+	{
+		std::cout << "Mesh cache " << path << " is truncated, ignoring it.\n";
+		return false;
+	}
+
+	uint64_t vertices_size = header.vertex_count * sizeof(Vertex);
+	uint64_t indices_size = header.index_count * sizeof(uint32_t);
+
+	if (header.vertices_offset > file.get_size() || vertices_size > file.get_size() - header.vertices_offset
+		|| header.indices_offset > file.get_size() || indices_size > file.get_size() - header.indices_offset)
+	{
+		std::cout << "Mesh cache " << path << " is truncated, ignoring it.\n";
+		return false;
+	}
+
+	const char* vertex_data = data + header.vertices_offset;
+	const char* index_data = data + header.indices_offset;
+
+	if (hash_content(vertex_data, static_cast<size_t>(vertices_size), index_data, static_cast<size_t>(indices_size)) != header.content_hash)
+	{
+		std::cout << "Mesh cache " << path << " is damaged, ignoring it.\n";
+		return false;
+	}
+
+	vertices.resize(static_cast<size_t>(header.vertex_count));
+	indices.resize(static_cast<size_t>(header.index_count));
+	memcpy(vertices.data(), vertex_data, static_cast<size_t>(vertices_size));
+	memcpy(indices.data(), index_data, static_cast<size_t>(indices_size));
+
+	bounding_sphere = glm::vec4(header.bounding_sphere[0], header.bounding_sphere[1], header.bounding_sphere[2], header.bounding_sphere[3]);
+
+	return true;
+}
+
+void MeshCache::write(const std::string& path, const File_Info& source, uint32_t flags,
+	const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	TRACE_SCOPE("MeshCache::write");
+
+	size_t vertices_size = vertices.size() * sizeof(Vertex);
+	size_t indices_size = indices.size() * sizeof(uint32_t);
+
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = FILE_MAGIC;
+	header.version = FILE_VERSION;
+	header.vertex_stride = sizeof(Vertex);
+	header.flags = flags;
+	header.vertex_count = vertices.size();
+	header.index_count = indices.size();
+	header.vertices_offset = (sizeof(header) + BLOB_ALIGNMENT - 1) / BLOB_ALIGNMENT * BLOB_ALIGNMENT;
+	header.indices_offset = (header.vertices_offset + vertices_size + BLOB_ALIGNMENT - 1) / BLOB_ALIGNMENT * BLOB_ALIGNMENT;
+	header.source_size = source.size;
+	header.source_modification_time = source.modification_time;
+	header.content_hash = hash_content(vertices.data(), vertices_size, indices.data(), indices_size);
+
+	glm::vec3 bounds_min(0.0f);
+	glm::vec3 bounds_max(0.0f);
+
+	if (!vertices.empty())
+	{
+		bounds_min = bounds_max = vertices[0].pos;
+
+		for (const Vertex& vertex : vertices)
+		{
+			bounds_min = glm::min(bounds_min, vertex.pos);
+			bounds_max = glm::max(bounds_max, vertex.pos);
+		}
+	}
+
+	glm::vec4 bounding_sphere = ModelLoader::compute_bounding_sphere(vertices.data(), vertices.size());
+
+	for (int i = 0; i < 3; i++)
+	{
+		header.bounds_min[i] = bounds_min[i];
+		header.bounds_max[i] = bounds_max[i];
+	}
+
+	for (int i = 0; i < 4; i++)
+		header.bounding_sphere[i] = bounding_sphere[i];
+
+	// Written under a temporary name and renamed, so a reader never sees half a file
+	std::string temporary_path = path + ".tmp";
+
+	{
+		std::ofstream output(temporary_path, std::ios::binary | std::ios::trunc);
+
+		if (!output.is_open())
+			throw std::runtime_error("Failed to open " + temporary_path + " for writing.");
+
+		const char padding[BLOB_ALIGNMENT] = {};
+
+		output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		output.write(padding, static_cast<std::streamsize>(header.vertices_offset - sizeof(header)));
+		output.write(reinterpret_cast<const char*>(vertices.data()), vertices_size);
+		output.write(padding, static_cast<std::streamsize>(header.indices_offset - header.vertices_offset - vertices_size));
+		output.write(reinterpret_cast<const char*>(indices.data()), indices_size);
+
+		if (!output)
+			throw std::runtime_error("Failed to write " + temporary_path + ".");
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporary_path, path, error);
+
+	if (error)
+	{
+		std::filesystem::remove(temporary_path, error);
+		throw std::runtime_error("Failed to write " + path + ".");
+	}
+}
+
+uint64_t MeshCache::hash_content(const void* vertices, size_t vertices_size, const void* indices, size_t indices_size)
+{
+	return Hash::bytes(indices, indices_size, Hash::bytes(vertices, vertices_size));
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "FileStream.hpp"
+#include "ModelLoader.hpp"
+
+// Binary mesh file (.vmesh): a header followed by the vertex and index blobs exactly as they are uploaded.
+// Reading it is a memory mapping and a copy, instead of parsing text and welding the vertices again.
+class MeshCache
+{
+public:
+
+	// How the mesh was processed after it was loaded
+	static const uint32_t FLAG_OPTIMIZED = 1 << 0;
+
+	// Returns false when the file is missing, damaged, stores a different Vertex layout, or (if source is given)
+	// was converted from a different version of the source file or with different flags.
+	// Without the source file there's nothing to rebuild the cache from, so its flags are ignored.
+	static bool read(const std::string& path, const File_Info* source, uint32_t flags,
+		std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, glm::vec4& bounding_sphere);
+	static void write(const std::string& path, const File_Info& source, uint32_t flags,
+		const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+private:
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		// sizeof(Vertex) when the file was written
+		uint32_t vertex_stride;
+		uint32_t flags;
+		uint64_t vertex_count;
+		uint64_t index_count;
+		// Offsets of the blobs from the beginning of the file
+		uint64_t vertices_offset;
+		uint64_t indices_offset;
+		uint64_t source_size;
+		int64_t source_modification_time;
+		// Hash of the vertex and index blobs
+		uint64_t content_hash;
+		float bounds_min[3];
+		float bounds_max[3];
+		float bounding_sphere[4];
+	};
+
+	static const uint32_t FILE_MAGIC = 0x48534D56; // "VMSH"
+	static const uint32_t FILE_VERSION = 1;
+	static const uint64_t BLOB_ALIGNMENT = 16;
+
+	static uint64_t hash_content(const void* vertices, size_t vertices_size, const void* indices, size_t indices_size);
+};
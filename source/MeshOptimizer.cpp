@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "MeshOptimizer.hpp"
+
+// FIFO cache simulation: a vertex is in the cache while fewer than VERTEX_CACHE_SIZE other vertices were added after it.
+// Adding VERTEX_CACHE_SIZE to time empties the cache.
+static bool is_in_cache(uint32_t vertex, const std::vector<uint32_t>& cache_time, uint32_t time)
+{
+	return time - cache_time[vertex] <= MeshOptimizer::VERTEX_CACHE_SIZE;
+}
+
+// Returns the number of vertices of the triangle that had to be transformed
+static uint32_t transform_triangle(const uint32_t* triangle, std::vector<uint32_t>& cache_time, uint32_t& time)
+{
+	uint32_t misses = 0;
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		if (!is_in_cache(triangle[i], cache_time, time))
+		{
+			cache_time[triangle[i]] = time++;
+			misses++;
+		}
+	}
+
+	return misses;
+}
+
+void MeshOptimizer::optimize(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	std::vector<uint32_t> clusters;
+	optimize_vertex_cache(indices, vertices.size(), &clusters);
+	optimize_overdraw(indices, vertices, clusters);
+	optimize_vertex_fetch(vertices, indices);
+}
+
+void MeshOptimizer::optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertex_count, std::vector<uint32_t>* clusters)
+{
+	if (clusters != nullptr)
+		clusters->clear();
+
+	size_t triangle_count = indices.size() / 3;
+
+	if (triangle_count == 0)
+		return;
+
+	// Triangles that use each vertex and weren't emitted yet
+	std::vector<uint32_t> live_triangles(vertex_count, 0);
+
+	for (size_t i = 0; i < triangle_count * 3; i++)
+	{
+		if (indices[i] >= vertex_count)
+			throw std::runtime_error("Mesh index out of range.");
+
+		live_triangles[indices[i]]++;
+	}
+
+	std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+	for (size_t i = 0; i < vertex_count; i++)
+		adjacency_offsets[i + 1] = adjacency_offsets[i] + live_triangles[i];
+
+	std::vector<uint32_t> adjacency(triangle_count * 3);
+	std::vector<uint32_t> adjacency_fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+
+	for (size_t i = 0; i < triangle_count * 3; i++)
+		adjacency[adjacency_fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+	std::vector<uint32_t> cache_time(vertex_count, 0);
+	std::vector<uint8_t> emitted(triangle_count, 0);
+	std::vector<uint32_t> dead_end_stack;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> result;
+
+	dead_end_stack.reserve(triangle_count * 3);
+	result.reserve(triangle_count * 3);
+
+	const uint32_t NO_VERTEX = ~0u;
+
+	uint32_t time = VERTEX_CACHE_SIZE + 1;
+	size_t cursor = 0;
+	uint32_t fanning_vertex = indices[0];
+
+	if (clusters != nullptr)
+		clusters->push_back(0);
+
+	while (true)
+	{
+		candidates.clear();
+
+		// Emit every remaining triangle around the fanning vertex
+		for (uint32_t i = adjacency_offsets[fanning_vertex]; i < adjacency_offsets[fanning_vertex + 1]; i++)
+		{
+			uint32_t triangle = adjacency[i];
+
+			if (emitted[triangle])
+				continue;
+
+			emitted[triangle] = 1;
+
+			for (uint32_t j = 0; j < 3; j++)
+			{
+				uint32_t vertex = indices[triangle * 3 + j];
+
+				result.push_back(vertex);
+				dead_end_stack.push_back(vertex);
+				candidates.push_back(vertex);
+				live_triangles[vertex]--;
+
+				if (!is_in_cache(vertex, cache_time, time))
+					cache_time[vertex] = time++;
+			}
+		}
+
+		// The next fanning vertex is the oldest candidate that will still be in the cache after emitting all its triangles,
+		// or any candidate with triangles left
+		uint32_t next_vertex = NO_VERTEX;
+		int64_t best_priority = -1;
+
+		for (uint32_t vertex : candidates)
+		{
+			if (live_triangles[vertex] == 0)
+				continue;
+
+			int64_t priority = 0;
+			int64_t age = time - cache_time[vertex];
+
+			if (age + 2 * static_cast<int64_t>(live_triangles[vertex]) <= VERTEX_CACHE_SIZE)
+				priority = age;
+
+			if (priority > best_priority)
+			{
+				best_priority = priority;
+				next_vertex = vertex;
+			}
+		}
+
+		// Dead end, go back to the most recently used vertex with triangles left
+		while (next_vertex == NO_VERTEX && !dead_end_stack.empty())
+		{
+			uint32_t vertex = dead_end_stack.back();
+			dead_end_stack.pop_back();
+
+			if (live_triangles[vertex] > 0)
+				next_vertex = vertex;
+		}
+
+		// Nothing connected is left, continue with any vertex that has triangles left
+		if (next_vertex == NO_VERTEX)
+		{
+			while (cursor < vertex_count && live_triangles[cursor] == 0)
+				cursor++;
+
+			if (cursor == vertex_count)
+				break;
+
+			next_vertex = static_cast<uint32_t>(cursor);
+		}
+
+		if (clusters != nullptr && !is_in_cache(next_vertex, cache_time, time) && result.size() / 3 > clusters->back())
+			clusters->push_back(static_cast<uint32_t>(result.size() / 3));
+
+		fanning_vertex = next_vertex;
+	}
+
+	indices.swap(result);
+}
+
+void MeshOptimizer::optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& clusters, float threshold)
+{
+	size_t triangle_count = indices.size() / 3;
+
+	if (triangle_count == 0 || clusters.empty())
+		return;
+
+	// Soft boundaries, every cluster gets a cold cache when it's moved so it can't be split where the cache is doing most of its work
+	std::vector<uint32_t> cache_time(vertices.size(), 0);
+	uint32_t time = VERTEX_CACHE_SIZE + 1;
+	std::vector<uint32_t> soft_clusters;
+
+	for (size_t i = 0; i < clusters.size(); i++)
+	{
+		size_t begin = clusters[i];
+		size_t end = i + 1 < clusters.size() ? clusters[i + 1] : triangle_count;
+
+		time += VERTEX_CACHE_SIZE;
+		uint32_t cluster_misses = 0;
+
+		for (size_t triangle = begin; triangle < end; triangle++)
+			cluster_misses += transform_triangle(&indices[triangle * 3], cache_time, time);
+
+		float split_acmr = threshold * cluster_misses / static_cast<float>(end - begin);
+
+		time += VERTEX_CACHE_SIZE;
+		size_t start = begin;
+		uint32_t misses = 0;
+
+		soft_clusters.push_back(static_cast<uint32_t>(begin));
+
+		for (size_t triangle = begin; triangle < end; triangle++)
+		{
+			misses += transform_triangle(&indices[triangle * 3], cache_time, time);
+
+			if (triangle + 1 < end && misses <= split_acmr * (triangle + 1 - start))
+			{
+				soft_clusters.push_back(static_cast<uint32_t>(triangle + 1));
+				start = triangle + 1;
+				misses = 0;
+				time += VERTEX_CACHE_SIZE;
+			}
+		}
+	}
+
+	// Area weighted centroid of the whole mesh
+	glm::vec3 mesh_centroid(0.0f);
+	float mesh_area = 0.0f;
+
+	std::vector<glm::vec3> cluster_centroids(soft_clusters.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> cluster_normals(soft_clusters.size(), glm::vec3(0.0f));
+
+	for (size_t i = 0; i < soft_clusters.size(); i++)
+	{
+		size_t begin = soft_clusters[i];
+		size_t end = i + 1 < soft_clusters.size() ? soft_clusters[i + 1] : triangle_count;
+		float cluster_area = 0.0f;
+
+		for (size_t triangle = begin; triangle < end; triangle++)
+		{
+			const glm::vec3& p0 = vertices[indices[triangle * 3 + 0]].pos;
+			const glm::vec3& p1 = vertices[indices[triangle * 3 + 1]].pos;
+			const glm::vec3& p2 = vertices[indices[triangle * 3 + 2]].pos;
+
+			// Twice the area, scaling doesn't matter here
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			glm::vec3 centroid = (p0 + p1 + p2) / 3.0f;
+
+			cluster_centroids[i] += centroid * area;
+			cluster_normals[i] += normal;
+			cluster_area += area;
+		}
+
+		mesh_centroid += cluster_centroids[i];
+		mesh_area += cluster_area;
+
+		if (cluster_area > 0.0f)
+			cluster_centroids[i] /= cluster_area;
+	}
+
+	if (mesh_area > 0.0f)
+		mesh_centroid /= mesh_area;
+
+	std::vector<float> cluster_sort_keys(soft_clusters.size());
+	std::vector<uint32_t> cluster_order(soft_clusters.size());
+
+	for (size_t i = 0; i < soft_clusters.size(); i++)
+	{
+		float normal_length = glm::length(cluster_normals[i]);
+		glm::vec3 normal = normal_length > 0.0f ? cluster_normals[i] / normal_length : glm::vec3(0.0f);
+
+		cluster_sort_keys[i] = glm::dot(cluster_centroids[i] - mesh_centroid, normal);
+		cluster_order[i] = static_cast<uint32_t>(i);
+	}
+
+	std::stable_sort(cluster_order.begin(), cluster_order.end(), [&](uint32_t a, uint32_t b)
+	{
+		return cluster_sort_keys[a] > cluster_sort_keys[b];
+	});
+
+	std::vector<uint32_t> result;
+	result.reserve(triangle_count * 3);
+
+	for (uint32_t cluster : cluster_order)
+	{
+		size_t begin = soft_clusters[cluster];
+		size_t end = cluster + 1 < soft_clusters.size() ? soft_clusters[cluster + 1] : triangle_count;
+
+		result.insert(result.end(), indices.begin() + begin * 3, indices.begin() + end * 3);
+	}
+
+	indices.swap(result);
+}
+
+void MeshOptimizer::optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	const uint32_t UNUSED = ~0u;
+
+	std::vector<uint32_t> remap(vertices.size(), UNUSED);
+	std::vector<Vertex> result;
+	result.reserve(vertices.size());
+
+	for (uint32_t& index : indices)
+	{
+		if (index >= vertices.size())
+			throw std::runtime_error("Mesh index out of range.");
+
+		if (remap[index] == UNUSED)
+		{
+			remap[index] = static_cast<uint32_t>(result.size());
+			result.push_back(vertices[index]);
+		}
+
+		index = remap[index];
+	}
+
+	vertices.swap(result);
+}
+
+Vertex_Cache_Statistics MeshOptimizer::analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertex_count)
+{
+	Vertex_Cache_Statistics statistics{};
+	size_t triangle_count = indices.size() / 3;
+
+	if (triangle_count == 0)
+		return statistics;
+
+	std::vector<uint32_t> cache_time(vertex_count, 0);
+	std::vector<uint8_t> used(vertex_count, 0);
+	uint32_t time = VERTEX_CACHE_SIZE + 1;
+	size_t misses = 0;
+	size_t used_vertices = 0;
+
+	for (size_t i = 0; i < triangle_count * 3; i++)
+	{
+		if (indices[i] >= vertex_count)
+			throw std::runtime_error("Mesh index out of range.");
+
+		if (!used[indices[i]])
+		{
+			used[indices[i]] = 1;
+			used_vertices++;
+		}
+	}
+
+	for (size_t triangle = 0; triangle < triangle_count; triangle++)
+		misses += transform_triangle(&indices[triangle * 3], cache_time, time);
+
+	statistics.acmr = static_cast<float>(misses) / triangle_count;
+	statistics.atvr = static_cast<float>(misses) / used_vertices;
+
+	return statistics;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ModelLoader.hpp"
+
+struct Vertex_Cache_Statistics
+{
+	// Average cache miss ratio, vertex shader invocations per triangle: 3 at worst, about 0.5 for a regular grid
+	float acmr;
+	// Average transformed vertex ratio, vertex shader invocations per vertex: 1 at best
+	float atvr;
+};
+
+// Reorders the triangles and vertices of an indexed mesh so the GPU does less work drawing it, the rendered image stays the same.
+// The steps are meant to run in this order: vertex cache, overdraw, vertex fetch.
+class MeshOptimizer
+{
+public:
+
+	// Size of the FIFO post-transform cache the meshes are optimized and measured for
+	static const uint32_t VERTEX_CACHE_SIZE = 16;
+
+	// Runs all the steps
+	static void optimize(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+	// Reorders the triangles to reuse the transformed vertices in the post-transform cache, with Tipsify
+	// (Sander, Nehab, Barczak - Fast Triangle Reordering for Vertex Locality and Reduced Overdraw).
+	// clusters receives the first triangle of every run that starts with a cold cache, which optimize_overdraw can move around.
+	static void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertex_count, std::vector<uint32_t>* clusters = nullptr);
+	// Splits the clusters further where that costs at most threshold times their ACMR, then sorts them so the ones
+	// facing away from the center of the mesh come first. Those are the most likely to occlude the others.
+	static void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices,
+		const std::vector<uint32_t>& clusters, float threshold = 1.05f);
+	// Orders the vertices by their first use in the index buffer so they are fetched mostly sequentially,
+	// vertices that aren't used by any triangle are removed
+	static void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+	static Vertex_Cache_Statistics analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertex_count);
+};
@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#include "MeshSimplifier.hpp"
+
+void MeshSimplifier::Quadric::add_plane(const glm::vec3& normal, float distance, float plane_weight)
+{
+	double x = normal.x, y = normal.y, z = normal.z, d = distance, w = plane_weight;
+
+	a00 += w * x * x; a01 += w * x * y; a02 += w * x * z;
+	a11 += w * y * y; a12 += w * y * z;
+	a22 += w * z * z;
+	b0 += w * x * d; b1 += w * y * d; b2 += w * z * d;
+	c += w * d * d;
+	weight += w;
+}
+
+void MeshSimplifier::Quadric::add(const Quadric& other)
+{
+	a00 += other.a00; a01 += other.a01; a02 += other.a02;
+	a11 += other.a11; a12 += other.a12;
+	a22 += other.a22;
+	b0 += other.b0; b1 += other.b1; b2 += other.b2;
+	c += other.c;
+	weight += other.weight;
+}
+
+double MeshSimplifier::Quadric::error(const glm::vec3& point) const
+{
+	double x = point.x, y = point.y, z = point.z;
+
+	double result = a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z
+		+ a11 * y * y + 2.0 * a12 * y * z
+		+ a22 * z * z
+		+ 2.0 * (b0 * x + b1 * y + b2 * z)
+		+ c;
+
+	// Rounding can make it slightly negative
+	return weight > 0.0 ? std::max(result, 0.0) / weight : 0.0;
+}
+
+float MeshSimplifier::simplify(const Vertex* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count,
+	size_t target_index_count, float max_error, std::vector<uint32_t>& result)
+{
+	result.assign(indices, indices + index_count - index_count % 3);
+
+	if (result.size() <= target_index_count)
+		return 0.0f;
+
+	// Vertices with the same position are the same vertex for the simplification, represented by the first of them
+	std::vector<uint32_t> sorted_vertices(vertex_count);
+	std::iota(sorted_vertices.begin(), sorted_vertices.end(), 0);
+	std::sort(sorted_vertices.begin(), sorted_vertices.end(), [&](uint32_t a, uint32_t b)
+	{
+		int order = memcmp(&vertices[a].pos, &vertices[b].pos, sizeof(glm::vec3));
+		return order != 0 ? order < 0 : a < b;
+	});
+
+	std::vector<uint32_t> canonical(vertex_count);
+	std::vector<uint8_t> seam(vertex_count, 0);
+	std::vector<uint8_t> locked(vertex_count, 0);
+
+	for (size_t begin = 0, end = 0; begin < vertex_count; begin = end)
+	{
+		uint32_t first = sorted_vertices[begin];
+
+		for (end = begin; end < vertex_count && memcmp(&vertices[sorted_vertices[end]].pos, &vertices[first].pos, sizeof(glm::vec3)) == 0; end++)
+		{
+			canonical[sorted_vertices[end]] = first;
+
+			if (memcmp(&vertices[sorted_vertices[end]], &vertices[first], sizeof(Vertex)) != 0)
+				seam[first] = locked[first] = 1;
+		}
+	}
+
+	// Duplicates that are identical in every attribute are merged, only the vertices of a seam keep their own index
+	for (uint32_t& index : result)
+	{
+		if (index >= vertex_count)
+			throw std::runtime_error("Mesh index out of range.");
+
+		if (!seam[canonical[index]])
+			index = canonical[index];
+	}
+
+	// Edges that aren't shared by exactly two triangles are on a border (or not manifold), their vertices stay
+	std::vector<uint64_t> edges;
+	edges.reserve(result.size());
+
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		for (size_t j = 0; j < 3; j++)
+		{
+			uint64_t a = canonical[result[i + j]];
+			uint64_t b = canonical[result[i + (j + 1) % 3]];
+			edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+		}
+	}
+
+	std::sort(edges.begin(), edges.end());
+
+	for (size_t begin = 0, end = 0; begin < edges.size(); begin = end)
+	{
+		for (end = begin; end < edges.size() && edges[end] == edges[begin]; end++);
+
+		if (end - begin != 2)
+		{
+			locked[static_cast<uint32_t>(edges[begin] >> 32)] = 1;
+			locked[static_cast<uint32_t>(edges[begin])] = 1;
+		}
+	}
+
+	std::vector<Quadric> quadrics(vertex_count, Quadric{});
+
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		const glm::vec3& p0 = vertices[result[i + 0]].pos;
+		const glm::vec3& p1 = vertices[result[i + 1]].pos;
+		const glm::vec3& p2 = vertices[result[i + 2]].pos;
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+
+		if (length == 0.0f)
+			continue;
+
+		normal = normal / length;
+
+		for (size_t j = 0; j < 3; j++)
+			quadrics[canonical[result[i + j]]].add_plane(normal, -glm::dot(normal, p0), length * 0.5f);
+	}
+
+	struct Collapse
+	{
+		uint32_t source;
+		uint32_t target;
+		double error;
+	};
+
+	std::vector<uint32_t> collapse_targets(vertex_count);
+	std::iota(collapse_targets.begin(), collapse_targets.end(), 0);
+
+	std::vector<uint32_t> adjacency_offsets(vertex_count + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<uint8_t> touched(vertex_count);
+
+	double max_error_squared = static_cast<double>(max_error) * max_error;
+	double result_error_squared = 0.0;
+
+	// Every pass collapses the cheapest edges that don't share vertices, then the indices are rebuilt
+	while (result.size() > target_index_count)
+	{
+		size_t triangle_count = result.size() / 3;
+
+		std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+		for (uint32_t index : result)
+			adjacency_offsets[canonical[index] + 1]++;
+
+		for (size_t i = 0; i < vertex_count; i++)
+			adjacency_offsets[i + 1] += adjacency_offsets[i];
+
+		adjacency.resize(result.size());
+		std::vector<uint32_t> adjacency_fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+
+		for (size_t i = 0; i < result.size(); i++)
+			adjacency[adjacency_fill[canonical[result[i]]]++] = static_cast<uint32_t>(i / 3);
+
+		collapses.clear();
+
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (size_t j = 0; j < 3; j++)
+			{
+				uint32_t a = canonical[result[i + j]];
+				uint32_t b = canonical[result[i + (j + 1) % 3]];
+
+				// Inner edges are seen once from each of their triangles
+				if (a > b)
+					continue;
+
+				// The target of a collapse can't be on a seam, its triangles would get the attributes of the wrong side
+				Collapse collapse{ 0, 0, HUGE_VAL };
+
+				for (int direction = 0; direction < 2; direction++)
+				{
+					uint32_t source = direction == 0 ? a : b;
+					uint32_t target = direction == 0 ? b : a;
+
+					if (locked[source] || seam[target])
+						continue;
+
+					Quadric quadric = quadrics[source];
+					quadric.add(quadrics[target]);
+					double error = quadric.error(vertices[target].pos);
+
+					if (error < collapse.error)
+						collapse = { source, target, error };
+				}
+
+				if (collapse.error != HUGE_VAL)
+					collapses.push_back(collapse);
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b)
+		{
+			return a.error < b.error;
+		});
+
+		size_t triangles_to_remove = (result.size() - target_index_count + 2) / 3;
+		size_t removed_triangles = 0;
+		size_t collapsed_vertices = 0;
+
+		std::fill(touched.begin(), touched.end(), 0);
+
+		for (const Collapse& collapse : collapses)
+		{
+			if (collapse.error > max_error_squared || removed_triangles >= triangles_to_remove)
+				break;
+
+			if (touched[collapse.source] || touched[collapse.target])
+				continue;
+
+			const glm::vec3& target_position = vertices[collapse.target].pos;
+			bool flips = false;
+			size_t collapsed_triangles = 0;
+
+			// Moving the source vertex must not turn any of the triangles that stay around
+			for (uint32_t i = adjacency_offsets[collapse.source]; i < adjacency_offsets[collapse.source + 1] && !flips; i++)
+			{
+				const uint32_t* triangle = &result[adjacency[i] * 3];
+				glm::vec3 positions[3];
+				glm::vec3 moved_positions[3];
+				bool has_target = false;
+
+				for (size_t j = 0; j < 3; j++)
+				{
+					positions[j] = vertices[triangle[j]].pos;
+					moved_positions[j] = canonical[triangle[j]] == collapse.source ? target_position : positions[j];
+					has_target = has_target || canonical[triangle[j]] == collapse.target;
+				}
+
+				if (has_target)
+				{
+					collapsed_triangles++;
+					continue;
+				}
+
+				glm::vec3 normal = glm::cross(positions[1] - positions[0], positions[2] - positions[0]);
+				glm::vec3 moved_normal = glm::cross(moved_positions[1] - moved_positions[0], moved_positions[2] - moved_positions[0]);
+
+				flips = glm::dot(normal, moved_normal) <= 0.0f;
+			}
+
+			if (flips)
+				continue;
+
+			collapse_targets[collapse.source] = collapse.target;
+			quadrics[collapse.target].add(quadrics[collapse.source]);
+			result_error_squared = std::max(result_error_squared, collapse.error);
+			removed_triangles += collapsed_triangles;
+			collapsed_vertices++;
+
+			// The triangles around the source change, nothing else in this pass may use their vertices
+			for (uint32_t i = adjacency_offsets[collapse.source]; i < adjacency_offsets[collapse.source + 1]; i++)
+			{
+				for (size_t j = 0; j < 3; j++)
+					touched[canonical[result[adjacency[i] * 3 + j]]] = 1;
+			}
+		}
+
+		if (collapsed_vertices == 0)
+			break;
+
+		size_t write = 0;
+
+		for (size_t i = 0; i < triangle_count; i++)
+		{
+			uint32_t triangle[3];
+
+			for (size_t j = 0; j < 3; j++)
+			{
+				uint32_t index = result[i * 3 + j];
+				uint32_t target = collapse_targets[canonical[index]];
+				triangle[j] = target != canonical[index] ? target : index;
+			}
+
+			uint32_t c0 = canonical[triangle[0]], c1 = canonical[triangle[1]], c2 = canonical[triangle[2]];
+
+			if (c0 == c1 || c1 == c2 || c0 == c2)
+				continue;
+
+			result[write++] = triangle[0];
+			result[write++] = triangle[1];
+			result[write++] = triangle[2];
+		}
+
+		result.resize(write);
+		std::iota(collapse_targets.begin(), collapse_targets.end(), 0);
+	}
+
+	return static_cast<float>(std::sqrt(result_error_squared));
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ModelLoader.hpp"
+
+// Reduces the triangle count of an indexed mesh by collapsing edges in the order of their quadric error
+// (Garland & Heckbert - Surface Simplification Using Quadric Error Metrics).
+// A vertex is only ever collapsed onto another existing vertex, so the simplified indices still index into the same vertices
+// and every level of detail of a mesh can share one vertex buffer.
+class MeshSimplifier
+{
+public:
+
+	// Collapses edges until at most target_index_count indices are left, or until the next collapse would move the surface
+	// further than max_error. Vertices on open borders and on attribute seams (a position shared by vertices with different
+	// attributes) don't move, so the result doesn't crack or stretch the texture across the seam.
+	// Returns the error of the result, a distance in the units of the positions.
+	static float simplify(const Vertex* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count,
+		size_t target_index_count, float max_error, std::vector<uint32_t>& result);
+
+private:
+
+	// Symmetric 4x4 matrix of the sum of squared distances to a set of planes, weighted by the area of their triangles
+	struct Quadric
+	{
+		double a00, a01, a02, a11, a12, a22;
+		double b0, b1, b2;
+		double c;
+		double weight;
+
+		void add_plane(const glm::vec3& normal, float distance, float plane_weight);
+		void add(const Quadric& other);
+		// Mean squared distance of the point to the planes
+		double error(const glm::vec3& point) const;
+	};
+};
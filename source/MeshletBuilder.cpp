@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "MeshletBuilder.hpp"
+
+void MeshletBuilder::build(const Vertex* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count, std::vector<Meshlet>& meshlets)
+{
+	const uint32_t NO_MESHLET = ~0u;
+
+	// The last meshlet that used every vertex, so the vertices of the current one are counted without clearing anything
+	std::vector<uint32_t> meshlet_of_vertices(vertex_count, NO_MESHLET);
+	uint32_t meshlet_id = 0;
+	uint32_t meshlet_vertex_count = 0;
+	size_t meshlet_first_index = 0;
+
+	for (size_t i = 0; i + 2 < index_count; i += 3)
+	{
+		uint32_t new_vertices = 0;
+
+		for (size_t j = 0; j < 3; j++)
+		{
+			if (indices[i + j] >= vertex_count)
+				throw std::runtime_error("Mesh index out of range.");
+
+			// A triangle can use the same vertex twice, it's still one new vertex
+			bool repeated = (j > 0 && indices[i + j] == indices[i]) || (j > 1 && indices[i + j] == indices[i + 1]);
+
+			if (meshlet_of_vertices[indices[i + j]] != meshlet_id && !repeated)
+				new_vertices++;
+		}
+
+		if (meshlet_vertex_count + new_vertices > MAX_VERTICES || i - meshlet_first_index >= MAX_TRIANGLES * 3)
+		{
+			meshlets.push_back(compute_bounds(vertices, indices + meshlet_first_index, i - meshlet_first_index));
+			meshlets.back().first_index = static_cast<uint32_t>(meshlet_first_index);
+
+			meshlet_id++;
+			meshlet_vertex_count = 0;
+			meshlet_first_index = i;
+		}
+
+		for (size_t j = 0; j < 3; j++)
+		{
+			if (meshlet_of_vertices[indices[i + j]] != meshlet_id)
+			{
+				meshlet_of_vertices[indices[i + j]] = meshlet_id;
+				meshlet_vertex_count++;
+			}
+		}
+	}
+
+	size_t triangle_index_count = index_count - index_count % 3;
+
+	if (triangle_index_count > meshlet_first_index)
+	{
+		meshlets.push_back(compute_bounds(vertices, indices + meshlet_first_index, triangle_index_count - meshlet_first_index));
+		meshlets.back().first_index = static_cast<uint32_t>(meshlet_first_index);
+	}
+}
+
+Meshlet MeshletBuilder::compute_bounds(const Vertex* vertices, const uint32_t* indices, size_t index_count)
+{
+	Meshlet meshlet{};
+	meshlet.index_count = static_cast<uint32_t>(index_count);
+
+	glm::vec3 min_position = vertices[indices[0]].pos;
+	glm::vec3 max_position = vertices[indices[0]].pos;
+
+	for (size_t i = 0; i < index_count; i++)
+	{
+		min_position = glm::min(min_position, vertices[indices[i]].pos);
+		max_position = glm::max(max_position, vertices[indices[i]].pos);
+	}
+
+	glm::vec3 center = (min_position + max_position) * 0.5f;
+	float radius = 0.0f;
+
+	for (size_t i = 0; i < index_count; i++)
+		radius = std::max(radius, glm::length(vertices[indices[i]].pos - center));
+
+	meshlet.bounding_sphere = glm::vec4(center, radius);
+
+	// The cross products are twice the areas of the triangles, so big triangles weigh more in the axis
+	glm::vec3 normal_sum(0.0f);
+
+	for (size_t i = 0; i < index_count; i += 3)
+	{
+		const glm::vec3& p0 = vertices[indices[i + 0]].pos;
+		normal_sum += glm::cross(vertices[indices[i + 1]].pos - p0, vertices[indices[i + 2]].pos - p0);
+	}
+
+	float normal_sum_length = glm::length(normal_sum);
+
+	// Triangles facing every direction, the cluster is never entirely back facing
+	if (normal_sum_length == 0.0f)
+	{
+		meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		return meshlet;
+	}
+
+	glm::vec3 axis = normal_sum / normal_sum_length;
+	float min_dot = 1.0f;
+
+	for (size_t i = 0; i < index_count; i += 3)
+	{
+		const glm::vec3& p0 = vertices[indices[i + 0]].pos;
+		glm::vec3 normal = glm::cross(vertices[indices[i + 1]].pos - p0, vertices[indices[i + 2]].pos - p0);
+		float length = glm::length(normal);
+
+		if (length > 0.0f)
+			min_dot = std::min(min_dot, glm::dot(normal / length, axis));
+	}
+
+	// The normals span more than a hemisphere (give or take), some triangle faces the camera from anywhere.
+	// Otherwise the triangles face away when the view direction is within asin(min_dot) of the axis, the sphere makes it
+	// hold for every point of the cluster and not only for the center.
+	float cutoff = min_dot <= 0.1f ? 1.0f : std::sqrt(1.0f - min_dot * min_dot);
+
+	meshlet.cone = glm::vec4(axis, cutoff);
+
+	return meshlet;
+}
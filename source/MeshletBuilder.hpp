@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ModelLoader.hpp"
+
+// A small cluster of consecutive triangles of a mesh, the unit the meshlet culling shader accepts or rejects
+struct Meshlet
+{
+	// Range of the indices given to MeshletBuilder::build
+	uint32_t first_index;
+	uint32_t index_count;
+	// xyz is the center and w the radius, in the space of the mesh
+	glm::vec4 bounding_sphere;
+	// xyz is the average normal of the triangles and w the cosine the view direction is compared with, see MeshletBuilder
+	glm::vec4 cone;
+};
+
+// Splits the triangles of a mesh into meshlets without reordering them, like the scan builder of meshoptimizer
+// (Kapoulkine - meshoptimizer, meshopt_buildMeshletsScan). The triangles should already be in vertex cache order,
+// then consecutive triangles are close to each other and the clusters come out compact.
+class MeshletBuilder
+{
+public:
+
+	// Limits of a meshlet, the same as for NVIDIA mesh shaders, so the clusters could be drawn by them as well
+	static const uint32_t MAX_VERTICES = 64;
+	static const uint32_t MAX_TRIANGLES = 124;
+
+	// Appends the meshlets of the triangles to meshlets, their index ranges are relative to indices.
+	// All the triangles of a meshlet face away from a camera at position c when
+	// dot(center - c, cone.xyz) >= cone.w * length(center - c) + radius. A cone.w of 1 means they can't all face away.
+	static void build(const Vertex* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count, std::vector<Meshlet>& meshlets);
+
+private:
+
+	static Meshlet compute_bounds(const Vertex* vertices, const uint32_t* indices, size_t index_count);
+};
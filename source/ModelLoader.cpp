@@ -1,9 +1,329 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "FileStream.hpp"
+#include "MeshCache.hpp"
+#include "MeshOptimizer.hpp"
 #include "ModelLoader.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+#include "VertexWelder.hpp"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
-void ModelLoader::load_model(std::string model_path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+static Vertex make_vertex(const tinyobj::attrib_t& attrib, const tinyobj::index_t& index)
+{
+	Vertex vertex{};
+
+	vertex.pos = {
+		attrib.vertices[3 * index.vertex_index + 0],
+		attrib.vertices[3 * index.vertex_index + 1],
+		attrib.vertices[3 * index.vertex_index + 2]
+	};
+
+	vertex.tex_coord = {
+		attrib.texcoords[2 * index.texcoord_index + 0],
+
+		// The OBJ format assumes a coordinate system where a vertical coordinate of 0 means the bottom of the image,
+		// however we've uploaded our image into Vulkan in a top to bottom orientation where 0 means the top of the image.
+		// Solve this by flipping the vertical component of the texture coordinates.
+		1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+	};
+
+	vertex.color = { 1.0f, 1.0f, 1.0f };
+
+	return vertex;
+}
+
+static void weld_serial(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes,
+	std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	size_t index_count = 0;
+	for (const auto& shape : shapes)
+		index_count += shape.mesh.indices.size();
+
+	indices.reserve(indices.size() + index_count);
+
+	VertexWelder welder;
+
+	// Vertices are only merged within a shape
+	for (const auto& shape : shapes)
+	{
+		welder.reset(shape.mesh.indices.size());
+
+		for (const auto& index : shape.mesh.indices)
+			indices.push_back(welder.weld(make_vertex(attrib, index), vertices));
+	}
+}
+
+// Below this many indices per chunk the merge costs more than the threads save
+static const size_t MIN_WELD_CHUNK_SIZE = 1 << 16;
+
+struct Weld_Chunk
+{
+	size_t shape;
+	size_t first_index;
+	size_t index_count;
+	// Welded on their own, in the order the vertices first appear in the chunk
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	// Chunk vertex -> shape vertex, empty when the shape is a single chunk
+	std::vector<uint32_t> remap;
+};
+
+struct Weld_Shape
+{
+	size_t first_chunk = 0;
+	size_t chunk_count = 0;
+	std::vector<Vertex> vertices;
+	size_t vertex_offset = 0;
+	size_t index_offset = 0;
+};
+
+// Every chunk is welded on its own, then the chunks of a shape are merged in order. A vertex first seen in an earlier
+// chunk is merged before the ones first seen in later chunks, and inside a chunk they are in the order they first appear,
+// so the merged vertices end up in the same order as with the serial welding and the indices are the same too.
+static void weld_parallel(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes,
+	std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, ThreadPool& thread_pool)
+{
+	size_t total_index_count = 0;
+	for (const auto& shape : shapes)
+		total_index_count += shape.mesh.indices.size();
+
+	size_t chunk_size = std::max(MIN_WELD_CHUNK_SIZE, total_index_count / (thread_pool.get_thread_count() * 4) + 1);
+
+	std::vector<Weld_Shape> weld_shapes(shapes.size());
+	std::vector<Weld_Chunk> chunks;
+
+	for (size_t i = 0; i < shapes.size(); i++)
+	{
+		size_t index_count = shapes[i].mesh.indices.size();
+		weld_shapes[i].first_chunk = chunks.size();
+
+		for (size_t first = 0; first < index_count; first += chunk_size)
+		{
+			Weld_Chunk chunk{};
+			chunk.shape = i;
+			chunk.first_index = first;
+			chunk.index_count = std::min(chunk_size, index_count - first);
+			chunks.push_back(std::move(chunk));
+		}
+
+		weld_shapes[i].chunk_count = chunks.size() - weld_shapes[i].first_chunk;
+	}
+
+	thread_pool.run(static_cast<uint32_t>(chunks.size()), [&](uint32_t task_index, uint32_t)
+	{
+		Weld_Chunk& chunk = chunks[task_index];
+		const auto& shape_indices = shapes[chunk.shape].mesh.indices;
+
+		VertexWelder welder;
+		welder.reset(chunk.index_count);
+		chunk.indices.resize(chunk.index_count);
+
+		for (size_t i = 0; i < chunk.index_count; i++)
+			chunk.indices[i] = welder.weld(make_vertex(attrib, shape_indices[chunk.first_index + i]), chunk.vertices);
+	});
+
+	thread_pool.run(static_cast<uint32_t>(shapes.size()), [&](uint32_t task_index, uint32_t)
+	{
+		Weld_Shape& shape = weld_shapes[task_index];
+
+		if (shape.chunk_count == 1)
+		{
+			shape.vertices.swap(chunks[shape.first_chunk].vertices);
+			return;
+		}
+
+		size_t chunk_vertex_count = 0;
+		for (size_t i = 0; i < shape.chunk_count; i++)
+			chunk_vertex_count += chunks[shape.first_chunk + i].vertices.size();
+
+		VertexWelder welder;
+		welder.reset(chunk_vertex_count);
+
+		for (size_t i = 0; i < shape.chunk_count; i++)
+		{
+			Weld_Chunk& chunk = chunks[shape.first_chunk + i];
+			chunk.remap.resize(chunk.vertices.size());
+
+			for (size_t j = 0; j < chunk.vertices.size(); j++)
+				chunk.remap[j] = welder.weld(chunk.vertices[j], shape.vertices);
+
+			std::vector<Vertex>().swap(chunk.vertices);
+		}
+	});
+
+	// The outputs are sized once and every thread writes its own part
+	size_t vertex_count = vertices.size();
+	size_t index_count = indices.size();
+
+	for (Weld_Shape& shape : weld_shapes)
+	{
+		shape.vertex_offset = vertex_count;
+		shape.index_offset = index_count;
+		vertex_count += shape.vertices.size();
+		index_count += shapes[&shape - weld_shapes.data()].mesh.indices.size();
+	}
+
+	if (vertex_count > UINT32_MAX)
+		throw std::runtime_error("Too many vertices for 32-bit indices.");
+
+	vertices.resize(vertex_count);
+	indices.resize(index_count);
+
+	thread_pool.run(static_cast<uint32_t>(chunks.size()), [&](uint32_t task_index, uint32_t)
+	{
+		const Weld_Chunk& chunk = chunks[task_index];
+		const Weld_Shape& shape = weld_shapes[chunk.shape];
+		uint32_t* output = indices.data() + shape.index_offset + chunk.first_index;
+		uint32_t vertex_offset = static_cast<uint32_t>(shape.vertex_offset);
+
+		if (chunk.remap.empty())
+		{
+			for (size_t i = 0; i < chunk.index_count; i++)
+				output[i] = vertex_offset + chunk.indices[i];
+		}
+		else
+		{
+			for (size_t i = 0; i < chunk.index_count; i++)
+				output[i] = vertex_offset + chunk.remap[chunk.indices[i]];
+		}
+
+		// The first chunk of a shape also copies its vertices
+		if (static_cast<size_t>(task_index) == shape.first_chunk && !shape.vertices.empty())
+			memcpy(vertices.data() + shape.vertex_offset, shape.vertices.data(), shape.vertices.size() * sizeof(Vertex));
+	});
+}
+
+void ModelLoader::load_model(std::string model_path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, glm::vec4* bounding_sphere,
+	ThreadPool* thread_pool, bool optimize)
+{
+	TRACE_SCOPE("ModelLoader::load_model");
+
+	std::string mesh_path = get_mesh_cache_path(model_path);
+
+	File_Info source;
+	bool has_source = FileStream::get_file_info(model_path, source);
+
+	glm::vec4 cached_bounding_sphere;
+	uint32_t flags = optimize ? MeshCache::FLAG_OPTIMIZED : 0;
+
+	if (MeshCache::read(mesh_path, has_source ? &source : nullptr, flags, vertices, indices, cached_bounding_sphere))
+	{
+		if (bounding_sphere != nullptr)
+			*bounding_sphere = cached_bounding_sphere;
+
+		return;
+	}
+
+	vertices.clear();
+	indices.clear();
+	load_obj(model_path, vertices, indices, thread_pool);
+
+	if (optimize)
+		MeshOptimizer::optimize(vertices, indices);
+
+	if (bounding_sphere != nullptr)
+		*bounding_sphere = compute_bounding_sphere(vertices.data(), vertices.size());
+
+	// A failed write only costs the parsing on the next launch again
+	try
+	{
+		MeshCache::write(mesh_path, source, flags, vertices, indices);
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "Failed to cache " << model_path << ": " << e.what() << "\n";
+	}
+}
+
+void ModelLoader::convert_model(const std::string& model_path, const std::string& mesh_path, ThreadPool* thread_pool, bool optimize)
+{
+	File_Info source;
+
+	if (!FileStream::get_file_info(model_path, source))
+		throw std::runtime_error("Failed to open " + model_path + ".");
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	load_obj(model_path, vertices, indices, thread_pool);
+
+	if (optimize)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		Vertex_Cache_Statistics before = MeshOptimizer::analyze_vertex_cache(indices, vertices.size());
+		MeshOptimizer::optimize(vertices, indices);
+		Vertex_Cache_Statistics after = MeshOptimizer::analyze_vertex_cache(indices, vertices.size());
+
+		auto end = std::chrono::high_resolution_clock::now();
+
+		std::cout << "Mesh optimization (" << indices.size() / 3 << " triangles, "
+			<< std::chrono::duration<double, std::milli>(end - start).count() << " ms): "
+			<< "ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << "\n";
+	}
+
+	MeshCache::write(mesh_path, source, optimize ? MeshCache::FLAG_OPTIMIZED : 0, vertices, indices);
+}
+
+std::string ModelLoader::get_mesh_cache_path(const std::string& model_path)
+{
+	size_t extension = model_path.find_last_of('.');
+	size_t directory = model_path.find_last_of("/\\");
+
+	if (extension == std::string::npos || (directory != std::string::npos && extension < directory))
+		return model_path + ".vmesh";
+
+	return model_path.substr(0, extension) + ".vmesh";
+}
+
+glm::vec4 ModelLoader::compute_bounding_sphere(const Vertex* vertices, size_t vertex_count)
+{
+	if (vertex_count == 0)
+		return glm::vec4(0.0f);
+
+	glm::vec3 min_position = vertices[0].pos;
+	glm::vec3 max_position = vertices[0].pos;
+
+	for (size_t i = 0; i < vertex_count; i++)
+	{
+		min_position = glm::min(min_position, vertices[i].pos);
+		max_position = glm::max(max_position, vertices[i].pos);
+	}
+
+	glm::vec3 center = (min_position + max_position) * 0.5f;
+	float radius = 0.0f;
+
+	for (size_t i = 0; i < vertex_count; i++)
+		radius = std::max(radius, glm::length(vertices[i].pos - center));
+
+	return glm::vec4(center, radius);
+}
+
+void ModelLoader::load_obj(const std::string& model_path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, ThreadPool* thread_pool)
+{
+	TRACE_SCOPE("ModelLoader::load_obj");
+
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string warn, err;
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str()))
+		throw std::runtime_error(warn + err);
+
+	if (thread_pool != nullptr && thread_pool->get_thread_count() > 1)
+		weld_parallel(attrib, shapes, vertices, indices, *thread_pool);
+	else
+		weld_serial(attrib, shapes, vertices, indices);
+}
+
+void ModelLoader::benchmark_welding(const std::string& model_path, uint32_t iterations)
 {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
@@ -13,38 +333,95 @@ void ModelLoader::load_model(std::string model_path, std::vector<Vertex>& vertic
 	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str()))
 		throw std::runtime_error(warn + err);
 
+	size_t index_count = 0;
 	for (const auto& shape : shapes)
-	{
-		std::unordered_map<Vertex, uint32_t> unique_vertices{};
+		index_count += shape.mesh.indices.size();
 
-		for (const auto& index : shape.mesh.indices)
-		{
-			Vertex vertex{};
+	std::cout << model_path << ": " << shapes.size() << " shapes, " << index_count << " indices, " << iterations << " iterations\n";
 
-			vertex.pos = {
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
-			};
+	double map_milliseconds = 0.0;
+	double welder_milliseconds = 0.0;
+	std::vector<Vertex> map_vertices, welder_vertices;
+	std::vector<uint32_t> map_indices, welder_indices;
 
-			vertex.tex_coord = {
-				attrib.texcoords[2 * index.texcoord_index + 0],
+	for (uint32_t iteration = 0; iteration < iterations; iteration++)
+	{
+		map_vertices.clear();
+		map_indices.clear();
 
-				// The OBJ format assumes a coordinate system where a vertical coordinate of 0 means the bottom of the image,
-				// however we've uploaded our image into Vulkan in a top to bottom orientation where 0 means the top of the image.
-				// Solve this by flipping the vertical component of the texture coordinates.
-				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-			};
+		// The previous implementation, std::hash<Vertex> with a lookup and an insertion per index
+		auto start = std::chrono::high_resolution_clock::now();
 
-			vertex.color = { 1.0f, 1.0f, 1.0f };
+		for (const auto& shape : shapes)
+		{
+			std::unordered_map<Vertex, uint32_t> unique_vertices{};
 
-			if (unique_vertices.count(vertex) == 0)
+			for (const auto& index : shape.mesh.indices)
 			{
-				unique_vertices[vertex] = static_cast<uint32_t>(vertices.size());
-				vertices.push_back(vertex);
+				Vertex vertex = make_vertex(attrib, index);
+
+				if (unique_vertices.count(vertex) == 0)
+				{
+					unique_vertices[vertex] = static_cast<uint32_t>(map_vertices.size());
+					map_vertices.push_back(vertex);
+				}
+
+				map_indices.push_back(unique_vertices[vertex]);
 			}
+		}
+
+		auto middle = std::chrono::high_resolution_clock::now();
 
-			indices.push_back(unique_vertices[vertex]);
+		welder_vertices.clear();
+		welder_indices.clear();
+
+		VertexWelder welder;
+
+		for (const auto& shape : shapes)
+		{
+			welder.reset(shape.mesh.indices.size());
+
+			for (const auto& index : shape.mesh.indices)
+				welder_indices.push_back(welder.weld(make_vertex(attrib, index), welder_vertices));
 		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+
+		map_milliseconds += std::chrono::duration<double, std::milli>(middle - start).count();
+		welder_milliseconds += std::chrono::duration<double, std::milli>(end - middle).count();
+	}
+
+	std::cout << "unordered_map: " << map_milliseconds / iterations << " ms, " << map_vertices.size() << " vertices\n";
+	std::cout << "VertexWelder:  " << welder_milliseconds / iterations << " ms, " << welder_vertices.size() << " vertices\n";
+	std::cout << "Speedup: " << map_milliseconds / welder_milliseconds << "x\n";
+
+	if (map_indices.size() != welder_indices.size() || map_vertices.size() != welder_vertices.size())
+		std::cout << "The results differ (vertices with -0.0 or NaN compare differently as bytes).\n";
+
+	ThreadPool thread_pool;
+	thread_pool.init(std::max(1u, std::thread::hardware_concurrency()));
+
+	double parallel_milliseconds = 0.0;
+	std::vector<Vertex> parallel_vertices;
+	std::vector<uint32_t> parallel_indices;
+
+	for (uint32_t iteration = 0; iteration < iterations; iteration++)
+	{
+		parallel_vertices.clear();
+		parallel_indices.clear();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		weld_parallel(attrib, shapes, parallel_vertices, parallel_indices, thread_pool);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		parallel_milliseconds += std::chrono::duration<double, std::milli>(end - start).count();
 	}
+
+	bool identical = parallel_indices == welder_indices && parallel_vertices.size() == welder_vertices.size()
+		&& memcmp(parallel_vertices.data(), welder_vertices.data(), welder_vertices.size() * sizeof(Vertex)) == 0;
+
+	std::cout << "Parallel (" << thread_pool.get_thread_count() << " threads): " << parallel_milliseconds / iterations << " ms, "
+		<< (identical ? "identical to serial" : "DIFFERENT from serial") << "\n";
+
+	thread_pool.cleanup();
 }
\ No newline at end of file
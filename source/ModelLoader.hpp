@@ -10,6 +10,8 @@
 #include <glm/gtx/hash.hpp>
 #include <vulkan/vulkan.h>
 
+class ThreadPool;
+
 struct Vertex {
 	glm::vec3 pos;
 	glm::vec3 color;
@@ -73,5 +75,23 @@ struct Uniform_Buffer_Object
 class ModelLoader
 {
 public:
-	static void load_model(std::string model_path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+	// Loads the model from its binary mesh cache, which is (re)built from the OBJ file when it's missing or out of date.
+	// If the OBJ file isn't there the cache is used on its own, so only the .vmesh files have to be shipped.
+	// With a thread pool, the vertices of an OBJ file are welded on all of its threads (see load_obj).
+	// With optimize, the mesh goes through MeshOptimizer before it's cached, so that only happens when the cache is rebuilt.
+	static void load_model(std::string model_path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, glm::vec4* bounding_sphere = nullptr,
+		ThreadPool* thread_pool = nullptr, bool optimize = true);
+	// Parses the OBJ file, without touching the cache. With a thread pool the welding is split by shape and,
+	// inside big shapes, by index range. The result is byte for byte the same as without one.
+	static void load_obj(const std::string& model_path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, ThreadPool* thread_pool = nullptr);
+	// Times the vertex welding of the OBJ file with VertexWelder against the std::unordered_map it replaced,
+	// and the parallel welding against the serial one
+	static void benchmark_welding(const std::string& model_path, uint32_t iterations);
+	// Offline conversion of an OBJ file into a mesh cache file, prints the vertex cache statistics of the optimization
+	static void convert_model(const std::string& model_path, const std::string& mesh_path, ThreadPool* thread_pool = nullptr, bool optimize = true);
+	// models/name.obj -> models/name.vmesh
+	static std::string get_mesh_cache_path(const std::string& model_path);
+
+	// Sphere around the center of the bounding box, it's not the tightest one but it's cheap to build
+	static glm::vec4 compute_bounding_sphere(const Vertex* vertices, size_t vertex_count);
 };
@@ -0,0 +1,153 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "FileStream.hpp"
+#include "Hash.hpp"
+#include "PipelineCache.hpp"
+
+void PipelineCache::init(VkPhysicalDevice physical_device, VkDevice device, const std::string& path)
+{
+	this->device = device;
+	this->path = path;
+
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+	std::vector<char> data;
+	bool loaded = load(data);
+
+	VkPipelineCacheCreateInfo cache_info{};
+	cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cache_info.initialDataSize = loaded ? data.size() : 0;
+	cache_info.pInitialData = loaded ? data.data() : nullptr;
+
+	// The driver checks the data too and ignores it when it doesn't match, but it's allowed to fail instead
+	if (vkCreatePipelineCache(device, &cache_info, nullptr, &cache) != VK_SUCCESS)
+	{
+		cache_info.initialDataSize = 0;
+		cache_info.pInitialData = nullptr;
+
+		if (vkCreatePipelineCache(device, &cache_info, nullptr, &cache) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create pipeline cache.");
+	}
+}
+
+void PipelineCache::cleanup()
+{
+	save();
+
+	vkDestroyPipelineCache(device, cache, nullptr);
+	cache = VK_NULL_HANDLE;
+}
+
+PipelineCache::FileHeader PipelineCache::make_header() const
+{
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = FILE_MAGIC;
+	header.version = FILE_VERSION;
+	header.vendor_id = properties.vendorID;
+	header.device_id = properties.deviceID;
+	header.driver_version = properties.driverVersion;
+	memcpy(header.pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+	return header;
+}
+
+bool PipelineCache::load(std::vector<char>& data) const
+{
+	std::vector<char> file;
+
+	try
+	{
+		file = FileStream::read_file(path);
+	}
+	catch (const std::exception&)
+	{
+		// No cache yet
+		return false;
+	}
+
+	FileHeader expected = make_header();
+	FileHeader header;
+
+	if (file.size() < sizeof(header))
+	{
+		std::cout << "Pipeline cache " << path << " is damaged, discarding it.\n";
+		return false;
+	}
+
+	memcpy(&header, file.data(), sizeof(header));
+
+	if (header.magic != expected.magic || header.version != expected.version)
+	{
+		std::cout << "Pipeline cache " << path << " has an unknown format, discarding it.\n";
+		return false;
+	}
+
+	if (header.vendor_id != expected.vendor_id || header.device_id != expected.device_id || header.driver_version != expected.driver_version
+		|| memcmp(header.pipeline_cache_uuid, expected.pipeline_cache_uuid, VK_UUID_SIZE) != 0)
+	{
+		std::cout << "Pipeline cache " << path << " was created with a different device or driver, discarding it.\n";
+		return false;
+	}
+
+	if (header.data_size != file.size() - sizeof(header) || header.data_hash != Hash::bytes(file.data() + sizeof(header), file.size() - sizeof(header)))
+	{
+		std::cout << "Pipeline cache " << path << " is damaged, discarding it.\n";
+		return false;
+	}
+
+	data.assign(file.begin() + sizeof(header), file.end());
+
+	return true;
+}
+
+void PipelineCache::save() const
+{
+	size_t data_size = 0;
+
+	if (vkGetPipelineCacheData(device, cache, &data_size, nullptr) != VK_SUCCESS || data_size == 0)
+		return;
+
+	std::vector<char> data(data_size);
+
+	if (vkGetPipelineCacheData(device, cache, &data_size, data.data()) != VK_SUCCESS)
+		return;
+
+	data.resize(data_size);
+
+	FileHeader header = make_header();
+	header.data_size = data.size();
+	header.data_hash = Hash::bytes(data.data(), data.size());
+
+	// Written next to the old file and renamed over it, so a crash while saving doesn't leave half a cache behind
+	std::string temporary_path = path + ".tmp";
+
+	{
+		std::ofstream output(temporary_path, std::ios::binary | std::ios::trunc);
+
+		if (!output.is_open())
+		{
+			std::cout << "Failed to save pipeline cache to " << path << ".\n";
+			return;
+		}
+
+		output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		output.write(data.data(), data.size());
+
+		if (!output)
+		{
+			std::cout << "Failed to save pipeline cache to " << path << ".\n";
+			return;
+		}
+	}
+
+	// std::rename doesn't replace an existing file everywhere
+	std::remove(path.c_str());
+
+	if (std::rename(temporary_path.c_str(), path.c_str()) != 0)
+		std::cout << "Failed to save pipeline cache to " << path << ".\n";
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// VkPipelineCache that is loaded from a file at startup and written back on cleanup, so the shaders are only
+// compiled by the driver on the first launch. The file starts with a header identifying the device and driver
+// it was created with, a cache from a different GPU or driver version (or a damaged file) is thrown away.
+class PipelineCache
+{
+public:
+
+	void init(VkPhysicalDevice physical_device, VkDevice device, const std::string& path);
+	// Saves the cache and destroys it
+	void cleanup();
+
+	VkPipelineCache get_cache() const { return cache; }
+
+private:
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vendor_id;
+		uint32_t device_id;
+		uint32_t driver_version;
+		uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+		// Keeps the 64-bit fields aligned without padding, so the struct can be written as it is
+		uint32_t reserved;
+		uint64_t data_size;
+		uint64_t data_hash;
+	};
+
+	static const uint32_t FILE_MAGIC = 0x43504B56; // "VKPC"
+	static const uint32_t FILE_VERSION = 2;
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties properties{};
+	std::string path;
+
+	FileHeader make_header() const;
+	bool load(std::vector<char>& data) const;
+	void save() const;
+};
@@ -1,41 +1,73 @@
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
+#include <cstring>
+#include <thread>
 
 #include "FileStream.hpp"
 #include "Renderer.hpp"
+#include "Trace.hpp"
 
 void Renderer::init_vulkan()
 {
+	TRACE_SCOPE("Renderer::init_vulkan");
+
+	// Filled by the create functions below
+	frames.assign(frames_in_flight, FrameContext{});
+
 	create_instance();
 	//setup_debug_messenger();
 	// Window surface needs to be created right after the instance creation, because it can actually influence the physical device selection
-	create_surface();
+	if (!headless)
+		create_surface();
 	pick_physical_device();
 	create_logical_device();
-	create_swap_chain();
+	allocator.init(physical_device, device);
+	// Loaded before any pipeline is created, a missing or outdated file just gives an empty cache
+	pipeline_cache.init(physical_device, device, PIPELINE_CACHE_PATH);
+	sampler_cache.init(device);
+	create_upload_context();
+
+	if (headless)
+		create_offscreen_images();
+	else
+		create_swap_chain();
+
 	create_image_views();
 	create_render_pass();
 	create_descriptor_set_layout();
+	create_cull_descriptor_set_layout();
+	create_texture_table();
 	create_graphics_pipeline();
 	create_command_pool();
+	create_worker_command_pools();
 	create_color_resources();
 	create_depth_resources();
 	create_framebuffers();
-	create_texture_image();
-	create_texture_image_view();
 	create_texture_sampler();
-	ModelLoader::load_model(MODEL_PATH, vertices, indices); // TODO: don't hardcode this
+	create_textures();
+	create_scene();
 	create_vertex_buffer();
 	create_index_buffer();
+	// The meshlet culling shader is specialized for the index type of the scene
+	create_cull_pipeline();
+	create_draw_buffers();
 	create_uniform_buffers();
 	create_descriptor_pool();
 	create_descriptor_sets();
 	create_command_buffers();
 	create_sync_objects();
+	create_gpu_profiler();
+
+	// All the uploads recorded above go to the GPU in one submission. We don't wait for it, the frames
+	// are submitted to the same queue after it and the upload batch ends with a barrier.
+	upload_context.submit();
+
+	if (enable_validation_layers)
+		allocator.print_stats();
 }
 
 void Renderer::recreate_swap_chain()
 {
+	TRACE_SCOPE("Renderer::recreate_swap_chain");
+
 	int width = 0, height = 0;
 	glfwGetFramebufferSize(window, &width, &height);
 
@@ -52,19 +84,32 @@ void Renderer::recreate_swap_chain()
 	create_color_resources();
 	create_depth_resources();
 	create_framebuffers();
-	create_uniform_buffers();
-	create_descriptor_pool();
-	create_descriptor_sets();
 
-	if (swap_chain_images.size() != command_buffers.size())
+	// Depth image layout transition
+	upload_context.submit();
+
+	// The framebuffers changed, so every command buffer has to be recorded again
+	if (frames[0].command_buffers.size() != swap_chain_framebuffers.size())
 	{
-		vkFreeCommandBuffers(device, command_pool, static_cast<uint32_t>(command_buffers.size()), command_buffers.data());
+		for (FrameContext& frame : frames)
+		{
+			for (FrameCommandBuffer& frame_command_buffer : frame.command_buffers)
+				vkFreeCommandBuffers(device, command_pool, 1, &frame_command_buffer.command_buffer);
+		}
+
 		create_command_buffers();
 	}
+
+	// No frame is in flight anymore, create_swap_chain waited for the device
+	images_in_flight.assign(swap_chain_images.size(), VK_NULL_HANDLE);
+
+	invalidate_command_buffers();
 }
 
 void Renderer::create_instance()
 {
+	TRACE_SCOPE("Renderer::create_instance");
+
 	VkApplicationInfo app_info{};
 	app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
 	app_info.pApplicationName = "Vulkan Engine";
@@ -78,9 +123,11 @@ void Renderer::create_instance()
 	info.pApplicationInfo = &app_info;
 
 	uint32_t glfw_extension_count = 0;
-	const char** glfw_extensions;
+	const char** glfw_extensions = nullptr;
 
-	glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+	// Headless rendering needs no surface extensions, GLFW isn't even initialized then
+	if (!headless)
+		glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
 
 	info.enabledExtensionCount = glfw_extension_count;
 	info.ppEnabledExtensionNames = glfw_extensions;
@@ -172,6 +219,8 @@ void Renderer::create_surface()
 
 void Renderer::pick_physical_device()
 {
+	TRACE_SCOPE("Renderer::pick_physical_device");
+
 	uint32_t device_count = 0;
 
 	vkEnumeratePhysicalDevices(instance, &device_count, nullptr);
@@ -209,20 +258,39 @@ bool Renderer::is_device_suitable(VkPhysicalDevice device)
 	if (!find_queue_indices(device, indices))
 		return false;
 
-	if (!device_features.geometryShader)
+	// Draws find their Draw_Data through firstInstance of the indirect commands
+	if (!device_features.drawIndirectFirstInstance)
 		return false;
 
 	if (!check_device_extensions(device))
 		return false;
 
-	SwapChainSupportDetails swap_chain_support_details = query_swap_chain_support(device);
-	if (swap_chain_support_details.formats.empty() || swap_chain_support_details.present_modes.empty())
-		return false;
+	if (!headless)
+	{
+		SwapChainSupportDetails swap_chain_support_details = query_swap_chain_support(device);
+		if (swap_chain_support_details.formats.empty() || swap_chain_support_details.present_modes.empty())
+			return false;
+	}
 
 	// TODO: maybe don't return false and just set the sampler info to not use anisotropic filtering?
 	if (!device_features.samplerAnisotropy)
 		return false;
 
+	// The texture table needs descriptor indexing, core in Vulkan 1.2
+	if (VK_API_VERSION_MAJOR(device_properties.apiVersion) == 1 && VK_API_VERSION_MINOR(device_properties.apiVersion) < 2)
+		return false;
+
+	VkPhysicalDeviceVulkan12Features vulkan12_features{};
+	vulkan12_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+	VkPhysicalDeviceFeatures2 features2{};
+	features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features2.pNext = &vulkan12_features;
+	vkGetPhysicalDeviceFeatures2(device, &features2);
+
+	if (!TextureTable::is_supported(vulkan12_features))
+		return false;
+
 	return true;
 }
 
@@ -239,30 +307,59 @@ bool Renderer::find_queue_indices(VkPhysicalDevice device, QueueFamilyIndices& i
 	uint32_t i = 0;
 	bool graphics_family_found = false;
 	bool present_family_found = false;
+	bool transfer_family_found = false;
+	bool compute_family_found = false;
 	for (const auto& queue_family_properties : queue_families_properties)
 	{
+		VkQueueFlags flags = queue_family_properties.queueFlags;
+
 		// We want a device that can draw AND display it to the surface
-		if (queue_family_properties.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		if (!graphics_family_found && (flags & VK_QUEUE_GRAPHICS_BIT))
 		{
 			new_indices.graphics_family = i;
 			graphics_family_found = true;
 		}
 
 		VkBool32 surface_supported = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &surface_supported);
 
-		if (surface_supported)
+		if (!headless)
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &surface_supported);
+
+		if (!present_family_found && surface_supported)
 		{
 			new_indices.present_family = i;
 			present_family_found = true;
 		}
 
-		if (graphics_family_found && present_family_found)
-			break;
+		// A family with only the transfer bit is usually backed by the DMA engines, which can copy while the GPU renders
+		if (!transfer_family_found && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			new_indices.transfer_family = i;
+			transfer_family_found = true;
+		}
+
+		if (!compute_family_found && (flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			new_indices.compute_family = i;
+			compute_family_found = true;
+		}
 
 		i++;
 	}
 
+	if (!transfer_family_found)
+		new_indices.transfer_family = new_indices.graphics_family;
+
+	if (!compute_family_found)
+		new_indices.compute_family = new_indices.graphics_family;
+
+	// Nothing is presented without a window
+	if (headless)
+	{
+		new_indices.present_family = new_indices.graphics_family;
+		present_family_found = graphics_family_found;
+	}
+
 	indices = new_indices;
 	return graphics_family_found && present_family_found;
 }
@@ -287,11 +384,13 @@ bool Renderer::check_device_extensions(VkPhysicalDevice device)
 
 void Renderer::create_logical_device()
 {
+	TRACE_SCOPE("Renderer::create_logical_device");
+
 	QueueFamilyIndices indices{};
 	find_queue_indices(physical_device, indices);
 
 	std::vector<VkDeviceQueueCreateInfo> queue_infos{};
-	std::set<uint32_t> unique_queue_families = { indices.graphics_family, indices.present_family };
+	std::set<uint32_t> unique_queue_families = { indices.graphics_family, indices.present_family, indices.transfer_family, indices.compute_family };
 
 	float queue_priority = 1.0;
 	for (const uint32_t unique_queue_family : unique_queue_families)
@@ -304,11 +403,60 @@ void Renderer::create_logical_device()
 		queue_infos.push_back(queue_info);
 	}
 
+	VkPhysicalDeviceProperties device_properties;
+	vkGetPhysicalDeviceProperties(physical_device, &device_properties);
+
+	VkPhysicalDeviceFeatures supported_features;
+	vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+
+	// Without multiDrawIndirect every indirect command is drawn with its own call
+	supports_multi_draw_indirect = supported_features.multiDrawIndirect == VK_TRUE;
+
+	// Only Vulkan 1.2 devices are picked, see is_device_suitable
+	VkPhysicalDeviceVulkan12Features supported_vulkan12_features{};
+	supported_vulkan12_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+	VkPhysicalDeviceFeatures2 supported_features2{};
+	supported_features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supported_features2.pNext = &supported_vulkan12_features;
+	vkGetPhysicalDeviceFeatures2(physical_device, &supported_features2);
+
+	supports_draw_indirect_count = supported_vulkan12_features.drawIndirectCount == VK_TRUE;
+
+	// Without them the passes are only timed
+	supports_pipeline_statistics = supported_features.pipelineStatisticsQuery == VK_TRUE;
+	supports_inherited_queries = supported_features.inheritedQueries == VK_TRUE;
+
+	if (vertex_format == VertexFormat::Compact)
+	{
+		for (const VkVertexInputAttributeDescription& attribute : Compact_Vertex::get_attribute_descriptions())
+		{
+			VkFormatProperties format_properties;
+			vkGetPhysicalDeviceFormatProperties(physical_device, attribute.format, &format_properties);
+
+			if (!(format_properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT))
+				vertex_format = VertexFormat::Full;
+		}
+	}
+
 	VkPhysicalDeviceFeatures device_features{};
 	device_features.samplerAnisotropy = VK_TRUE;
+	device_features.drawIndirectFirstInstance = VK_TRUE;
+	device_features.multiDrawIndirect = supports_multi_draw_indirect ? VK_TRUE : VK_FALSE;
+	// Block compressed textures can only be sampled in the families the device has the feature for, see TextureStreamer::load_texture_data
+	device_features.textureCompressionBC = supported_features.textureCompressionBC;
+	device_features.textureCompressionASTC_LDR = supported_features.textureCompressionASTC_LDR;
+	device_features.pipelineStatisticsQuery = supports_pipeline_statistics ? VK_TRUE : VK_FALSE;
+	device_features.inheritedQueries = supports_inherited_queries ? VK_TRUE : VK_FALSE;
+
+	VkPhysicalDeviceVulkan12Features vulkan12_features{};
+	vulkan12_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	vulkan12_features.drawIndirectCount = supports_draw_indirect_count ? VK_TRUE : VK_FALSE;
+	TextureTable::enable_features(vulkan12_features);
 
 	VkDeviceCreateInfo info{};
 	info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	info.pNext = &vulkan12_features;
 	info.queueCreateInfoCount = static_cast<uint32_t>(queue_infos.size());
 	info.pQueueCreateInfos = queue_infos.data();
 	info.pEnabledFeatures = &device_features;
@@ -332,6 +480,8 @@ void Renderer::create_logical_device()
 
 	vkGetDeviceQueue(device, indices.graphics_family, 0, &graphics_queue);
 	vkGetDeviceQueue(device, indices.present_family, 0, &present_queue);
+	vkGetDeviceQueue(device, indices.transfer_family, 0, &transfer_queue);
+	vkGetDeviceQueue(device, indices.compute_family, 0, &compute_queue);
 }
 
 // Just checking if a swap chain is available is not sufficient, because it may not actually be compatible with our window surface
@@ -411,6 +561,8 @@ VkExtent2D Renderer::choose_swap_extent(const VkSurfaceCapabilitiesKHR& capabili
 // https://vulkan-tutorial.com/Drawing_a_triangle/Presentation/Swap_chain
 void Renderer::create_swap_chain(bool recreation)
 {
+	TRACE_SCOPE("Renderer::create_swap_chain");
+
 	SwapChainSupportDetails swap_chain_support_details = query_swap_chain_support(physical_device);
 
 	VkSurfaceFormatKHR surface_format = choose_swap_surface_format(swap_chain_support_details.formats);
@@ -485,6 +637,26 @@ void Renderer::create_swap_chain(bool recreation)
 	swap_chain_extent = extent;
 }
 
+void Renderer::create_offscreen_images()
+{
+	TRACE_SCOPE("Renderer::create_offscreen_images");
+
+	// Every frame in flight draws into its own image, the fence of the frame guards it like acquiring a swap chain image would.
+	// R8G8B8A8_SRGB can be rendered to on every device and is what read_frame hands out.
+	swap_chain_image_format = VK_FORMAT_R8G8B8A8_SRGB;
+	swap_chain_extent = headless_extent;
+
+	swap_chain_images.resize(frames_in_flight);
+	offscreen_image_allocations.resize(frames_in_flight);
+
+	for (uint32_t i = 0; i < frames_in_flight; i++)
+	{
+		create_image(swap_chain_extent.width, swap_chain_extent.height, 1, VK_SAMPLE_COUNT_1_BIT, swap_chain_image_format, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			swap_chain_images[i], offscreen_image_allocations[i]);
+	}
+}
+
 void Renderer::create_image_views()
 {
 	swap_chain_image_views.resize(swap_chain_images.size());
@@ -551,7 +723,8 @@ void Renderer::create_render_pass()
 	color_attachment_resolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	color_attachment_resolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	color_attachment_resolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	color_attachment_resolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// Offscreen images stay attachments, read_frame moves them to the transfer layout when it copies one
+	color_attachment_resolve.finalLayout = headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference color_attachment_resolve_ref{};
 	color_attachment_resolve_ref.attachment = 2;
@@ -590,6 +763,8 @@ void Renderer::create_render_pass()
 
 void Renderer::create_graphics_pipeline()
 {
+	TRACE_SCOPE("Renderer::create_graphics_pipeline");
+
 	auto vert_shader_code = FileStream::read_file("shaders/vert.spv");
 	auto frag_shader_code = FileStream::read_file("shaders/frag.spv");
 
@@ -612,8 +787,25 @@ void Renderer::create_graphics_pipeline()
 
 	VkPipelineShaderStageCreateInfo shader_stages[] = { vert_shader_stage_info, frag_shader_stage_info };
 
-	auto binding_desc = Vertex::get_binding_description();
-	auto attribute_descs = Vertex::get_attribute_descriptions();
+	bool compact_vertices = vertex_format == VertexFormat::Compact;
+	auto binding_desc = compact_vertices ? Compact_Vertex::get_binding_description() : Vertex::get_binding_description();
+	auto attribute_descs = compact_vertices ? Compact_Vertex::get_attribute_descriptions() : Vertex::get_attribute_descriptions();
+
+	// The vertex shader dequantizes the attributes only when they are compact, the branch is removed when the pipeline is compiled
+	VkBool32 compact_vertices_constant = compact_vertices ? VK_TRUE : VK_FALSE;
+
+	VkSpecializationMapEntry specialization_entry{};
+	specialization_entry.constantID = 0;
+	specialization_entry.offset = 0;
+	specialization_entry.size = sizeof(compact_vertices_constant);
+
+	VkSpecializationInfo vert_specialization_info{};
+	vert_specialization_info.mapEntryCount = 1;
+	vert_specialization_info.pMapEntries = &specialization_entry;
+	vert_specialization_info.dataSize = sizeof(compact_vertices_constant);
+	vert_specialization_info.pData = &compact_vertices_constant;
+
+	shader_stages[0].pSpecializationInfo = &vert_specialization_info;
 
 	// https://vulkan-tutorial.com/en/Drawing_a_triangle/Graphics_pipeline_basics/Fixed_functions#page_Vertex-input
 	VkPipelineVertexInputStateCreateInfo vertex_input_info{};
@@ -703,10 +895,13 @@ void Renderer::create_graphics_pipeline()
 	depth_stencil.back = {};
 
 	// https://vulkan-tutorial.com/en/Drawing_a_triangle/Graphics_pipeline_basics/Fixed_functions#page_Pipeline-layout
+	// Set 1 is the texture table, it's the same for every pipeline and never changes
+	std::array<VkDescriptorSetLayout, 2> set_layouts = { descriptor_set_layout, texture_table.get_layout() };
+
 	VkPipelineLayoutCreateInfo pipeline_layout_info{};
 	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipeline_layout_info.setLayoutCount = 1;
-	pipeline_layout_info.pSetLayouts = &descriptor_set_layout;
+	pipeline_layout_info.setLayoutCount = static_cast<uint32_t>(set_layouts.size());
+	pipeline_layout_info.pSetLayouts = set_layouts.data();
 	pipeline_layout_info.pushConstantRangeCount = 0;
 	pipeline_layout_info.pPushConstantRanges = nullptr;
 
@@ -739,13 +934,77 @@ void Renderer::create_graphics_pipeline()
 	pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
 	pipeline_info.basePipelineIndex = -1;
 
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &graphics_pipeline) != VK_SUCCESS)
+	if (vkCreateGraphicsPipelines(device, pipeline_cache.get_cache(), 1, &pipeline_info, nullptr, &graphics_pipeline) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create graphics pipeline!");
 
 	vkDestroyShaderModule(device, vert_shader_module, nullptr);
 	vkDestroyShaderModule(device, frag_shader_module, nullptr);
 }
 
+void Renderer::create_cull_pipeline()
+{
+	TRACE_SCOPE("Renderer::create_cull_pipeline");
+
+	auto cull_shader_code = FileStream::read_file("shaders/cull.spv");
+	VkShaderModule cull_shader_module = create_shader_module(cull_shader_code);
+
+	VkPipelineShaderStageCreateInfo cull_shader_stage_info{};
+	cull_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	cull_shader_stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	cull_shader_stage_info.module = cull_shader_module;
+	cull_shader_stage_info.pName = "main";
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info{};
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount = 1;
+	pipeline_layout_info.pSetLayouts = &cull_descriptor_set_layout;
+	pipeline_layout_info.pushConstantRangeCount = 0;
+	pipeline_layout_info.pPushConstantRanges = nullptr;
+
+	if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &cull_pipeline_layout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create cull pipeline layout.");
+
+	VkComputePipelineCreateInfo pipeline_info{};
+	pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_info.stage = cull_shader_stage_info;
+	pipeline_info.layout = cull_pipeline_layout;
+	pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+	pipeline_info.basePipelineIndex = -1;
+
+	if (vkCreateComputePipelines(device, pipeline_cache.get_cache(), 1, &pipeline_info, nullptr, &cull_pipeline) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create cull pipeline!");
+
+	vkDestroyShaderModule(device, cull_shader_module, nullptr);
+
+	if (!meshlet_culling)
+		return;
+
+	auto meshlet_cull_shader_code = FileStream::read_file("shaders/cull_meshlets.spv");
+	VkShaderModule meshlet_cull_shader_module = create_shader_module(meshlet_cull_shader_code);
+
+	// The shader reads the indices straight from the index buffer, it has to know how they are packed
+	VkBool32 source_indices_16bit_constant = index_type == VK_INDEX_TYPE_UINT16 ? VK_TRUE : VK_FALSE;
+
+	VkSpecializationMapEntry specialization_entry{};
+	specialization_entry.constantID = 0;
+	specialization_entry.offset = 0;
+	specialization_entry.size = sizeof(source_indices_16bit_constant);
+
+	VkSpecializationInfo specialization_info{};
+	specialization_info.mapEntryCount = 1;
+	specialization_info.pMapEntries = &specialization_entry;
+	specialization_info.dataSize = sizeof(source_indices_16bit_constant);
+	specialization_info.pData = &source_indices_16bit_constant;
+
+	pipeline_info.stage.module = meshlet_cull_shader_module;
+	pipeline_info.stage.pSpecializationInfo = &specialization_info;
+
+	if (vkCreateComputePipelines(device, pipeline_cache.get_cache(), 1, &pipeline_info, nullptr, &meshlet_cull_pipeline) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create meshlet cull pipeline!");
+
+	vkDestroyShaderModule(device, meshlet_cull_shader_module, nullptr);
+}
+
 VkShaderModule Renderer::create_shader_module(const std::vector<char>& code)
 {
 	VkShaderModuleCreateInfo info{};
@@ -789,6 +1048,14 @@ void Renderer::create_framebuffers()
 	}
 }
 
+void Renderer::create_upload_context()
+{
+	QueueFamilyIndices queue_family_indices;
+	find_queue_indices(physical_device, queue_family_indices);
+
+	upload_context.init(device, graphics_queue, queue_family_indices.graphics_family, transfer_queue, queue_family_indices.transfer_family, &allocator);
+}
+
 // https://vulkan-tutorial.com/en/Drawing_a_triangle/Drawing/Command_buffers#page_Command-pools
 void Renderer::create_command_pool()
 {
@@ -798,7 +1065,9 @@ void Renderer::create_command_pool()
 	VkCommandPoolCreateInfo pool_info{};
 	pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	pool_info.queueFamilyIndex = queue_family_indices.graphics_family;
-	pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	// Cached command buffers live for many frames, so the pool isn't transient.
+	// Command buffers are reset individually when they are recorded again.
+	pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 	if (vkCreateCommandPool(device, &pool_info, nullptr, &command_pool) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create command pool.");
@@ -806,7 +1075,7 @@ void Renderer::create_command_pool()
 
 void Renderer::create_image(uint32_t width, uint32_t height, uint32_t mip_levels, VkSampleCountFlagBits samples_count,
 	VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-	VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& image_memory)
+	VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& image_allocation)
 {
 	// https://vulkan-tutorial.com/Texture_mapping/Images#page_Staging-buffer
 	VkImageCreateInfo image_info{};
@@ -828,19 +1097,12 @@ void Renderer::create_image(uint32_t width, uint32_t height, uint32_t mip_levels
 	if (vkCreateImage(device, &image_info, nullptr, &image) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create an image.");
 
-	VkMemoryRequirements mem_requirements;
+	// Render targets get their own memory, they are big and the driver may want to place them specially
+	bool is_render_target = usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
 
-	vkGetImageMemoryRequirements(device, image, &mem_requirements);
+	image_allocation = allocator.allocate_for_image(image, properties, is_render_target);
 
-	VkMemoryAllocateInfo alloc_info{};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.allocationSize = mem_requirements.size;
-	alloc_info.memoryTypeIndex = find_memory_type(mem_requirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(device, &alloc_info, nullptr, &image_memory) != VK_SUCCESS)
-		throw std::runtime_error("Failed to allocate image memory.");
-
-	vkBindImageMemory(device, image, image_memory, 0);
+	vkBindImageMemory(device, image, image_allocation.memory, image_allocation.offset);
 }
 
 void Renderer::create_color_resources()
@@ -848,7 +1110,7 @@ void Renderer::create_color_resources()
 	VkFormat color_format = swap_chain_image_format;
 
 	create_image(swap_chain_extent.width, swap_chain_extent.height, 1, mssa_samples, color_format, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, color_image, color_image_memory);
+		VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, color_image, color_image_allocation);
 
 	color_image_view = create_image_view(color_image, color_format, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 }
@@ -858,139 +1120,40 @@ void Renderer::create_depth_resources()
 	VkFormat depth_format = find_depth_format();
 
 	create_image(swap_chain_extent.width, swap_chain_extent.height, 1, mssa_samples, depth_format, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depth_image, depth_image_memory);
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depth_image, depth_image_allocation);
 
 	depth_image_view = create_image_view(depth_image, depth_format, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
 
 	transition_image_layout(depth_image, depth_format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
 }
 
-void Renderer::create_texture_image()
-{
-	// https://vulkan-tutorial.com/Texture_mapping/Images#page_Staging-buffer
-	int tex_width, tex_height, tex_channels;
-
-	stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &tex_width, &tex_height, &tex_channels, STBI_rgb_alpha);
-
-	mip_levels = static_cast<uint32_t>(std::floor(std::log2(std::max(tex_width, tex_height)))) + 1;
-
-	VkDeviceSize image_size = tex_width * tex_height * 4;
-
-	if (!pixels)
-		throw std::runtime_error("Failed to load texture image.");
-
-	VkBuffer staging_buffer;
-	VkDeviceMemory staging_buffer_memory;
-
-	create_buffer(image_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging_buffer, staging_buffer_memory);
-
-	void* data;
-	vkMapMemory(device, staging_buffer_memory, 0, image_size, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(image_size));
-	vkUnmapMemory(device, staging_buffer_memory);
-
-	stbi_image_free(pixels);
-
-	create_image(tex_width, tex_height, mip_levels, VK_SAMPLE_COUNT_1_BIT,
-		VK_FORMAT_R8G8B8A8_SRGB,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		texture_image,
-		texture_image_memory);
-
-	transition_image_layout(texture_image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mip_levels);
-
-	copy_buffer_to_image(staging_buffer, texture_image, static_cast<uint32_t>(tex_width), static_cast<uint32_t>(tex_height));
-
-	// While generating mip maps we transition to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-	generate_mipmaps(texture_image, VK_FORMAT_R8G8B8A8_SRGB, tex_width, tex_height, mip_levels);
-
-	// transition_image_layout(texture_image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
-
-	vkDestroyBuffer(device, staging_buffer, nullptr);
-	vkFreeMemory(device, staging_buffer_memory, nullptr);
-}
-
-// https://vulkan-tutorial.com/Generating_Mipmaps#page_Generating-Mipmaps
-// Generating mip maps at runtime is not a usual way to go. Most of the time they are pregenerated
-// and stored in texture file alongside the base level to improve loading times 
-void Renderer::generate_mipmaps(VkImage image, VkFormat image_format, int32_t tex_width, int32_t tex_height, uint32_t mip_levels)
+void Renderer::create_textures()
 {
-	// Check if image format supports linear blitting
-	VkFormatProperties format_properties;
-	vkGetPhysicalDeviceFormatProperties(physical_device, image_format, &format_properties);
-
-	if (!(format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
-	{
-		throw std::runtime_error("Texture image format does not support linear blitting.");
-	}
+	TRACE_SCOPE("Renderer::create_textures");
 
-	VkCommandBuffer command_buffer = begin_single_time_commands();
+	// Decoding gets half the cores, the rest keeps recording frames while textures load
+	uint32_t decode_thread_count = std::max(std::thread::hardware_concurrency() / 2, 1u);
 
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.image = image;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.subresourceRange.levelCount = 1;
-
-	int32_t mip_width = tex_width;
-	int32_t mip_height = tex_height;
+	texture_streamer.init(physical_device, device, &allocator, &upload_context, frames_in_flight, texture_memory_budget, decode_thread_count);
 
-	for (uint32_t i = 1; i < mip_levels; i++)
+	if (synthetic_object_count > 0)
 	{
-		barrier.subresourceRange.baseMipLevel = i - 1;
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-		VkImageBlit blit{};
-		blit.srcOffsets[0] = { 0, 0, 0 };
-		blit.srcOffsets[1] = { mip_width, mip_height, 1 };
-		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		blit.srcSubresource.mipLevel = i - 1;
-		blit.srcSubresource.baseArrayLayer = 0;
-		blit.srcSubresource.layerCount = 1;
-		blit.dstOffsets[0] = { 0, 0, 0 };
-		blit.dstOffsets[1] = { mip_width > 1 ? mip_width / 2 : 1, mip_height > 1 ? mip_height / 2 : 1, 1 };
-		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		blit.dstSubresource.mipLevel = i;
-		blit.dstSubresource.baseArrayLayer = 0;
-		blit.dstSubresource.layerCount = 1;
-
-		vkCmdBlitImage(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
-
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		// Generated here, the streamer only uploads them
+		for (uint32_t i = 0; i < synthetic_texture_count; i++)
+		{
+			Texture_Data data;
+			SyntheticScene::generate_texture(i, SYNTHETIC_TEXTURE_SIZE, data);
 
-		if (mip_width > 1)
-			mip_width /= 2;
+			uint32_t synthetic_texture = texture_streamer.add_texture(std::move(data));
+			texture_table_indices.push_back(texture_table.add_texture(texture_streamer.get_image_view(synthetic_texture), texture_sampler));
+		}
 
-		if (mip_height > 1)
-			mip_height /= 2;
+		return;
 	}
 
-	// For the last mip map
-	barrier.subresourceRange.baseMipLevel = mip_levels - 1;
-	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-	end_single_time_commands(command_buffer);
+	// Drawn with the placeholder until it's decoded
+	texture = texture_streamer.add_texture(TEXTURE_PATH);
+	texture_table_indices.push_back(texture_table.add_texture(texture_streamer.get_image_view(texture), texture_sampler));
 }
 
 VkSampleCountFlagBits Renderer::get_max_mssa_sample_count()
@@ -1010,11 +1173,6 @@ VkSampleCountFlagBits Renderer::get_max_mssa_sample_count()
 	return VK_SAMPLE_COUNT_1_BIT;
 }
 
-void Renderer::create_texture_image_view()
-{
-	texture_image_view = create_image_view(texture_image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, mip_levels);
-}
-
 void Renderer::create_texture_sampler()
 {
 	VkSamplerCreateInfo sampler_info{};
@@ -1039,157 +1197,235 @@ void Renderer::create_texture_sampler()
 	sampler_info.minLod = 0.0f;
 	sampler_info.maxLod = VK_LOD_CLAMP_NONE;
 
-	if (vkCreateSampler(device, &sampler_info, nullptr, &texture_sampler) != VK_SUCCESS)
-		throw std::runtime_error("Failed to create texture sampler");
+	// Textures with the same sampler settings share it
+	texture_sampler = sampler_cache.get_sampler(sampler_info);
 }
 
 // https://vulkan-tutorial.com/en/Vertex_buffers/Vertex_buffer_creation#page_Buffer-creation
+void Renderer::create_scene()
+{
+	TRACE_SCOPE("Renderer::create_scene");
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	glm::vec4 bounding_sphere;
+
+	if (synthetic_object_count > 0)
+	{
+		SyntheticScene::generate_sphere(synthetic_triangle_count, vertices, indices);
+		uint32_t sphere_mesh_index = scene.add_mesh(vertices, indices);
+
+		// Same area as the model grid, with gaps between the spheres
+		uint32_t grid_size = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(synthetic_object_count))));
+		float cell_size = 2.0f / grid_size;
+
+		for (uint32_t i = 0; i < synthetic_object_count; i++)
+		{
+			glm::vec3 position(((i % grid_size) + 0.5f) * cell_size - 1.0f, ((i / grid_size) + 0.5f) * cell_size - 1.0f, 0.0f);
+
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+			transform = glm::scale(transform, glm::vec3(cell_size * 0.4f));
+
+			scene.add_instance(sphere_mesh_index, transform, texture_table_indices[i % synthetic_texture_count]);
+		}
+
+		return;
+	}
+
+	ModelLoader::load_model(MODEL_PATH, vertices, indices, &bounding_sphere, &thread_pool, optimize_meshes); // TODO: don't hardcode this
+
+	uint32_t mesh_index = scene.add_mesh(vertices, indices, bounding_sphere);
+
+	// The instances are scaled down so the whole grid covers the area of a single model
+	float scale = 1.0f / scene_grid_size;
+
+	for (uint32_t y = 0; y < scene_grid_size; y++)
+	{
+		for (uint32_t x = 0; x < scene_grid_size; x++)
+		{
+			glm::vec3 position((x + 0.5f) * scale * 2.0f - 1.0f, (y + 0.5f) * scale * 2.0f - 1.0f, 0.0f);
+
+			if (scene_grid_size == 1)
+				position = glm::vec3(0.0f);
+
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+			transform = glm::scale(transform, glm::vec3(scale));
+
+			scene.add_instance(mesh_index, transform, texture_table_indices[texture]);
+		}
+	}
+}
+
 void Renderer::create_vertex_buffer()
 {
+	TRACE_SCOPE("Renderer::create_vertex_buffer");
+
 	// TODO: v!
 	/*
-	It should be noted that in a real world application, you're not supposed to actually call vkAllocateMemory
-	for every individual buffer. The maximum number of simultaneous memory allocations is limited
-	by the maxMemoryAllocationCount physical device limit, which may be as low as 4096 even on high end
-	hardware like an NVIDIA GTX 1080. The right way to allocate memory for a large number of objects
-	at the same time is to create a custom allocator that splits up a single allocation among many
-	different objects by using the offset parameters that we've seen in many functions.
-
-	The previous chapter already mentioned that you should allocate multiple resources like buffers
-	from a single memory allocation, but in fact you should go a step further. Driver developers recommend
-	that you also store multiple buffers, like the vertex and index buffer, into a single VkBuffer and use offsets
+	Memory for the buffers is sub-allocated by the MemoryAllocator, so we don't run into maxMemoryAllocationCount.
+
+	Driver developers recommend that you also store multiple buffers, like the vertex and index buffer, into a single VkBuffer and use offsets
 	in commands like vkCmdBindVertexBuffers. The advantage is that your data is more cache friendly in that case,
 	because it's closer together. It is even possible to reuse the same chunk of memory for multiple resources
 	if they are not used during the same render operations, provided that their data is refreshed, of course.
 	This is known as aliasing and some Vulkan functions have explicit flags to specify that you want to do this.
 	*/
 
+	const std::vector<Vertex>& vertices = scene.get_vertices();
+	std::vector<Compact_Vertex> compact_vertices;
+
+	const void* vertex_data = vertices.data();
 	VkDeviceSize buffer_size = sizeof(vertices[0]) * vertices.size();
-	VkBuffer staging_buffer;
-	VkDeviceMemory staging_buffer_memory;
 
-	create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging_buffer, staging_buffer_memory);
+	if (vertex_format == VertexFormat::Compact)
+	{
+		scene.build_compact_vertices(compact_vertices);
+		vertex_data = compact_vertices.data();
+		buffer_size = sizeof(compact_vertices[0]) * compact_vertices.size();
+	}
 
-	void* data;
-	vkMapMemory(device, staging_buffer_memory, 0, buffer_size, 0, &data);
-	memcpy(data, vertices.data(), (size_t)buffer_size);
-	vkUnmapMemory(device, staging_buffer_memory);
+	VkBuffer staging_buffer = upload_context.create_staging_buffer(vertex_data, buffer_size);
 
-	create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertex_buffer, vertex_buffer_memory);
+	create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertex_buffer, vertex_buffer_allocation);
 
 	copy_buffer(staging_buffer, vertex_buffer, buffer_size);
-
-	vkDestroyBuffer(device, staging_buffer, nullptr);
-	vkFreeMemory(device, staging_buffer_memory, nullptr);
 }
 
 void Renderer::create_index_buffer()
 {
+	TRACE_SCOPE("Renderer::create_index_buffer");
+
+	const std::vector<uint32_t>& indices = scene.get_indices();
+	std::vector<uint16_t> indices_16bit;
+
+	// The parts of the scene meshes are small enough for 16-bit indices, that halves the index buffer
+	index_type = scene.get_index_type();
+
+	const void* index_data = indices.data();
 	VkDeviceSize buffer_size = sizeof(indices[0]) * indices.size();
-	VkBuffer staging_buffer;
-	VkDeviceMemory staging_buffer_memory;
-	create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging_buffer, staging_buffer_memory);
 
-	void* data;
-	vkMapMemory(device, staging_buffer_memory, 0, buffer_size, 0, &data);
-	memcpy(data, indices.data(), (size_t)buffer_size);
-	vkUnmapMemory(device, staging_buffer_memory);
+	if (index_type == VK_INDEX_TYPE_UINT16)
+	{
+		scene.build_16bit_indices(indices_16bit);
+
+		// The meshlet culling shader reads the indices as pairs packed in a uint
+		if (indices_16bit.size() % 2 != 0)
+			indices_16bit.push_back(0);
+
+		index_data = indices_16bit.data();
+		buffer_size = sizeof(indices_16bit[0]) * indices_16bit.size();
+	}
 
-	create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, index_buffer, index_buffer_memory);
+	VkBuffer staging_buffer = upload_context.create_staging_buffer(index_data, buffer_size);
 
-	copy_buffer(staging_buffer, index_buffer, buffer_size);
+	create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, index_buffer, index_buffer_allocation);
 
-	vkDestroyBuffer(device, staging_buffer, nullptr);
-	vkFreeMemory(device, staging_buffer_memory, nullptr);
+	copy_buffer(staging_buffer, index_buffer, buffer_size);
 }
 
-void Renderer::create_uniform_buffers()
+void Renderer::create_draw_buffers()
 {
-	VkDeviceSize buffer_size = sizeof(Uniform_Buffer_Object);
+	TRACE_SCOPE("Renderer::create_draw_buffers");
 
-	uniform_buffers.resize(swap_chain_images.size());
-	uniform_buffers_memory.resize(swap_chain_images.size());
+	std::vector<Draw_Data> draw_data;
+	std::vector<VkDrawIndexedIndirectCommand> draw_commands;
+	std::vector<Lod_Data> lod_data;
+	std::vector<Meshlet_Data> meshlet_data;
+	scene.build_draws(draw_data, draw_commands, lod_data, meshlet_data);
 
-	for (size_t i = 0; i < swap_chain_images.size(); i++)
-	{
-		create_buffer(buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniform_buffers[i], uniform_buffers_memory[i]);
-	}
-}
+	draw_count = static_cast<uint32_t>(draw_commands.size());
 
-void Renderer::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage_flags, VkMemoryPropertyFlags properties,
-	VkBuffer& buffer, VkDeviceMemory& buffer_memory)
-{
-	VkBufferCreateInfo buffer_info{};
-	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	buffer_info.size = size;
-	buffer_info.usage = usage_flags;
-	buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (draw_count == 0)
+		throw std::runtime_error("The scene has nothing to draw.");
 
-	if (vkCreateBuffer(device, &buffer_info, nullptr, &buffer) != VK_SUCCESS)
-		throw std::runtime_error("Failed to create vertex buffer.");
+	VkDeviceSize buffer_size = sizeof(draw_data[0]) * draw_data.size();
+	VkBuffer staging_buffer = upload_context.create_staging_buffer(draw_data.data(), buffer_size);
+	create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, draw_data_buffer, draw_data_buffer_allocation);
+	copy_buffer(staging_buffer, draw_data_buffer, buffer_size);
 
-	VkMemoryRequirements mem_requirements;
-	vkGetBufferMemoryRequirements(device, buffer, &mem_requirements);
+	buffer_size = sizeof(draw_commands[0]) * draw_commands.size();
+	staging_buffer = upload_context.create_staging_buffer(draw_commands.data(), buffer_size);
+	create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirect_buffer, indirect_buffer_allocation);
+	copy_buffer(staging_buffer, indirect_buffer, buffer_size);
 
-	VkMemoryAllocateInfo alloc_info{};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.allocationSize = mem_requirements.size;
-	alloc_info.memoryTypeIndex = find_memory_type(mem_requirements.memoryTypeBits, properties);
+	VkDeviceSize lod_buffer_size = sizeof(lod_data[0]) * lod_data.size();
+	staging_buffer = upload_context.create_staging_buffer(lod_data.data(), lod_buffer_size);
+	create_buffer(lod_buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lod_buffer, lod_buffer_allocation);
+	copy_buffer(staging_buffer, lod_buffer, lod_buffer_size);
 
-	if (vkAllocateMemory(device, &alloc_info, nullptr, &buffer_memory) != VK_SUCCESS)
-		throw std::runtime_error("Failed to allocate vertex buffer memory.");
+	VkDeviceSize meshlet_buffer_size = sizeof(meshlet_data[0]) * meshlet_data.size();
+	staging_buffer = upload_context.create_staging_buffer(meshlet_data.data(), meshlet_buffer_size);
+	create_buffer(meshlet_buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshlet_buffer, meshlet_buffer_allocation);
+	copy_buffer(staging_buffer, meshlet_buffer, meshlet_buffer_size);
 
-	vkBindBufferMemory(device, buffer, buffer_memory, 0);
-}
+	// Written by the culling pass every frame, so the frames in flight can't share them
+	for (FrameContext& frame : frames)
+	{
+		create_buffer(buffer_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			frame.culled_indirect_buffer, frame.culled_indirect_buffer_allocation);
+
+		// There are at most as many segments as recording threads
+		create_buffer(sizeof(uint32_t) * thread_pool.get_thread_count(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.draw_count_buffer, frame.draw_count_buffer_allocation);
+
+		// Read before the frame was ever drawn, then nothing is wanted yet
+		VkDeviceSize texture_demand_size = sizeof(uint32_t) * texture_table.get_texture_count();
+		create_buffer(texture_demand_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.texture_demand_buffer, frame.texture_demand_buffer_allocation);
+		memset(frame.texture_demand_buffer_allocation.mapped_data, 0, texture_demand_size);
+	}
 
-VkCommandBuffer Renderer::begin_single_time_commands()
-{
-	VkCommandBufferAllocateInfo alloc_info{};
-	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	alloc_info.commandPool = command_pool;
-	alloc_info.commandBufferCount = 1;
+	if (!meshlet_culling)
+		return;
 
-	VkCommandBuffer command_buffer;
-	vkAllocateCommandBuffers(device, &alloc_info, &command_buffer);
+	// The visible draws take their ranges of the buffer in turn, it never needs more than all the draws at full detail.
+	// The draw commands start out with that many.
+	VkDeviceSize culled_index_count = 0;
+	for (const VkDrawIndexedIndirectCommand& command : draw_commands)
+		culled_index_count += command.indexCount;
 
-	VkCommandBufferBeginInfo begin_info{};
-	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	culled_index_capacity = static_cast<uint32_t>(std::min<VkDeviceSize>(culled_index_count, MAX_CULLED_INDICES));
 
-	vkBeginCommandBuffer(command_buffer, &begin_info);
+	// Nothing the meshlets could be culled from, the draws keep reading the scene index buffer
+	if (culled_index_capacity == 0)
+	{
+		meshlet_culling = false;
+		return;
+	}
 
-	return command_buffer;
+	for (FrameContext& frame : frames)
+	{
+		create_buffer(sizeof(uint32_t) * (1 + culled_index_capacity), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.culled_index_buffer, frame.culled_index_buffer_allocation);
+	}
 }
 
-void Renderer::end_single_time_commands(VkCommandBuffer command_buffer)
+void Renderer::create_uniform_buffers()
 {
-	vkEndCommandBuffer(command_buffer);
-
-	VkSubmitInfo submit_info{};
-	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &command_buffer;
+	uniform_ring_buffer.init(physical_device, device, &allocator, UNIFORM_RING_FRAME_SIZE, frames_in_flight);
+}
 
-	vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
+void Renderer::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage_flags, VkMemoryPropertyFlags properties,
+	VkBuffer& buffer, MemoryAllocation& buffer_allocation)
+{
+	VkBufferCreateInfo buffer_info{};
+	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_info.size = size;
+	buffer_info.usage = usage_flags;
+	buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	/* There are again two possible ways to wait on this transfer to complete.
-	   We could use a fence and wait with vkWaitForFences, or simply wait for the transfer queue to become idle with vkQueueWaitIdle.
-	   A fence would allow you to schedule multiple transfers simultaneously and wait for all of them complete,
-	   instead of executing one at a time. That may give the driver more opportunities to optimize. */
+	if (vkCreateBuffer(device, &buffer_info, nullptr, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create vertex buffer.");
 
-	vkQueueWaitIdle(graphics_queue);
+	buffer_allocation = allocator.allocate_for_buffer(buffer, properties);
 
-	vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
+	vkBindBufferMemory(device, buffer, buffer_allocation.memory, buffer_allocation.offset);
 }
 
 void Renderer::copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size)
 {
-	/* TODO: You may wish to create a separate command pool for these kinds of short-lived buffers,
-	because the implementation may be able to apply memory allocation optimizations.
-	You should use the VK_COMMAND_POOL_CREATE_TRANSIENT_BIT flag during command pool generation in that case.*/
-
-	VkCommandBuffer command_buffer = begin_single_time_commands();
+	VkCommandBuffer command_buffer = upload_context.get_transfer_command_buffer();
 
 	VkBufferCopy copy_region{};
 	copy_region.srcOffset = 0;
@@ -1197,13 +1433,13 @@ void Renderer::copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSiz
 	copy_region.size = size;
 	vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1, &copy_region);
 
-	end_single_time_commands(command_buffer);
+	upload_context.transfer_buffer_ownership(dst_buffer);
 }
 
 // https://vulkan-tutorial.com/Texture_mapping/Images#page_Copying-buffer-to-image
 void Renderer::copy_buffer_to_image(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
 {
-	VkCommandBuffer command_buffer = begin_single_time_commands();
+	VkCommandBuffer command_buffer = upload_context.get_transfer_command_buffer();
 
 	VkBufferImageCopy region{};
 	region.bufferOffset = 0;
@@ -1229,12 +1465,15 @@ void Renderer::copy_buffer_to_image(VkBuffer buffer, VkImage image, uint32_t wid
 		&region
 	);
 
-	end_single_time_commands(command_buffer);
+	upload_context.transfer_image_ownership(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
 }
 
 void Renderer::transition_image_layout(VkImage image, VkFormat format, VkImageLayout old_layout, VkImageLayout new_layout, uint32_t mip_levels)
 {
-	VkCommandBuffer command_buffer = begin_single_time_commands();
+	// Preparing an image for a copy happens on the transfer queue next to the copy itself, everything else on the graphics queue
+	VkCommandBuffer command_buffer = new_layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+		? upload_context.get_transfer_command_buffer()
+		: upload_context.get_graphics_command_buffer();
 
 	VkImageMemoryBarrier barrier{};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1290,8 +1529,6 @@ void Renderer::transition_image_layout(VkImage image, VkFormat format, VkImageLa
 	}
 
 	vkCmdPipelineBarrier(command_buffer, source_stage, destination_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-	end_single_time_commands(command_buffer);
 }
 
 VkFormat Renderer::find_depth_format()
@@ -1322,54 +1559,274 @@ VkFormat Renderer::find_supported_format(const std::vector<VkFormat>& candidates
 	throw std::runtime_error("Failed to find supported format.");
 }
 
-uint32_t Renderer::find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties)
-{
-	VkPhysicalDeviceMemoryProperties mem_properties;
-	vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_properties);
-
-	VkPhysicalDeviceProperties props;
-	vkGetPhysicalDeviceProperties(physical_device, &props);
-
-	for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++)
-	{
-		if (type_filter & (1 << i) && (mem_properties.memoryTypes[i].propertyFlags & properties) == properties)
-			return i;
-	}
-
-	throw std::runtime_error("Failed to find sustainable memory type.");
-}
-
 // https://vulkan-tutorial.com/en/Drawing_a_triangle/Drawing/Command_buffers#page_Command-buffer-allocation
 void Renderer::create_command_buffers()
 {
-	command_buffers.resize(swap_chain_framebuffers.size());
+	TRACE_SCOPE("Renderer::create_command_buffers");
+
+	// A command buffer can't be recorded again while the GPU may still execute it. With one per frame in flight
+	// and framebuffer, the one picked in draw_frame was last submitted by this frame, whose fence was already waited on.
+	std::vector<VkCommandBuffer> command_buffers(swap_chain_framebuffers.size());
 
 	VkCommandBufferAllocateInfo alloc_info{};
 	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	alloc_info.commandPool = command_pool;
 	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	alloc_info.commandBufferCount = (uint32_t)command_buffers.size();
+	alloc_info.commandBufferCount = static_cast<uint32_t>(command_buffers.size());
+
+	for (FrameContext& frame : frames)
+	{
+		if (vkAllocateCommandBuffers(device, &alloc_info, command_buffers.data()) != VK_SUCCESS)
+			throw std::runtime_error("Failed to allocate command buffers.");
 
-	if (vkAllocateCommandBuffers(device, &alloc_info, command_buffers.data()) != VK_SUCCESS)
-		throw std::runtime_error("Failed to allocate command buffers.");
+		frame.command_buffers.assign(command_buffers.size(), FrameCommandBuffer{});
+
+		for (size_t i = 0; i < command_buffers.size(); i++)
+			frame.command_buffers[i].command_buffer = command_buffers[i];
+	}
 }
 
-// TODO: Abstract this?
-void Renderer::record_command_buffer(int image_index)
+void Renderer::create_worker_command_pools()
 {
-	VkCommandBufferBeginInfo begin_info{};
-	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	begin_info.flags = 0;
-	begin_info.pInheritanceInfo = nullptr;
+	// The main thread records the primary command buffers, so it's left out of the worker count
+	uint32_t hardware_threads = std::thread::hardware_concurrency();
+	thread_pool.init(hardware_threads > 1 ? hardware_threads - 1 : 1);
 
-	if (vkBeginCommandBuffer(command_buffers[image_index], &begin_info) != VK_SUCCESS)
-		throw std::runtime_error("Failed to begin recording command buffer.");
+	QueueFamilyIndices queue_family_indices;
+	find_queue_indices(physical_device, queue_family_indices);
 
-	begin_render_pass(image_index);
-}
+	VkCommandPoolCreateInfo pool_info{};
+	pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_info.queueFamilyIndex = queue_family_indices.graphics_family;
+	// The whole pool is reset every frame instead of the separate command buffers
+	pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	for (FrameContext& frame : frames)
+	{
+		frame.worker_command_pools.resize(thread_pool.get_thread_count());
+
+		for (WorkerCommandPool& worker_command_pool : frame.worker_command_pools)
+		{
+			if (vkCreateCommandPool(device, &pool_info, nullptr, &worker_command_pool.command_pool) != VK_SUCCESS)
+				throw std::runtime_error("Failed to create worker command pool.");
+		}
+	}
+}
+
+void Renderer::set_scene_grid_size(uint32_t grid_size)
+{
+	if (grid_size == 0)
+		throw std::runtime_error("Scene grid size has to be at least 1.");
+
+	scene_grid_size = grid_size;
+}
+
+void Renderer::set_mesh_optimization(bool enabled)
+{
+	optimize_meshes = enabled;
+}
+
+void Renderer::set_vertex_format(VertexFormat format)
+{
+	vertex_format = format;
+}
+
+void Renderer::set_texture_memory_budget(VkDeviceSize bytes)
+{
+	texture_memory_budget = bytes;
+}
+
+void Renderer::set_meshlet_culling(bool enabled)
+{
+	meshlet_culling = enabled;
+}
+
+void Renderer::set_lod_error_threshold(float pixels)
+{
+	lod_error_threshold = pixels;
+}
+
+void Renderer::set_synthetic_scene(uint32_t object_count, uint32_t triangle_count, uint32_t texture_count)
+{
+	if (object_count == 0 || texture_count == 0)
+		throw std::runtime_error("A synthetic scene needs at least one object and one texture.");
+
+	if (texture_count > TextureTable::MAX_TEXTURES)
+		throw std::runtime_error("A synthetic scene can have at most " + std::to_string(TextureTable::MAX_TEXTURES) + " textures.");
+
+	synthetic_object_count = object_count;
+	synthetic_triangle_count = triangle_count;
+	synthetic_texture_count = texture_count;
+}
+
+void Renderer::set_fixed_time_step(float seconds)
+{
+	fixed_time_step = seconds;
+}
+
+void Renderer::set_frames_in_flight(uint32_t count)
+{
+	if (count == 0 || count > MAX_FRAMES_IN_FLIGHT)
+		throw std::runtime_error("Frames in flight must be between 1 and " + std::to_string(MAX_FRAMES_IN_FLIGHT) + ".");
+
+	frames_in_flight = count;
+}
+
+void Renderer::set_low_latency(bool enabled)
+{
+	low_latency = enabled;
+	has_previous_frame = false;
+}
+
+bool Renderer::get_gpu_frame_time(double& milliseconds) const
+{
+	const GpuProfiler::Pass_Results& frame_results = gpu_profiler.get_results()[frame_profiler_pass];
+
+	if (frame_results.last_milliseconds < 0.0)
+		return false;
+
+	milliseconds = frame_results.last_milliseconds;
+	return true;
+}
+
+std::string Renderer::get_device_name() const
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+	return properties.deviceName;
+}
+
+void Renderer::set_recording_mode(RecordingMode mode)
+{
+	recording_mode = mode;
+	invalidate_command_buffers();
+}
+
+void Renderer::invalidate_command_buffers()
+{
+	for (FrameContext& frame : frames)
+	{
+		for (FrameCommandBuffer& frame_command_buffer : frame.command_buffers)
+			frame_command_buffer.valid = false;
+	}
+}
+
+void Renderer::record_command_buffer(uint32_t image_index)
+{
+	TRACE_SCOPE("Renderer::record_command_buffer");
+
+	FrameCommandBuffer& frame_command_buffer = frames[current_frame].command_buffers[image_index];
+	VkCommandBuffer command_buffer = frame_command_buffer.command_buffer;
+
+	// The only thing that changes between frames is the uniform offset, and with one ring buffer region
+	// per frame in flight it's the same every time this command buffer is used
+	if (recording_mode == RecordingMode::Cached && frame_command_buffer.valid && frame_command_buffer.uniform_offset == uniform_buffer_offset
+		&& frame_command_buffer.cull_offset == cull_data_offset)
+		return;
+
+	VkCommandBufferBeginInfo begin_info{};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = recording_mode == RecordingMode::Cached ? 0 : VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	begin_info.pInheritanceInfo = nullptr;
+
+	// The pool was created with VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, so this resets the command buffer
+	if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS)
+		throw std::runtime_error("Failed to begin recording command buffer.");
+
+	// The queries of the frame are reset by the command buffer itself, so cached ones keep working
+	gpu_profiler.reset(command_buffer, static_cast<uint32_t>(current_frame));
+	gpu_profiler.begin_pass(command_buffer, static_cast<uint32_t>(current_frame), frame_profiler_pass);
+
+	// Culling can't be done inside a render pass, it has to finish before the draws read the indirect buffer
+	gpu_profiler.begin_pass(command_buffer, static_cast<uint32_t>(current_frame), cull_profiler_pass);
+	record_culling(command_buffer);
+	gpu_profiler.end_pass(command_buffer, static_cast<uint32_t>(current_frame), cull_profiler_pass);
+
+	if (recording_mode == RecordingMode::Parallel)
+	{
+		begin_render_pass(command_buffer, image_index, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		record_secondary_command_buffers(command_buffer, image_index);
+	}
+	else
+	{
+		begin_render_pass(command_buffer, image_index, VK_SUBPASS_CONTENTS_INLINE);
+		record_draws(command_buffer, 0);
+	}
+
+	end_render_pass(command_buffer);
+	gpu_profiler.end_pass(command_buffer, static_cast<uint32_t>(current_frame), frame_profiler_pass);
+
+	if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to record a command buffer.");
+
+	frame_command_buffer.valid = recording_mode == RecordingMode::Cached;
+	frame_command_buffer.uniform_offset = uniform_buffer_offset;
+	frame_command_buffer.cull_offset = cull_data_offset;
+}
+
+void Renderer::record_culling(VkCommandBuffer command_buffer)
+{
+	const FrameContext& frame = frames[current_frame];
+
+	// Every segment counts its visible draws from 0
+	vkCmdFillBuffer(command_buffer, frame.draw_count_buffer, 0, VK_WHOLE_SIZE, 0);
+
+	// And the visible draws take their indices from the beginning of the buffer
+	if (meshlet_culling)
+		vkCmdFillBuffer(command_buffer, frame.culled_index_buffer, 0, sizeof(uint32_t), 0);
+
+	// The draws raise the demand of their texture from 0
+	vkCmdFillBuffer(command_buffer, frame.texture_demand_buffer, 0, VK_WHOLE_SIZE, 0);
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshlet_culling ? meshlet_cull_pipeline : cull_pipeline);
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline_layout, 0, 1, &frame.cull_descriptor_set, 1, &cull_data_offset);
+
+	if (meshlet_culling)
+		vkCmdDispatch(command_buffer, std::min(draw_count, MAX_MESHLET_CULL_GROUPS), 1, 1);
+	else
+		vkCmdDispatch(command_buffer, (draw_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+	// The draws read the indices the meshlet culling wrote
+	if (meshlet_culling)
+	{
+		dst_stage |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+		barrier.dstAccessMask |= VK_ACCESS_INDEX_READ_BIT;
+	}
+
+	// And the CPU reads the texture demand after the fence of the frame
+	dst_stage |= VK_PIPELINE_STAGE_HOST_BIT;
+	barrier.dstAccessMask |= VK_ACCESS_HOST_READ_BIT;
+
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dst_stage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// In parallel mode every thread draws one segment of the draws. The culling pass compacts the visible draws
+// to the beginning of their segment, so a segment can be drawn without knowing how many are visible in the others.
+uint32_t Renderer::get_draw_segment_count() const
+{
+	return recording_mode == RecordingMode::Parallel ? thread_pool.get_thread_count() : 1;
+}
+
+uint32_t Renderer::get_draw_segment_size() const
+{
+	uint32_t segment_count = get_draw_segment_count();
+	return (draw_count + segment_count - 1) / segment_count;
+}
 
 // https://vulkan-tutorial.com/Drawing_a_triangle/Drawing/Command_buffers#page_Starting-a-render-pass
-void Renderer::begin_render_pass(int framebuffer_index)
+void Renderer::begin_render_pass(VkCommandBuffer command_buffer, uint32_t framebuffer_index, VkSubpassContents contents)
 {
 	VkRenderPassBeginInfo render_pass_begin_info{};
 	render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -1385,8 +1842,24 @@ void Renderer::begin_render_pass(int framebuffer_index)
 	render_pass_begin_info.clearValueCount = static_cast<uint32_t>(clear_values.size());
 	render_pass_begin_info.pClearValues = clear_values.data();
 
-	vkCmdBeginRenderPass(command_buffers[framebuffer_index], &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+	// The statistics query has to be active around the whole render pass. Secondary command buffers can only run inside
+	// it when they inherit it, see record_secondary_command_buffers.
+	bool statistics = contents == VK_SUBPASS_CONTENTS_INLINE || supports_inherited_queries;
+	gpu_profiler.begin_pass(command_buffer, static_cast<uint32_t>(current_frame), main_profiler_pass, statistics);
+
+	vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, contents);
+}
+
+void Renderer::end_render_pass(VkCommandBuffer command_buffer)
+{
+	vkCmdEndRenderPass(command_buffer);
+
+	gpu_profiler.end_pass(command_buffer, static_cast<uint32_t>(current_frame), main_profiler_pass);
+}
 
+// Secondary command buffers don't inherit any state, so everything is bound again for every command buffer
+void Renderer::record_draws(VkCommandBuffer command_buffer, uint32_t segment)
+{
 	VkViewport viewport{};
 	viewport.x = 0.0f;
 	viewport.y = 0.0f;
@@ -1399,33 +1872,127 @@ void Renderer::begin_render_pass(int framebuffer_index)
 	scissor.offset = { 0, 0 };
 	scissor.extent = swap_chain_extent;
 
-	vkCmdSetViewport(command_buffers[framebuffer_index], 0, 1, &viewport);
-	vkCmdSetScissor(command_buffers[framebuffer_index], 0, 1, &scissor);
+	vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+	vkCmdSetScissor(command_buffer, 0, 1, &scissor);
 
-	vkCmdBindPipeline(command_buffers[framebuffer_index], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline);
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline);
 
 	VkBuffer vertex_buffers[] = { vertex_buffer };
 	VkDeviceSize offsets[] = { 0 };
-	vkCmdBindVertexBuffers(command_buffers[framebuffer_index], 0, 1, vertex_buffers, offsets);
+	vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
+
+	const FrameContext& frame = frames[current_frame];
 
-	vkCmdBindIndexBuffer(command_buffers[framebuffer_index], index_buffer, 0, VK_INDEX_TYPE_UINT32);
+	// The culled indices start after the count at the beginning of the buffer
+	if (meshlet_culling)
+		vkCmdBindIndexBuffer(command_buffer, frame.culled_index_buffer, sizeof(uint32_t), VK_INDEX_TYPE_UINT32);
+	else
+		vkCmdBindIndexBuffer(command_buffer, index_buffer, 0, index_type);
 
-	vkCmdBindDescriptorSets(command_buffers[framebuffer_index], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &descriptor_sets[framebuffer_index], 0, nullptr);
+	std::array<VkDescriptorSet, 2> sets = { frame.descriptor_set, texture_table.get_descriptor_set(static_cast<uint32_t>(current_frame)) };
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, static_cast<uint32_t>(sets.size()), sets.data(), 1, &uniform_buffer_offset);
 
-	vkCmdDrawIndexed(command_buffers[framebuffer_index], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+	uint32_t first_draw = segment * get_draw_segment_size();
 
-	vkCmdEndRenderPass(command_buffers[framebuffer_index]);
+	if (first_draw >= draw_count)
+		return;
 
-	if (vkEndCommandBuffer(command_buffers[framebuffer_index]) != VK_SUCCESS)
-		throw std::runtime_error("Failed to record a command buffer.");
+	uint32_t draws = std::min(get_draw_segment_size(), draw_count - first_draw);
+
+	// The draws are read by the GPU from the indirect buffer, so the CPU cost is the same for 1 and 100k objects
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize offset = static_cast<VkDeviceSize>(first_draw) * stride;
+	VkBuffer culled_indirect_buffer = frame.culled_indirect_buffer;
+
+	if (supports_draw_indirect_count)
+	{
+		vkCmdDrawIndexedIndirectCount(command_buffer, culled_indirect_buffer, offset, frame.draw_count_buffer, segment * sizeof(uint32_t), draws, stride);
+	}
+	else if (supports_multi_draw_indirect)
+	{
+		// Without the count the culled draws stay in place with instanceCount set to 0
+		vkCmdDrawIndexedIndirect(command_buffer, culled_indirect_buffer, offset, draws, stride);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < draws; i++)
+			vkCmdDrawIndexedIndirect(command_buffer, culled_indirect_buffer, offset + static_cast<VkDeviceSize>(i) * stride, 1, stride);
+	}
+}
+
+void Renderer::record_secondary_command_buffers(VkCommandBuffer command_buffer, uint32_t framebuffer_index)
+{
+	TRACE_SCOPE("Renderer::record_secondary_command_buffers");
+
+	// The fence of this frame was waited on, so none of the command buffers from its pools are executing anymore
+	for (WorkerCommandPool& worker_command_pool : frames[current_frame].worker_command_pools)
+	{
+		vkResetCommandPool(device, worker_command_pool.command_pool, 0);
+		worker_command_pool.used_command_buffers = 0;
+	}
+
+	// Every thread draws one segment
+	uint32_t task_count = get_draw_segment_count();
+	std::vector<VkCommandBuffer> secondary_command_buffers(task_count);
+
+	thread_pool.run(task_count, [&](uint32_t task_index, uint32_t thread_index)
+	{
+		WorkerCommandPool& worker_command_pool = frames[current_frame].worker_command_pools[thread_index];
+		VkCommandBuffer secondary_command_buffer = get_worker_command_buffer(worker_command_pool);
+
+		VkCommandBufferInheritanceInfo inheritance_info{};
+		inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritance_info.renderPass = render_pass;
+		inheritance_info.subpass = 0;
+		inheritance_info.framebuffer = swap_chain_framebuffers[framebuffer_index];
+
+		// The main pass counts its shader invocations when the device can pass the query on to secondary command buffers
+		if (supports_inherited_queries)
+			inheritance_info.pipelineStatistics = gpu_profiler.get_statistic_flags();
+
+		VkCommandBufferBeginInfo begin_info{};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		begin_info.pInheritanceInfo = &inheritance_info;
+
+		if (vkBeginCommandBuffer(secondary_command_buffer, &begin_info) != VK_SUCCESS)
+			throw std::runtime_error("Failed to begin recording secondary command buffer.");
+
+		record_draws(secondary_command_buffer, task_index);
+
+		if (vkEndCommandBuffer(secondary_command_buffer) != VK_SUCCESS)
+			throw std::runtime_error("Failed to record a secondary command buffer.");
+
+		secondary_command_buffers[task_index] = secondary_command_buffer;
+	});
+
+	vkCmdExecuteCommands(command_buffer, task_count, secondary_command_buffers.data());
+}
+
+VkCommandBuffer Renderer::get_worker_command_buffer(WorkerCommandPool& worker_command_pool)
+{
+	if (worker_command_pool.used_command_buffers == worker_command_pool.command_buffers.size())
+	{
+		VkCommandBufferAllocateInfo alloc_info{};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.commandPool = worker_command_pool.command_pool;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		alloc_info.commandBufferCount = 1;
+
+		VkCommandBuffer command_buffer;
+
+		if (vkAllocateCommandBuffers(device, &alloc_info, &command_buffer) != VK_SUCCESS)
+			throw std::runtime_error("Failed to allocate secondary command buffer.");
+
+		worker_command_pool.command_buffers.push_back(command_buffer);
+	}
+
+	return worker_command_pool.command_buffers[worker_command_pool.used_command_buffers++];
 }
 
 void Renderer::create_sync_objects()
 {
-	image_available_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	render_finished_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	in_flight_fences.resize(MAX_FRAMES_IN_FLIGHT);
-	images_in_flight.resize(swap_chain_images.size(), VK_NULL_HANDLE);
+	images_in_flight.assign(swap_chain_images.size(), VK_NULL_HANDLE);
 
 	// https://vulkan-tutorial.com/en/Drawing_a_triangle/Drawing/Rendering_and_presentation#page_Semaphores
 	VkSemaphoreCreateInfo semaphore_info{};
@@ -1436,33 +2003,46 @@ void Renderer::create_sync_objects()
 	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	for (FrameContext& frame : frames)
 	{
-		if (vkCreateSemaphore(device, &semaphore_info, nullptr, &image_available_semaphores[i]) != VK_SUCCESS
-			|| vkCreateSemaphore(device, &semaphore_info, nullptr, &render_finished_semaphores[i]) != VK_SUCCESS
-			|| vkCreateFence(device, &fence_info, nullptr, &in_flight_fences[i]) != VK_SUCCESS)
+		if (vkCreateSemaphore(device, &semaphore_info, nullptr, &frame.image_available_semaphore) != VK_SUCCESS
+			|| vkCreateSemaphore(device, &semaphore_info, nullptr, &frame.render_finished_semaphore) != VK_SUCCESS
+			|| vkCreateFence(device, &fence_info, nullptr, &frame.in_flight_fence) != VK_SUCCESS)
 			throw std::runtime_error("Failed to create sync objects for a frame.");
 	}
 }
 
+void Renderer::create_gpu_profiler()
+{
+	frame_profiler_pass = gpu_profiler.add_pass("Frame");
+	cull_profiler_pass = gpu_profiler.add_pass("Culling");
+	main_profiler_pass = gpu_profiler.add_pass("Main pass");
+
+	QueueFamilyIndices indices;
+	find_queue_indices(physical_device, indices);
+
+	gpu_profiler.init(physical_device, device, indices.graphics_family, frames_in_flight, supports_pipeline_statistics);
+}
+
 // https://vulkan-tutorial.com/Uniform_buffers/Descriptor_layout_and_buffer#page_Descriptor-set-layout
 void Renderer::create_descriptor_set_layout()
 {
 	VkDescriptorSetLayoutBinding ubo_layout_binding{};
 	ubo_layout_binding.binding = 0;
-	ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	ubo_layout_binding.descriptorCount = 1;
 	ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 	ubo_layout_binding.pImmutableSamplers = nullptr;
 
-	VkDescriptorSetLayoutBinding sampler_layout_binding{};
-	sampler_layout_binding.binding = 1;
-	sampler_layout_binding.descriptorCount = 1;
-	sampler_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	sampler_layout_binding.pImmutableSamplers = nullptr;
-	sampler_layout_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	// The textures are in set 1, see TextureTable
+	VkDescriptorSetLayoutBinding draw_data_layout_binding{};
+	draw_data_layout_binding.binding = 1;
+	draw_data_layout_binding.descriptorCount = 1;
+	draw_data_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	draw_data_layout_binding.pImmutableSamplers = nullptr;
+	draw_data_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-	std::array<VkDescriptorSetLayoutBinding, 2> bindings = { ubo_layout_binding, sampler_layout_binding };
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = { ubo_layout_binding, draw_data_layout_binding };
 
 	VkDescriptorSetLayoutCreateInfo layout_info{};
 	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -1473,8 +2053,40 @@ void Renderer::create_descriptor_set_layout()
 		throw std::runtime_error("Failed to create descriptor set layout.");
 }
 
-void Renderer::update_uniform_buffer(uint32_t current_image)
+void Renderer::create_cull_descriptor_set_layout()
+{
+	std::array<VkDescriptorSetLayoutBinding, 10> bindings{};
+
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorCount = 1;
+		// Cull_Data, then draw data, input commands, culled commands, draw counts, levels of detail,
+		// for the meshlet culling the meshlets, the index buffer and the culled indices, and the texture demand
+		bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[i].pImmutableSamplers = nullptr;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layout_info{};
+	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+	layout_info.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &cull_descriptor_set_layout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create cull descriptor set layout.");
+}
+
+void Renderer::create_texture_table()
 {
+	// Textures are added to the table as they are created, its layout is needed by the graphics pipeline right away
+	texture_table.init(device, frames_in_flight);
+}
+
+void Renderer::update_uniform_buffer()
+{
+	TRACE_SCOPE("Renderer::update_uniform_buffer");
+
 	// TODO: v
 	// Using a UBO this way is not the most efficient way to pass frequently changing values to the shader.
 	// A more efficient way to pass a small buffer of data to shaders are push constants.
@@ -1483,31 +2095,93 @@ void Renderer::update_uniform_buffer(uint32_t current_image)
 	auto current_time = std::chrono::high_resolution_clock::now();
 	float time = std::chrono::duration<float, std::chrono::seconds::period>(current_time - start_time).count();
 
+	if (fixed_time_step > 0.0f)
+		time = frame_number * fixed_time_step;
+
+	frame_number++;
+
 	Uniform_Buffer_Object ubo{};
 	ubo.model = glm::rotate(glm::mat4(1.0), time * glm::radians(45.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 	ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 	ubo.proj = glm::perspective(glm::radians(45.0f), swap_chain_extent.width / (float)swap_chain_extent.height, 0.1f, 10.0f);
 	ubo.proj[1][1] *= -1; // GLM was originally designed for OpenGL, where the Y coordinate of the clip coordinates is inverted.
 
-	void* data;
-	vkMapMemory(device, uniform_buffers_memory[current_image], 0, sizeof(ubo), 0, &data);
-	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(device, uniform_buffers_memory[current_image]);
+	// The fence of this frame was already waited on, so nothing on the GPU reads its region anymore
+	uniform_ring_buffer.begin_frame(static_cast<uint32_t>(current_frame));
+	uniform_buffer_offset = uniform_ring_buffer.push(ubo);
+
+	// Frustum planes taken from the rows of the matrix (Gribb & Hartmann), with the Vulkan depth range of 0 to 1 for the near plane.
+	// They end up in the space before the per-draw model matrices, which is where the culling shader moves the bounding spheres.
+	glm::mat4 rows = glm::transpose(ubo.proj * ubo.view * ubo.model);
+
+	Cull_Data cull_data{};
+	cull_data.frustum_planes[0] = rows[3] + rows[0];
+	cull_data.frustum_planes[1] = rows[3] - rows[0];
+	cull_data.frustum_planes[2] = rows[3] + rows[1];
+	cull_data.frustum_planes[3] = rows[3] - rows[1];
+	cull_data.frustum_planes[4] = rows[2];
+	cull_data.frustum_planes[5] = rows[3] - rows[2];
+
+	for (glm::vec4& plane : cull_data.frustum_planes)
+		plane /= glm::length(glm::vec3(plane));
+
+	cull_data.draw_count = draw_count;
+	cull_data.segment_size = get_draw_segment_size();
+	cull_data.compact = supports_draw_indirect_count ? 1 : 0;
+
+	// The camera is at the origin of view space
+	cull_data.camera_position = glm::inverse(ubo.view * ubo.model) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	// An error of e world units at distance d covers e / d * proj[1][1] * height / 2 pixels
+	float pixels_per_unit = std::abs(ubo.proj[1][1]) * swap_chain_extent.height * 0.5f;
+	cull_data.lod_scale = lod_error_threshold > 0.0f ? pixels_per_unit / lod_error_threshold : FLT_MAX;
+	cull_data.index_capacity = culled_index_capacity;
+	cull_data.pixels_per_unit = pixels_per_unit;
+
+	cull_data_offset = uniform_ring_buffer.push(cull_data);
+}
+
+// The culling pass measures the demand on the GPU, see TextureDemandBuffer in cull.comp. This frame context was last
+// drawn frames_in_flight frames ago and its fence was waited on, so the demand lags the camera by that many frames.
+void Renderer::request_texture_detail()
+{
+	const uint32_t* screen_sizes = static_cast<const uint32_t*>(frames[current_frame].texture_demand_buffer_allocation.mapped_data);
+
+	for (uint32_t i = 0; i < texture_table_indices.size(); i++)
+		texture_streamer.request_detail(i, static_cast<float>(screen_sizes[texture_table_indices[i]]));
+}
+
+void Renderer::update_texture_streaming()
+{
+	TRACE_SCOPE("Renderer::update_texture_streaming");
+
+	request_texture_detail();
+
+	for (uint32_t changed_texture : texture_streamer.update())
+		texture_table.set_texture(texture_table_indices[changed_texture], texture_streamer.get_image_view(changed_texture), texture_sampler);
+
+	// The streamed levels go to the GPU ahead of the draws of this frame
+	upload_context.submit();
+
+	// The fence of this frame was waited on, so nothing uses its table set. The sets of the other frames in flight are
+	// written when their turn comes. The table is update-after-bind, the recorded command buffers stay valid.
+	texture_table.update(current_frame);
 }
 
 void Renderer::create_descriptor_pool()
 {
+	// A graphics and a cull descriptor set for every frame in flight, the textures have their own pool
 	std::array<VkDescriptorPoolSize, 2> pool_sizes{};
-	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	pool_sizes[0].descriptorCount = static_cast<uint32_t>(swap_chain_images.size());
-	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	pool_sizes[1].descriptorCount = static_cast<uint32_t>(swap_chain_images.size());
+	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	pool_sizes[0].descriptorCount = 2 * frames_in_flight;
+	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	pool_sizes[1].descriptorCount = 10 * frames_in_flight;
 
 	VkDescriptorPoolCreateInfo pool_info{};
 	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	pool_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
 	pool_info.pPoolSizes = pool_sizes.data();
-	pool_info.maxSets = static_cast<uint32_t>(swap_chain_images.size());
+	pool_info.maxSets = 2 * frames_in_flight;
 
 	if (vkCreateDescriptorPool(device, &pool_info, nullptr, &descriptor_pool) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create descriptor pool.");
@@ -1515,37 +2189,42 @@ void Renderer::create_descriptor_pool()
 
 void Renderer::create_descriptor_sets()
 {
-	std::vector<VkDescriptorSetLayout> layouts(swap_chain_images.size(), descriptor_set_layout);
+	TRACE_SCOPE("Renderer::create_descriptor_sets");
+
+	std::vector<VkDescriptorSetLayout> layouts(frames_in_flight, descriptor_set_layout);
 
 	VkDescriptorSetAllocateInfo alloc_info{};
 	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	alloc_info.descriptorPool = descriptor_pool;
-	alloc_info.descriptorSetCount = static_cast<uint32_t>(swap_chain_images.size());
+	alloc_info.descriptorSetCount = frames_in_flight;
 	alloc_info.pSetLayouts = layouts.data();
 
-	descriptor_sets.resize(swap_chain_images.size());
+	std::vector<VkDescriptorSet> descriptor_sets(frames_in_flight);
 
 	if (vkAllocateDescriptorSets(device, &alloc_info, descriptor_sets.data()) != VK_SUCCESS)
 		throw std::runtime_error("Failed to allocate descriptor sets.");
 
-	for (size_t i = 0; i < swap_chain_images.size(); i++)
+	for (size_t i = 0; i < frames.size(); i++)
 	{
+		frames[i].descriptor_set = descriptor_sets[i];
+
+		// The offset into the ring buffer is given when binding the set
 		VkDescriptorBufferInfo buffer_info{};
-		buffer_info.buffer = uniform_buffers[i];
+		buffer_info.buffer = uniform_ring_buffer.get_buffer();
 		buffer_info.offset = 0;
 		buffer_info.range = sizeof(Uniform_Buffer_Object);
 
-		VkDescriptorImageInfo image_info{};
-		image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		image_info.imageView = texture_image_view;
-		image_info.sampler = texture_sampler;
+		VkDescriptorBufferInfo draw_data_info{};
+		draw_data_info.buffer = draw_data_buffer;
+		draw_data_info.offset = 0;
+		draw_data_info.range = VK_WHOLE_SIZE;
 
 		std::array<VkWriteDescriptorSet, 2> descriptor_writes{};
 		descriptor_writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 		descriptor_writes[0].dstSet = descriptor_sets[i];
 		descriptor_writes[0].dstBinding = 0;
 		descriptor_writes[0].dstArrayElement = 0;
-		descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 		descriptor_writes[0].descriptorCount = 1;
 		descriptor_writes[0].pBufferInfo = &buffer_info;
 
@@ -1553,58 +2232,155 @@ void Renderer::create_descriptor_sets()
 		descriptor_writes[1].dstSet = descriptor_sets[i];
 		descriptor_writes[1].dstBinding = 1;
 		descriptor_writes[1].dstArrayElement = 0;
-		descriptor_writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptor_writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 		descriptor_writes[1].descriptorCount = 1;
-		descriptor_writes[1].pImageInfo = &image_info;
+		descriptor_writes[1].pBufferInfo = &draw_data_info;
 
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptor_writes.size()), descriptor_writes.data(), 0, nullptr);
 	}
+
+	std::vector<VkDescriptorSetLayout> cull_layouts(frames_in_flight, cull_descriptor_set_layout);
+	alloc_info.pSetLayouts = cull_layouts.data();
+
+	if (vkAllocateDescriptorSets(device, &alloc_info, descriptor_sets.data()) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate cull descriptor sets.");
+
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		FrameContext& frame = frames[i];
+		frame.cull_descriptor_set = descriptor_sets[i];
+
+		std::array<VkDescriptorBufferInfo, 10> buffer_infos{};
+		buffer_infos[0] = { uniform_ring_buffer.get_buffer(), 0, sizeof(Cull_Data) };
+		buffer_infos[1] = { draw_data_buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[2] = { indirect_buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[3] = { frame.culled_indirect_buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[4] = { frame.draw_count_buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[5] = { lod_buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[6] = { meshlet_buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[7] = { index_buffer, 0, VK_WHOLE_SIZE };
+
+		buffer_infos[8] = { frame.culled_index_buffer, 0, VK_WHOLE_SIZE };
+		buffer_infos[9] = { frame.texture_demand_buffer, 0, VK_WHOLE_SIZE };
+
+		std::array<VkWriteDescriptorSet, 10> descriptor_writes{};
+		uint32_t descriptor_write_count = 0;
+
+		for (uint32_t j = 0; j < buffer_infos.size(); j++)
+		{
+			// cull.comp doesn't use the culled indices, without meshlet culling there is no buffer to write
+			if (j == 8 && !meshlet_culling)
+				continue;
+
+			VkWriteDescriptorSet& descriptor_write = descriptor_writes[descriptor_write_count++];
+			descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptor_write.dstSet = frame.cull_descriptor_set;
+			descriptor_write.dstBinding = j;
+			descriptor_write.dstArrayElement = 0;
+			descriptor_write.descriptorType = j == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptor_write.descriptorCount = 1;
+			descriptor_write.pBufferInfo = &buffer_infos[j];
+		}
+
+		vkUpdateDescriptorSets(device, descriptor_write_count, descriptor_writes.data(), 0, nullptr);
+	}
 }
 
 void Renderer::draw_frame()
 {
-	vkWaitForFences(device, 1, &in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
+	TRACE_SCOPE("Renderer::draw_frame");
+
+	auto frame_start = std::chrono::steady_clock::now();
+
+	pace_frame();
+
+	upload_context.release_completed();
+
+	FrameContext& frame = frames[current_frame];
+
+	{
+		TRACE_SCOPE("Wait for frame fence");
+		vkWaitForFences(device, 1, &frame.in_flight_fence, VK_TRUE, UINT64_MAX);
+	}
+
+	gpu_profiler.read_results(static_cast<uint32_t>(current_frame));
 
 	// https://vulkan-tutorial.com/en/Drawing_a_triangle/Drawing/Rendering_and_presentation#page_Synchronization
 	uint32_t image_index;
-	VkResult result = vkAcquireNextImageKHR(device, swap_chain, UINT64_MAX, image_available_semaphores[current_frame], VK_NULL_HANDLE, &image_index);
+	VkResult result = VK_SUCCESS;
 
-	if (result == VK_ERROR_OUT_OF_DATE_KHR)
-		recreate_swap_chain();
-	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
-		throw std::runtime_error("Failed to acquire swap chain image.");
+	if (headless)
+	{
+		// The offscreen image of the frame, its fence was just waited on
+		image_index = static_cast<uint32_t>(current_frame);
+	}
+	else
+	{
+		TRACE_SCOPE("Acquire image");
+		result = vkAcquireNextImageKHR(device, swap_chain, UINT64_MAX, frame.image_available_semaphore, VK_NULL_HANDLE, &image_index);
 
-	record_command_buffer(image_index);
+		if (result == VK_ERROR_OUT_OF_DATE_KHR)
+			recreate_swap_chain();
+		else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+			throw std::runtime_error("Failed to acquire swap chain image.");
+	}
 
 	// Check if the previous frame is using the image (i.e. there is its fence to wait on)
 	if (images_in_flight[image_index] != VK_NULL_HANDLE)
+	{
+		TRACE_SCOPE("Wait for image fence");
 		vkWaitForFences(device, 1, &images_in_flight[image_index], VK_TRUE, UINT64_MAX);
+	}
 
 	// Mark the image as now being in use by this frame
-	images_in_flight[image_index] = in_flight_fences[current_frame];
+	images_in_flight[image_index] = frame.in_flight_fence;
 
-	update_uniform_buffer(image_index);
+	// The command buffer binds the uniforms with the offset they got in the ring buffer, so they go first
+	update_uniform_buffer();
+	update_texture_streaming();
+	record_command_buffer(image_index);
 
 	// https://vulkan-tutorial.com/en/Drawing_a_triangle/Drawing/Rendering_and_presentation#page_Submitting-the-command-buffer
 	VkSubmitInfo submit_info{};
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-	VkSemaphore wait_semaphores[] = { image_available_semaphores[current_frame] };
+	VkSemaphore wait_semaphores[] = { frame.image_available_semaphore };
 	VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submit_info.waitSemaphoreCount = 1;
+	// Headless frames have no image to wait for and nothing to present
+	submit_info.waitSemaphoreCount = headless ? 0 : 1;
 	submit_info.pWaitSemaphores = wait_semaphores;
 	submit_info.pWaitDstStageMask = wait_stages;
 	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &command_buffers[image_index];
+	submit_info.pCommandBuffers = &frame.command_buffers[image_index].command_buffer;
 
-	VkSemaphore signal_semaphores[] = { render_finished_semaphores[current_frame] };
-	submit_info.signalSemaphoreCount = 1;
+	VkSemaphore signal_semaphores[] = { frame.render_finished_semaphore };
+	submit_info.signalSemaphoreCount = headless ? 0 : 1;
 	submit_info.pSignalSemaphores = signal_semaphores;
 
-	vkResetFences(device, 1, &in_flight_fences[current_frame]);
+	{
+		TRACE_SCOPE("Submit");
+		vkResetFences(device, 1, &frame.in_flight_fence);
+
+		if (vkQueueSubmit(graphics_queue, 1, &submit_info, frame.in_flight_fence) != VK_SUCCESS)
+			throw std::runtime_error("Failed to submit a draw command buffer.");
+	}
+
+	last_image_index = image_index;
+	gpu_profiler.frame_submitted(static_cast<uint32_t>(current_frame));
+
+	// What pace_frame of the next frame goes by
+	previous_frame = current_frame;
+	previous_submit_time = std::chrono::steady_clock::now();
+	has_previous_frame = true;
+
+	double cpu_milliseconds = std::chrono::duration<double, std::milli>(previous_submit_time - frame_start).count();
+	cpu_frame_milliseconds = cpu_frame_milliseconds > 0.0 ? 0.9 * cpu_frame_milliseconds + 0.1 * cpu_milliseconds : cpu_milliseconds;
 
-	if (vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_fences[current_frame]) != VK_SUCCESS)
-		throw std::runtime_error("Failed to submit a draw command buffer.");
+	if (headless)
+	{
+		current_frame = (current_frame + 1) % frames_in_flight;
+		return;
+	}
 
 	VkPresentInfoKHR present_info{};
 	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1618,7 +2394,10 @@ void Renderer::draw_frame()
 	present_info.pImageIndices = &image_index;
 	present_info.pResults = nullptr;
 
-	result = vkQueuePresentKHR(present_queue, &present_info);
+	{
+		TRACE_SCOPE("Present");
+		result = vkQueuePresentKHR(present_queue, &present_info);
+	}
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebuffer_resized)
 	{
@@ -1628,18 +2407,46 @@ void Renderer::draw_frame()
 	else if (result != VK_SUCCESS)
 		throw std::runtime_error("Failed to acquire swap chain image.");
 
-	current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+	current_frame = (current_frame + 1) % frames_in_flight;
+}
+
+// Every queued frame adds a frame of latency between the input read in update_uniform_buffer and the photons. Instead
+// of running up to frames_in_flight frames ahead, the CPU starts the next frame so its submit lands just as the GPU
+// finishes the previous one: the GPU still never idles, but only one frame is queued.
+void Renderer::pace_frame()
+{
+	if (!low_latency || !has_previous_frame)
+		return;
+
+	TRACE_SCOPE("Renderer::pace_frame");
+
+	const GpuProfiler::Pass_Results& frame_pass = gpu_profiler.get_results()[frame_profiler_pass];
+
+	if (frame_pass.has_timings)
+	{
+		// The previous frame can't start on the GPU before its submit, so this is the earliest it can finish
+		double lead_milliseconds = frame_pass.milliseconds - cpu_frame_milliseconds - LOW_LATENCY_SLACK_MILLISECONDS;
+
+		if (lead_milliseconds > 0.0)
+			std::this_thread::sleep_until(previous_submit_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double, std::milli>(lead_milliseconds)));
+	}
+	else
+	{
+		// Without timestamps, wait until the previous frame is done
+		vkWaitForFences(device, 1, &frames[previous_frame].in_flight_fence, VK_TRUE, UINT64_MAX);
+	}
 }
 
 void Renderer::cleanup_swap_chain()
 {
 	vkDestroyImageView(device, color_image_view, nullptr);
 	vkDestroyImage(device, color_image, nullptr);
-	vkFreeMemory(device, color_image_memory, nullptr);
+	allocator.free(color_image_allocation);
 
 	vkDestroyImageView(device, depth_image_view, nullptr);
 	vkDestroyImage(device, depth_image, nullptr);
-	vkFreeMemory(device, depth_image_memory, nullptr);
+	allocator.free(depth_image_allocation);
 
 	for (size_t i = 0; i < swap_chain_framebuffers.size(); i++)
 		vkDestroyFramebuffer(device, swap_chain_framebuffers[i], nullptr);
@@ -1654,25 +2461,17 @@ void Renderer::cleanup_swap_chain()
 		vkDestroyImageView(device, swap_chain_image_views[i], nullptr);
 
 	vkDestroySwapchainKHR(device, swap_chain, nullptr);
-
-	for (size_t i = 0; i < swap_chain_images.size(); i++)
-	{
-		vkDestroyBuffer(device, uniform_buffers[i], nullptr);
-		vkFreeMemory(device, uniform_buffers_memory[i], nullptr);
-	}
-
-	vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
 }
 
 void Renderer::cleanup()
 {
 	vkDestroyImageView(device, color_image_view, nullptr);
 	vkDestroyImage(device, color_image, nullptr);
-	vkFreeMemory(device, color_image_memory, nullptr);
+	allocator.free(color_image_allocation);
 
 	vkDestroyImageView(device, depth_image_view, nullptr);
 	vkDestroyImage(device, depth_image, nullptr);
-	vkFreeMemory(device, depth_image_memory, nullptr);
+	allocator.free(depth_image_allocation);
 
 	for (size_t i = 0; i < swap_chain_framebuffers.size(); i++)
 		vkDestroyFramebuffer(device, swap_chain_framebuffers[i], nullptr);
@@ -1683,48 +2482,108 @@ void Renderer::cleanup()
 
 	vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
 
+	vkDestroyDescriptorSetLayout(device, cull_descriptor_set_layout, nullptr);
+
+	vkDestroyPipeline(device, cull_pipeline, nullptr);
+
+	vkDestroyPipeline(device, meshlet_cull_pipeline, nullptr);
+
+	vkDestroyPipelineLayout(device, cull_pipeline_layout, nullptr);
+
 	vkDestroyRenderPass(device, render_pass, nullptr);
 
 	for (size_t i = 0; i < swap_chain_image_views.size(); i++)
 		vkDestroyImageView(device, swap_chain_image_views[i], nullptr);
 
-	vkDestroySwapchainKHR(device, swap_chain, nullptr);
+	if (headless)
+	{
+		for (size_t i = 0; i < swap_chain_images.size(); i++)
+		{
+			vkDestroyImage(device, swap_chain_images[i], nullptr);
+			allocator.free(offscreen_image_allocations[i]);
+		}
+	}
+	else
+	{
+		vkDestroySwapchainKHR(device, swap_chain, nullptr);
+	}
+
+	texture_table.cleanup();
+	texture_streamer.cleanup();
+	sampler_cache.cleanup();
+
+	uniform_ring_buffer.cleanup();
 
-	vkDestroySampler(device, texture_sampler, nullptr);
-	vkDestroyImageView(device, texture_image_view, nullptr);
-	vkDestroyImage(device, texture_image, nullptr);
-	vkFreeMemory(device, texture_image_memory, nullptr);
+	vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
 
-	for (size_t i = 0; i < swap_chain_images.size(); i++)
+	for (FrameContext& frame : frames)
 	{
-		vkDestroyBuffer(device, uniform_buffers[i], nullptr);
-		vkFreeMemory(device, uniform_buffers_memory[i], nullptr);
+		vkDestroyBuffer(device, frame.texture_demand_buffer, nullptr);
+		allocator.free(frame.texture_demand_buffer_allocation);
+
+		// There are no culled indices without meshlet culling, destroying the null buffer does nothing
+		vkDestroyBuffer(device, frame.culled_index_buffer, nullptr);
+		allocator.free(frame.culled_index_buffer_allocation);
+
+		vkDestroyBuffer(device, frame.draw_count_buffer, nullptr);
+		allocator.free(frame.draw_count_buffer_allocation);
+
+		vkDestroyBuffer(device, frame.culled_indirect_buffer, nullptr);
+		allocator.free(frame.culled_indirect_buffer_allocation);
 	}
 
-	vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+	vkDestroyBuffer(device, indirect_buffer, nullptr);
+	allocator.free(indirect_buffer_allocation);
+
+	vkDestroyBuffer(device, lod_buffer, nullptr);
+	allocator.free(lod_buffer_allocation);
+
+	vkDestroyBuffer(device, meshlet_buffer, nullptr);
+	allocator.free(meshlet_buffer_allocation);
+
+	vkDestroyBuffer(device, draw_data_buffer, nullptr);
+	allocator.free(draw_data_buffer_allocation);
 
 	vkDestroyBuffer(device, index_buffer, nullptr);
-	vkFreeMemory(device, index_buffer_memory, nullptr);
+	allocator.free(index_buffer_allocation);
 
 	vkDestroyBuffer(device, vertex_buffer, nullptr);
-	vkFreeMemory(device, vertex_buffer_memory, nullptr);
+	allocator.free(vertex_buffer_allocation);
 
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	for (FrameContext& frame : frames)
 	{
-		vkDestroySemaphore(device, image_available_semaphores[i], nullptr);
-		vkDestroySemaphore(device, render_finished_semaphores[i], nullptr);
-		vkDestroyFence(device, in_flight_fences[i], nullptr);
+		vkDestroySemaphore(device, frame.image_available_semaphore, nullptr);
+		vkDestroySemaphore(device, frame.render_finished_semaphore, nullptr);
+		vkDestroyFence(device, frame.in_flight_fence, nullptr);
 	}
 
+	gpu_profiler.cleanup();
+
 	vkDestroyCommandPool(device, command_pool, nullptr);
 
+	for (FrameContext& frame : frames)
+	{
+		for (WorkerCommandPool& worker_command_pool : frame.worker_command_pools)
+			vkDestroyCommandPool(device, worker_command_pool.command_pool, nullptr);
+	}
+
+	thread_pool.cleanup();
+
+	upload_context.cleanup();
+	allocator.cleanup();
+	pipeline_cache.cleanup();
+
 	vkDestroyDevice(device, nullptr);
 
 	// Surface destroyed before the instance
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	if (!headless)
+		vkDestroySurfaceKHR(instance, surface, nullptr);
 
 	vkDestroyInstance(instance, nullptr);
 
+	if (headless)
+		return;
+
 	// GLWF
 	glfwDestroyWindow(window);
 
@@ -1742,6 +2601,83 @@ void Renderer::set_glfw_window(GLFWwindow* window)
 	return;
 }
 
+void Renderer::set_headless(uint32_t width, uint32_t height)
+{
+	headless = true;
+	headless_extent = { width, height };
+
+	// No swap chain
+	device_extensions.clear();
+}
+
+void Renderer::read_frame(std::vector<uint8_t>& pixels, uint32_t& width, uint32_t& height)
+{
+	TRACE_SCOPE("Renderer::read_frame");
+
+	if (!headless)
+		throw std::runtime_error("Frames can only be read back in headless mode.");
+
+	width = swap_chain_extent.width;
+	height = swap_chain_extent.height;
+
+	VkDeviceSize size = static_cast<VkDeviceSize>(width) * height * 4;
+	VkImage image = swap_chain_images[last_image_index];
+
+	VkBuffer readback_buffer;
+	MemoryAllocation readback_allocation;
+	create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		readback_buffer, readback_allocation);
+
+	// Submitted to the graphics queue after the frame, the barrier waits for its render pass
+	VkCommandBuffer command_buffer = upload_context.get_graphics_command_buffer();
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkBufferImageCopy region{};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { width, height, 1 };
+
+	vkCmdCopyImageToBuffer(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback_buffer, 1, &region);
+
+	// The next frame drawing into the image starts from an undefined layout, so it's left as it is
+	VkMemoryBarrier host_barrier{};
+	host_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &host_barrier, 0, nullptr, 0, nullptr);
+
+	upload_context.wait(upload_context.submit());
+
+	const uint8_t* data = static_cast<const uint8_t*>(readback_allocation.mapped_data);
+	pixels.assign(data, data + size);
+
+	vkDestroyBuffer(device, readback_buffer, nullptr);
+	allocator.free(readback_allocation);
+}
+
 GLFWwindow* Renderer::get_glfw_window() const
 {
 	return window;
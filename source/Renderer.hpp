@@ -16,30 +16,113 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
 #include <iostream>
 #include <set>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
+#include "GpuProfiler.hpp"
+#include "MemoryAllocator.hpp"
 #include "ModelLoader.hpp"
+#include "PipelineCache.hpp"
+#include "SamplerCache.hpp"
+#include "Scene.hpp"
+#include "SyntheticScene.hpp"
+#include "TextureStreamer.hpp"
+#include "TextureTable.hpp"
+#include "ThreadPool.hpp"
+#include "UniformRingBuffer.hpp"
+#include "UploadContext.hpp"
+#include "VertexFormat.hpp"
 
 class Renderer
 {
 public:
 
+	// How the per-frame command buffers are produced
+	enum class RecordingMode
+	{
+		// Re-recorded every frame on the main thread
+		Immediate,
+		// Recorded once and reused until the swap chain, pipeline or scene changes
+		Cached,
+		// Re-recorded every frame, the draws are split into secondary command buffers recorded by worker threads
+		Parallel
+	};
+
 	void init_vulkan();
 	void draw_frame();
 	void cleanup();
 	void set_framebuffer_as_resized();
 	GLFWwindow* get_glfw_window() const;
 	void set_glfw_window(GLFWwindow* window);
+	// Renders into offscreen images of this size instead of a window, there is no surface or swap chain and nothing is
+	// presented, so frames aren't throttled by the display. Call before init_vulkan instead of set_glfw_window.
+	void set_headless(uint32_t width, uint32_t height);
+	bool is_headless() const { return headless; }
+	// Waits for the last drawn frame and copies its image into pixels as tightly packed RGBA8 (sRGB) rows. Headless mode only.
+	void read_frame(std::vector<uint8_t>& pixels, uint32_t& width, uint32_t& height);
 	VkDevice get_device() const;
+	void set_recording_mode(RecordingMode mode);
+	// The model is instanced grid_size * grid_size times, call before init_vulkan
+	void set_scene_grid_size(uint32_t grid_size);
+	// Runs the loaded meshes through MeshOptimizer (on by default), call before init_vulkan
+	void set_mesh_optimization(bool enabled);
+	// Every draw uses the lowest level of detail whose error projects to at most this many pixels, 0 always draws the full detail
+	void set_lod_error_threshold(float pixels);
+	// Compact by default, falls back to full vertices when the GPU can't read the compact formats. Call before init_vulkan.
+	void set_vertex_format(VertexFormat format);
+	// Culls the meshlets of the visible draws too, the draws then read the indices of the remaining ones from a buffer the
+	// culling pass writes. Off by default, the back face test of the meshlets expects closed meshes with outward facing
+	// triangles while the pipeline draws both sides. Call before init_vulkan.
+	void set_meshlet_culling(bool enabled);
+	// Most memory the mip levels of the textures take on the GPU, the least recently used levels are dropped to stay
+	// below it. The smallest levels of every texture stay resident even past it. Call before init_vulkan.
+	void set_texture_memory_budget(VkDeviceSize bytes);
+	// Replaces the model and its texture with generated content for benchmarks: object_count spheres of about triangle_count
+	// triangles each, laid out in a grid and using texture_count checkerboard textures in turn. Call before init_vulkan.
+	void set_synthetic_scene(uint32_t object_count, uint32_t triangle_count, uint32_t texture_count);
+	// Animates by this many seconds per frame instead of by the time that passed, so every run draws the same frames. 0 turns it off.
+	void set_fixed_time_step(float seconds);
+	// GPU time of the frame whose fence the last draw_frame waited on, from timestamps around its command buffer.
+	// False until a frame completed, or when the graphics queue can't write timestamps.
+	bool get_gpu_frame_time(double& milliseconds) const;
+	// GPU time of every pass, and the shader invocations of the main pass when the device has pipeline statistics
+	const GpuProfiler& get_gpu_profiler() const { return gpu_profiler; }
+	std::string get_device_name() const;
+	// How many frames the CPU can queue ahead of the GPU, 2 by default. More keep the GPU busier when frame times vary,
+	// fewer cut the latency from input to display. Call before init_vulkan.
+	void set_frames_in_flight(uint32_t count);
+	uint32_t get_frames_in_flight() const { return frames_in_flight; }
+	// Delays the start of every frame until shortly before the GPU is expected to finish the previous one, so the frame
+	// is simulated and recorded as late as possible without the GPU running idle. The expectation comes from the GPU and
+	// CPU times of the last frames, without GPU timestamps every frame waits for the previous one to finish instead.
+	void set_low_latency(bool enabled);
+	// Call when anything recorded into the command buffers changes, so the cached ones get re-recorded
+	void invalidate_command_buffers();
 
 	bool was_window_resized() { return framebuffer_resized; }
 
-	const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+	// Upper bound of set_frames_in_flight, more only add latency
+	const uint32_t MAX_FRAMES_IN_FLIGHT = 8;
+	// How much earlier than predicted a low latency frame starts, to make up for errors in the prediction and the sleep
+	const double LOW_LATENCY_SLACK_MILLISECONDS = 0.5;
+	// Space for the constants of a single frame in the uniform ring buffer
+	const VkDeviceSize UNIFORM_RING_FRAME_SIZE = 64 * 1024;
+	// Has to match local_size_x in cull.comp
+	const uint32_t CULL_GROUP_SIZE = 64;
+	// cull_meshlets.comp has a workgroup per draw, this is the least maxComputeWorkGroupCount a device can have.
+	// With more draws every workgroup loops over several of them.
+	const uint32_t MAX_MESHLET_CULL_GROUPS = 65535;
+	// Most indices of visible meshlets a frame can draw, 8 MiB per frame in flight. Scenes with fewer indices get a smaller buffer.
+	const uint32_t MAX_CULLED_INDICES = 2 * 1024 * 1024;
 	const std::string MODEL_PATH = "models/viking_room.obj";
 	const std::string TEXTURE_PATH = "textures/viking_room.png";
+	const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
 
 #ifdef NDEBUG
 	const bool enable_validation_layers = false;
@@ -49,13 +132,19 @@ public:
 
 private:
 
-	GLFWwindow* window;
+	GLFWwindow* window = nullptr;
+	// Without a window the swap chain images are plain images created by create_offscreen_images
+	bool headless = false;
+	VkExtent2D headless_extent{};
 	VkDevice device;
 	VkInstance instance;
 	VkPhysicalDevice physical_device = VK_NULL_HANDLE;
 	VkQueue graphics_queue;
 	VkQueue present_queue;
-	VkSurfaceKHR surface;
+	VkQueue transfer_queue;
+	// Async compute work can be submitted here, it's the graphics queue when there is no separate compute family
+	VkQueue compute_queue;
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
 	VkSwapchainKHR swap_chain = VK_NULL_HANDLE;
 	VkSwapchainKHR new_swap_chain = VK_NULL_HANDLE;
 	VkFormat swap_chain_image_format;
@@ -64,50 +153,172 @@ private:
 	VkDescriptorSetLayout descriptor_set_layout;
 	VkPipelineLayout pipeline_layout;
 	VkPipeline graphics_pipeline;
+	VkDescriptorSetLayout cull_descriptor_set_layout;
+	VkPipelineLayout cull_pipeline_layout;
+	VkPipeline cull_pipeline;
+	// Shares the layout of cull_pipeline, only created with meshlet culling
+	VkPipeline meshlet_cull_pipeline = VK_NULL_HANDLE;
 	VkCommandPool command_pool;
 	VkBuffer vertex_buffer;
-	VkDeviceMemory vertex_buffer_memory;
+	MemoryAllocation vertex_buffer_allocation;
 	VkBuffer index_buffer;
-	VkDeviceMemory index_buffer_memory;
+	MemoryAllocation index_buffer_allocation;
+	VkIndexType index_type = VK_INDEX_TYPE_UINT32;
+	// Draw_Data of every draw, bound as a storage buffer
+	VkBuffer draw_data_buffer;
+	MemoryAllocation draw_data_buffer_allocation;
+	// VkDrawIndexedIndirectCommand of every draw, the input of culling
+	VkBuffer indirect_buffer;
+	MemoryAllocation indirect_buffer_allocation;
+	// Lod_Data of every mesh part, the culling shader picks the level of every draw from it
+	VkBuffer lod_buffer;
+	MemoryAllocation lod_buffer_allocation;
+	// Meshlet_Data of every level of detail
+	VkBuffer meshlet_buffer;
+	MemoryAllocation meshlet_buffer_allocation;
 	VkDescriptorPool descriptor_pool;
-	uint32_t mip_levels;
-	VkImage texture_image;
-	VkDeviceMemory texture_image_memory;
-	VkImageView texture_image_view;
+	TextureStreamer texture_streamer;
+	// Index of TEXTURE_PATH in the texture streamer
+	uint32_t texture = 0;
+	VkDeviceSize texture_memory_budget = 256 * 1024 * 1024;
+	// Descriptor set 1 of the graphics pipeline, the draws index it with Draw_Data::texture_index
+	TextureTable texture_table;
+	// Table index of every texture of the texture streamer
+	std::vector<uint32_t> texture_table_indices;
+	SamplerCache sampler_cache;
 	VkSampler texture_sampler;
 	VkImage depth_image;
 	VkImage color_image;
-	VkDeviceMemory color_image_memory;
+	MemoryAllocation color_image_allocation;
 	VkImageView color_image_view;
-	VkDeviceMemory depth_image_memory;
+	MemoryAllocation depth_image_allocation;
 	VkImageView depth_image_view;
 	VkSampleCountFlagBits mssa_samples = VK_SAMPLE_COUNT_1_BIT;
+	MemoryAllocator allocator;
+	PipelineCache pipeline_cache;
+	UploadContext upload_context;
+	UniformRingBuffer uniform_ring_buffer;
+	// Dynamic offset of this frame's Uniform_Buffer_Object in the ring buffer
+	uint32_t uniform_buffer_offset = 0;
+	// Dynamic offset of this frame's Cull_Data
+	uint32_t cull_data_offset = 0;
 
-	std::vector<VkDescriptorSet> descriptor_sets;
-	std::vector<VkBuffer> uniform_buffers;
-	std::vector<VkDeviceMemory> uniform_buffers_memory;
-	std::vector<VkSemaphore> image_available_semaphores;
-	std::vector<VkSemaphore> render_finished_semaphores;
+	// The offscreen images in headless mode, one per frame in flight
 	std::vector<VkImage> swap_chain_images;
+	std::vector<MemoryAllocation> offscreen_image_allocations;
+	// Image the last frame was drawn into
+	uint32_t last_image_index = 0;
 	std::vector<VkImageView> swap_chain_image_views;
 	std::vector<VkFramebuffer> swap_chain_framebuffers;
-	std::vector<VkCommandBuffer> command_buffers;
-	std::vector<VkFence> in_flight_fences;
+	// The fence of the frame that last drew into each swap chain image. With more frames in flight than images an
+	// acquired image can still be drawn into by an earlier frame.
 	std::vector<VkFence> images_in_flight;
 
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
+	Scene scene;
+	uint32_t scene_grid_size = 1;
+	// A synthetic scene replaces the model when object_count isn't 0, see set_synthetic_scene
+	uint32_t synthetic_object_count = 0;
+	uint32_t synthetic_triangle_count = 0;
+	uint32_t synthetic_texture_count = 0;
+	const uint32_t SYNTHETIC_TEXTURE_SIZE = 512;
+	float fixed_time_step = 0.0f;
+	uint64_t frame_number = 0;
+	bool optimize_meshes = true;
+	VertexFormat vertex_format = VertexFormat::Compact;
+	float lod_error_threshold = 1.0f;
+	bool meshlet_culling = false;
+	// Size of the culled index buffers, see Cull_Data::index_capacity
+	uint32_t culled_index_capacity = 0;
+	uint32_t draw_count = 0;
+	bool supports_multi_draw_indirect = false;
+	bool supports_draw_indirect_count = false;
+	bool supports_pipeline_statistics = false;
+	// Secondary command buffers can only be executed inside a pipeline statistics query with inheritedQueries
+	bool supports_inherited_queries = false;
 
+	uint32_t frames_in_flight = 2;
 	size_t current_frame = 0;
+
+	bool low_latency = false;
+	// Whether previous_frame was submitted, nothing is paced before the first frame
+	bool has_previous_frame = false;
+	size_t previous_frame = 0;
+	std::chrono::steady_clock::time_point previous_submit_time;
+	// Moving average of the CPU time from the start of a frame to its submission
+	double cpu_frame_milliseconds = 0.0;
+
+	GpuProfiler gpu_profiler;
+	// The whole command buffer of the frame
+	uint32_t frame_profiler_pass = 0;
+	uint32_t cull_profiler_pass = 0;
+	// The render pass, begin_render_pass to end_render_pass
+	uint32_t main_profiler_pass = 0;
 	bool framebuffer_resized = false;
+	RecordingMode recording_mode = RecordingMode::Cached;
+
+	// Command pools are externally synchronized, so every worker thread records from its own pools.
+	// There is one pool per thread and frame in flight, it's reset once the fence of its frame was waited on.
+	struct WorkerCommandPool
+	{
+		VkCommandPool command_pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> command_buffers;
+		uint32_t used_command_buffers = 0;
+	};
+
+	// A primary command buffer of a frame, recorded for one framebuffer
+	struct FrameCommandBuffer
+	{
+		VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+		// Whether the cached command buffer is still valid and the offsets it was recorded with
+		bool valid = false;
+		uint32_t uniform_offset = 0;
+		uint32_t cull_offset = 0;
+	};
+
+	// Everything a frame in flight writes or the GPU uses while executing it. The frames take turns, a context is
+	// only reused once its fence was waited on, so nothing in it is shared with the frames still in flight.
+	struct FrameContext
+	{
+		VkSemaphore image_available_semaphore = VK_NULL_HANDLE;
+		VkSemaphore render_finished_semaphore = VK_NULL_HANDLE;
+		VkFence in_flight_fence = VK_NULL_HANDLE;
+		VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+		VkDescriptorSet cull_descriptor_set = VK_NULL_HANDLE;
+		// The draws that survived culling
+		VkBuffer culled_indirect_buffer = VK_NULL_HANDLE;
+		MemoryAllocation culled_indirect_buffer_allocation;
+		// uint32_t count of the visible draws per segment, for vkCmdDrawIndexedIndirectCount
+		VkBuffer draw_count_buffer = VK_NULL_HANDLE;
+		MemoryAllocation draw_count_buffer_allocation;
+		// uint32_t count of the indices written by the meshlet culling, followed by the 32-bit indices of the meshlets that
+		// survived culling. Only with meshlet culling.
+		VkBuffer culled_index_buffer = VK_NULL_HANDLE;
+		MemoryAllocation culled_index_buffer_allocation;
+		// uint32_t per texture of the table, the most pixels a visible draw using it covers. Written by the culling pass,
+		// host visible so it can be read once the fence of the frame was waited on.
+		VkBuffer texture_demand_buffer = VK_NULL_HANDLE;
+		MemoryAllocation texture_demand_buffer_allocation;
+		// One per framebuffer, a cached command buffer can only be submitted with the framebuffer it was recorded for
+		std::vector<FrameCommandBuffer> command_buffers;
+		// One per worker thread
+		std::vector<WorkerCommandPool> worker_command_pools;
+	};
+
+	std::vector<FrameContext> frames;
+
+	ThreadPool thread_pool;
 
 	const std::vector<const char*> validation_layers = { "VK_LAYER_KHRONOS_validation", "VK_LAYER_LUNARG_monitor"};
-	const std::vector<const char*> device_extensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+	// Emptied in headless mode
+	std::vector<const char*> device_extensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
 	struct QueueFamilyIndices
 	{
 		uint32_t graphics_family;
 		uint32_t present_family;
+		// These fall back to the graphics family when the device has no dedicated ones
+		uint32_t transfer_family;
+		uint32_t compute_family;
 	};
 
 	struct SwapChainSupportDetails
@@ -131,43 +342,59 @@ private:
 	VkPresentModeKHR choose_swap_present_mode(const std::vector<VkPresentModeKHR>& available_present_modes);
 	VkExtent2D choose_swap_extent(const VkSurfaceCapabilitiesKHR& capabilities);
 	void create_swap_chain(bool recreation = false);
+	void create_offscreen_images();
 	void create_image_views();
 	VkImageView create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspect_flags, uint32_t mip_levels);
 	void create_render_pass();
 	void create_graphics_pipeline();
+	void create_cull_pipeline();
 	VkShaderModule create_shader_module(const std::vector<char>& code);
 	void create_framebuffers();
+	void create_upload_context();
 	void create_command_pool();
 	void create_image(uint32_t width, uint32_t height, uint32_t mip_levels, VkSampleCountFlagBits samples_count,
 		VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-		VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& image_memory);
+		VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& image_allocation);
 	void create_color_resources();
 	void create_depth_resources();
-	void create_texture_image();
-	void generate_mipmaps(VkImage image, VkFormat image_format, int32_t tex_width, int32_t tex_height, uint32_t mip_levels);
+	void create_textures();
+	void create_gpu_profiler();
 	VkSampleCountFlagBits get_max_mssa_sample_count();
-	void create_texture_image_view();
 	void create_texture_sampler();
+	void create_scene();
 	void create_vertex_buffer();
 	void create_index_buffer();
+	void create_draw_buffers();
 	void create_uniform_buffers();
 	void create_buffer(VkDeviceSize size, VkBufferUsageFlags usage_flags, VkMemoryPropertyFlags properties,
-		VkBuffer& buffer, VkDeviceMemory& buffer_memory);
-	VkCommandBuffer begin_single_time_commands();
-	void end_single_time_commands(VkCommandBuffer command_buffer);
+		VkBuffer& buffer, MemoryAllocation& buffer_allocation);
 	void copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size);
 	void copy_buffer_to_image(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
 	void transition_image_layout(VkImage image, VkFormat format, VkImageLayout old_layout, VkImageLayout new_layout, uint32_t mip_levels);
 	VkFormat find_depth_format();
 	bool has_stencil_component(VkFormat format);
 	VkFormat find_supported_format(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
-	uint32_t find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties);
 	void create_command_buffers();
-	void record_command_buffer(int image_index);
-	void begin_render_pass(int framebuffer_index);
+	void create_worker_command_pools();
+	void record_command_buffer(uint32_t image_index);
+	void begin_render_pass(VkCommandBuffer command_buffer, uint32_t framebuffer_index, VkSubpassContents contents);
+	void end_render_pass(VkCommandBuffer command_buffer);
+	void record_culling(VkCommandBuffer command_buffer);
+	uint32_t get_draw_segment_count() const;
+	uint32_t get_draw_segment_size() const;
+	void record_draws(VkCommandBuffer command_buffer, uint32_t segment);
+	void record_secondary_command_buffers(VkCommandBuffer command_buffer, uint32_t framebuffer_index);
+	VkCommandBuffer get_worker_command_buffer(WorkerCommandPool& worker_command_pool);
 	void create_sync_objects();
+	// Low latency mode, sleeps until the frame should start
+	void pace_frame();
 	void create_descriptor_set_layout();
-	void update_uniform_buffer(uint32_t current_image);
+	void create_cull_descriptor_set_layout();
+	void create_texture_table();
+	void update_uniform_buffer();
+	// Hands the texture demand the culling pass of this frame measured last time to the streamer
+	void request_texture_detail();
+	void update_texture_streaming();
 	void create_descriptor_pool();
 	void create_descriptor_sets();
 	void cleanup_swap_chain();
@@ -0,0 +1,54 @@
+#include <stdexcept>
+
+#include "SamplerCache.hpp"
+
+void SamplerCache::init(VkDevice device)
+{
+	this->device = device;
+}
+
+void SamplerCache::cleanup()
+{
+	for (auto& sampler : samplers)
+		vkDestroySampler(device, sampler.second, nullptr);
+
+	samplers.clear();
+}
+
+VkSampler SamplerCache::get_sampler(const VkSamplerCreateInfo& info)
+{
+	if (info.pNext != nullptr)
+		throw std::runtime_error("Samplers with a pNext chain can't be cached.");
+
+	Sampler_Key key;
+	key.flags = info.flags;
+	key.mag_filter = info.magFilter;
+	key.min_filter = info.minFilter;
+	key.mipmap_mode = info.mipmapMode;
+	key.address_mode_u = info.addressModeU;
+	key.address_mode_v = info.addressModeV;
+	key.address_mode_w = info.addressModeW;
+	key.mip_lod_bias = info.mipLodBias;
+	key.anisotropy_enable = info.anisotropyEnable;
+	key.max_anisotropy = info.maxAnisotropy;
+	key.compare_enable = info.compareEnable;
+	key.compare_op = info.compareOp;
+	key.min_lod = info.minLod;
+	key.max_lod = info.maxLod;
+	key.border_color = info.borderColor;
+	key.unnormalized_coordinates = info.unnormalizedCoordinates;
+
+	auto cached_sampler = samplers.find(key);
+
+	if (cached_sampler != samplers.end())
+		return cached_sampler->second;
+
+	VkSampler sampler;
+
+	if (vkCreateSampler(device, &info, nullptr, &sampler) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create texture sampler");
+
+	samplers.emplace(key, sampler);
+
+	return sampler;
+}
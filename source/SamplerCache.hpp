@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+#include <vulkan/vulkan.h>
+
+#include "Hash.hpp"
+
+// Hands out one VkSampler per distinct VkSamplerCreateInfo, textures with the same filtering and addressing share it.
+// A device can have as few as 4000 samplers (maxSamplerAllocationCount), so they shouldn't be created per texture.
+// The samplers live until cleanup.
+class SamplerCache
+{
+public:
+
+	void init(VkDevice device);
+	void cleanup();
+
+	// The create info can't have a pNext chain (e.g. sampler YCbCr conversion), it isn't part of the key
+	VkSampler get_sampler(const VkSamplerCreateInfo& info);
+	size_t get_sampler_count() const { return samplers.size(); }
+
+private:
+
+	// The fields of VkSamplerCreateInfo that make a sampler, all 4 bytes so there is no padding to compare or hash
+	struct Sampler_Key
+	{
+		VkSamplerCreateFlags flags;
+		VkFilter mag_filter;
+		VkFilter min_filter;
+		VkSamplerMipmapMode mipmap_mode;
+		VkSamplerAddressMode address_mode_u;
+		VkSamplerAddressMode address_mode_v;
+		VkSamplerAddressMode address_mode_w;
+		float mip_lod_bias;
+		VkBool32 anisotropy_enable;
+		float max_anisotropy;
+		VkBool32 compare_enable;
+		VkCompareOp compare_op;
+		float min_lod;
+		float max_lod;
+		VkBorderColor border_color;
+		VkBool32 unnormalized_coordinates;
+
+		bool operator==(const Sampler_Key& other) const { return memcmp(this, &other, sizeof(Sampler_Key)) == 0; }
+	};
+
+	struct Sampler_Key_Hash
+	{
+		size_t operator()(const Sampler_Key& key) const { return static_cast<size_t>(Hash::bytes(&key, sizeof(Sampler_Key))); }
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::unordered_map<Sampler_Key, VkSampler, Sampler_Key_Hash> samplers;
+};
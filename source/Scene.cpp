@@ -0,0 +1,276 @@
+#include <cfloat>
+#include <stdexcept>
+#include <string>
+
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "Scene.hpp"
+
+uint32_t Scene::add_mesh(const std::vector<Vertex>& mesh_vertices, const std::vector<uint32_t>& mesh_indices)
+{
+	return add_mesh(mesh_vertices, mesh_indices, ModelLoader::compute_bounding_sphere(mesh_vertices.data(), mesh_vertices.size()));
+}
+
+uint32_t Scene::add_mesh(const std::vector<Vertex>& mesh_vertices, const std::vector<uint32_t>& mesh_indices, const glm::vec4& bounding_sphere)
+{
+	Mesh mesh{};
+	mesh.first_part = static_cast<uint32_t>(parts.size());
+
+	if (mesh_vertices.size() <= MAX_PART_VERTICES)
+	{
+		add_part(mesh_vertices.data(), mesh_vertices.size(), mesh_indices.data(), mesh_indices.size(), bounding_sphere);
+	}
+	else
+	{
+		const uint32_t NOT_IN_PART = ~0u;
+
+		// Local index of every mesh vertex in the part being built
+		std::vector<uint32_t> part_indices_of_vertices(mesh_vertices.size(), NOT_IN_PART);
+		std::vector<Vertex> part_vertices;
+		std::vector<uint32_t> part_indices;
+		size_t part_first_triangle = 0;
+
+		part_vertices.reserve(MAX_PART_VERTICES);
+
+		for (size_t triangle = 0; triangle < mesh_indices.size() / 3; triangle++)
+		{
+			const uint32_t* triangle_indices = &mesh_indices[triangle * 3];
+			uint32_t new_vertices = 0;
+
+			for (uint32_t i = 0; i < 3; i++)
+			{
+				if (triangle_indices[i] >= mesh_vertices.size())
+					throw std::runtime_error("Mesh index out of range.");
+
+				if (part_indices_of_vertices[triangle_indices[i]] == NOT_IN_PART)
+					new_vertices++;
+			}
+
+			if (part_vertices.size() + new_vertices > MAX_PART_VERTICES)
+			{
+				add_part(part_vertices.data(), part_vertices.size(), part_indices.data(), part_indices.size(),
+					ModelLoader::compute_bounding_sphere(part_vertices.data(), part_vertices.size()));
+
+				// Only the vertices of this part have to be forgotten, not the whole mesh
+				for (size_t i = part_first_triangle * 3; i < triangle * 3; i++)
+					part_indices_of_vertices[mesh_indices[i]] = NOT_IN_PART;
+
+				part_vertices.clear();
+				part_indices.clear();
+				part_first_triangle = triangle;
+			}
+
+			for (uint32_t i = 0; i < 3; i++)
+			{
+				uint32_t& local_index = part_indices_of_vertices[triangle_indices[i]];
+
+				if (local_index == NOT_IN_PART)
+				{
+					local_index = static_cast<uint32_t>(part_vertices.size());
+					part_vertices.push_back(mesh_vertices[triangle_indices[i]]);
+				}
+
+				part_indices.push_back(local_index);
+			}
+		}
+
+		if (!part_indices.empty())
+		{
+			add_part(part_vertices.data(), part_vertices.size(), part_indices.data(), part_indices.size(),
+				ModelLoader::compute_bounding_sphere(part_vertices.data(), part_vertices.size()));
+		}
+	}
+
+	mesh.part_count = static_cast<uint32_t>(parts.size()) - mesh.first_part;
+	meshes.push_back(mesh);
+
+	return static_cast<uint32_t>(meshes.size() - 1);
+}
+
+void Scene::add_part(const Vertex* part_vertices, size_t vertex_count, const uint32_t* part_indices, size_t index_count, const glm::vec4& bounding_sphere)
+{
+	Mesh_Part part{};
+	part.lods[0].first_index = static_cast<uint32_t>(indices.size());
+	part.lods[0].index_count = static_cast<uint32_t>(index_count);
+	part.lods[0].error = 0.0f;
+	part.lod_count = 1;
+	part.vertex_offset = static_cast<int32_t>(vertices.size());
+	part.vertex_count = static_cast<uint32_t>(vertex_count);
+	part.bounding_sphere = bounding_sphere;
+	part.quantization = Vertex_Quantization::compute(part_vertices, vertex_count);
+
+	vertices.insert(vertices.end(), part_vertices, part_vertices + vertex_count);
+	indices.insert(indices.end(), part_indices, part_indices + index_count);
+
+	// The levels of detail share the vertices of the part, only their indices are added
+	std::vector<uint32_t> lod_indices;
+
+	while (part.lod_count < lod_count)
+	{
+		const Mesh_Lod& previous = part.lods[part.lod_count - 1];
+		size_t target_index_count = previous.index_count / 6 * 3;
+
+		float error = MeshSimplifier::simplify(part_vertices, vertex_count, &indices[previous.first_index], previous.index_count,
+			target_index_count, FLT_MAX, lod_indices);
+
+		// Borders and seams can stop the simplification early, a level that is almost the same isn't worth drawing
+		if (lod_indices.empty() || lod_indices.size() > previous.index_count * 3 / 4)
+			break;
+
+		MeshOptimizer::optimize_vertex_cache(lod_indices, vertex_count);
+
+		Mesh_Lod& lod = part.lods[part.lod_count++];
+		lod.first_index = static_cast<uint32_t>(indices.size());
+		lod.index_count = static_cast<uint32_t>(lod_indices.size());
+		// Every level is simplified from the one before it, so the errors add up
+		lod.error = previous.error + error;
+
+		indices.insert(indices.end(), lod_indices.begin(), lod_indices.end());
+	}
+
+	// The triangles of every level are in vertex cache order already, which keeps the meshlets compact
+	for (uint32_t i = 0; i < part.lod_count; i++)
+	{
+		Mesh_Lod& lod = part.lods[i];
+		lod.first_meshlet = static_cast<uint32_t>(meshlets.size());
+
+		MeshletBuilder::build(part_vertices, vertex_count, &indices[lod.first_index], lod.index_count, meshlets);
+
+		lod.meshlet_count = static_cast<uint32_t>(meshlets.size()) - lod.first_meshlet;
+
+		for (size_t j = lod.first_meshlet; j < meshlets.size(); j++)
+			meshlets[j].first_index += lod.first_index;
+	}
+
+	parts.push_back(part);
+}
+
+uint32_t Scene::add_instance(uint32_t mesh_index, const glm::mat4& transform, uint32_t texture_index)
+{
+	if (mesh_index >= meshes.size())
+		throw std::runtime_error("Instance refers to a mesh that doesn't exist.");
+
+	instances.push_back({ mesh_index, transform, texture_index });
+
+	return static_cast<uint32_t>(instances.size() - 1);
+}
+
+void Scene::set_lod_count(uint32_t count)
+{
+	if (count < 1 || count > MAX_LOD_COUNT)
+		throw std::runtime_error("Level of detail count has to be between 1 and " + std::to_string(MAX_LOD_COUNT) + ".");
+
+	lod_count = count;
+}
+
+void Scene::clear()
+{
+	vertices.clear();
+	indices.clear();
+	parts.clear();
+	meshlets.clear();
+	meshes.clear();
+	instances.clear();
+}
+
+void Scene::build_draws(std::vector<Draw_Data>& draw_data, std::vector<VkDrawIndexedIndirectCommand>& draw_commands, std::vector<Lod_Data>& lod_data,
+	std::vector<Meshlet_Data>& meshlet_data) const
+{
+	meshlet_data.resize(meshlets.size());
+
+	for (size_t i = 0; i < meshlets.size(); i++)
+	{
+		meshlet_data[i] = Meshlet_Data{};
+		meshlet_data[i].bounding_sphere = meshlets[i].bounding_sphere;
+		meshlet_data[i].cone = meshlets[i].cone;
+		meshlet_data[i].first_index = meshlets[i].first_index;
+		meshlet_data[i].index_count = meshlets[i].index_count;
+	}
+
+	lod_data.assign(parts.size() * MAX_LOD_COUNT, Lod_Data{});
+
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		for (uint32_t j = 0; j < parts[i].lod_count; j++)
+		{
+			Lod_Data& lod = lod_data[i * MAX_LOD_COUNT + j];
+			lod.first_index = parts[i].lods[j].first_index;
+			lod.index_count = parts[i].lods[j].index_count;
+			lod.first_meshlet = parts[i].lods[j].first_meshlet;
+			lod.meshlet_count = parts[i].lods[j].meshlet_count;
+			lod.error = parts[i].lods[j].error;
+		}
+	}
+
+	size_t draw_count = 0;
+	for (const Instance& instance : instances)
+		draw_count += meshes[instance.mesh_index].part_count;
+
+	draw_data.resize(draw_count);
+	draw_commands.resize(draw_count);
+
+	size_t draw_index = 0;
+
+	for (const Instance& instance : instances)
+	{
+		const Mesh& mesh = meshes[instance.mesh_index];
+
+		for (uint32_t i = 0; i < mesh.part_count; i++, draw_index++)
+		{
+			uint32_t part_index = mesh.first_part + i;
+			const Mesh_Part& part = parts[part_index];
+
+			draw_data[draw_index].model = instance.transform;
+			draw_data[draw_index].bounding_sphere = part.bounding_sphere;
+			draw_data[draw_index].position_scale = part.quantization.position_scale;
+			draw_data[draw_index].position_offset = part.quantization.position_offset;
+			draw_data[draw_index].tex_coord_transform = part.quantization.tex_coord_transform;
+			draw_data[draw_index].first_lod = part_index * MAX_LOD_COUNT;
+			draw_data[draw_index].lod_count = part.lod_count;
+			draw_data[draw_index].texture_index = instance.texture_index;
+
+			VkDrawIndexedIndirectCommand& command = draw_commands[draw_index];
+			command.indexCount = part.lods[0].index_count;
+			command.instanceCount = 1;
+			command.firstIndex = part.lods[0].first_index;
+			command.vertexOffset = part.vertex_offset;
+			// Lets the vertex shader find its Draw_Data through gl_InstanceIndex
+			command.firstInstance = static_cast<uint32_t>(draw_index);
+		}
+	}
+}
+
+void Scene::build_compact_vertices(std::vector<Compact_Vertex>& compact_vertices) const
+{
+	compact_vertices.resize(vertices.size());
+
+	for (const Mesh_Part& part : parts)
+	{
+		size_t begin = static_cast<size_t>(part.vertex_offset);
+
+		for (size_t i = begin; i < begin + part.vertex_count; i++)
+			compact_vertices[i] = Compact_Vertex::quantize(vertices[i], part.quantization);
+	}
+}
+
+void Scene::build_16bit_indices(std::vector<uint16_t>& indices_16bit) const
+{
+	if (get_index_type() != VK_INDEX_TYPE_UINT16)
+		throw std::runtime_error("The scene has parts that can't be drawn with 16-bit indices.");
+
+	indices_16bit.resize(indices.size());
+
+	for (size_t i = 0; i < indices.size(); i++)
+		indices_16bit[i] = static_cast<uint16_t>(indices[i]);
+}
+
+VkIndexType Scene::get_index_type() const
+{
+	for (const Mesh_Part& part : parts)
+	{
+		if (part.vertex_count > MAX_PART_VERTICES)
+			return VK_INDEX_TYPE_UINT32;
+	}
+
+	return VK_INDEX_TYPE_UINT16;
+}
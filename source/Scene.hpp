@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include "MeshletBuilder.hpp"
+#include "ModelLoader.hpp"
+#include "VertexFormat.hpp"
+
+// Per-draw data read by the vertex shader from a storage buffer (std430), indexed with gl_InstanceIndex
+struct Draw_Data
+{
+	alignas(16) glm::mat4 model;
+	// xyz is the center and w the radius, in the space of the mesh
+	alignas(16) glm::vec4 bounding_sphere;
+	// Vertex_Quantization of the mesh, only used by the pipeline for compact vertices
+	alignas(16) glm::vec4 position_scale;
+	alignas(16) glm::vec4 position_offset;
+	alignas(16) glm::vec4 tex_coord_transform;
+	// Levels of detail of the part in the Lod_Data buffer, the culling shader picks one of them
+	uint32_t first_lod;
+	uint32_t lod_count;
+	// Of the texture in the TextureTable the fragment shader samples
+	uint32_t texture_index;
+};
+
+// One level of detail of a mesh part (std430), read by the culling shader
+struct Lod_Data
+{
+	uint32_t first_index;
+	uint32_t index_count;
+	// Meshlets of the level in the Meshlet_Data buffer, they cover the same indices
+	uint32_t first_meshlet;
+	uint32_t meshlet_count;
+	// Distance the surface moved from the full detail, in the space of the mesh
+	float error;
+	uint32_t padding[3];
+};
+
+// A Meshlet as the meshlet culling shader reads it (std430)
+struct Meshlet_Data
+{
+	alignas(16) glm::vec4 bounding_sphere;
+	alignas(16) glm::vec4 cone;
+	// Into the index buffer of the scene, like the levels of detail
+	uint32_t first_index;
+	uint32_t index_count;
+	uint32_t padding[2];
+};
+
+// Input of the culling compute shader (std140), bound from the uniform ring buffer
+struct Cull_Data
+{
+	// Normalized planes (xyz normal pointing inside, w distance) in the space the Draw_Data model matrices transform to
+	alignas(16) glm::vec4 frustum_planes[6];
+	uint32_t draw_count;
+	// Visible draws are compacted per segment of this many draws, each segment has its own counter
+	uint32_t segment_size;
+	// 0 keeps every draw in place and sets instanceCount of the culled ones to 0
+	uint32_t compact;
+	// In the same space as the frustum planes
+	alignas(16) glm::vec4 camera_position;
+	// A level of detail is used when its error * lod_scale, both in world units, is below the distance to the camera.
+	// That is when the error projects to less than the pixel threshold on the screen.
+	float lod_scale;
+	// Most indices the meshlet culling can write in a frame, the draws past it keep only the triangles that fit
+	uint32_t index_capacity;
+	// Pixels covered by one world unit at a distance of one, the culling measures the texture demand with it
+	float pixels_per_unit;
+};
+
+// All the meshes of the scene packed into one vertex and one index buffer, plus the instances that draw them.
+// Every part of an instance becomes one VkDrawIndexedIndirectCommand whose firstInstance is the index of its Draw_Data,
+// so the whole scene is drawn with a single indirect call no matter how many objects there are.
+class Scene
+{
+public:
+
+	// Most a part can have, so its indices fit in 16 bits
+	static const uint32_t MAX_PART_VERTICES = 65536;
+	// Including the full detail
+	static const uint32_t MAX_LOD_COUNT = 4;
+
+	struct Mesh_Lod
+	{
+		uint32_t first_index;
+		uint32_t index_count;
+		uint32_t first_meshlet;
+		uint32_t meshlet_count;
+		float error;
+	};
+
+	// Meshes with more than MAX_PART_VERTICES vertices are split into parts that are drawn separately
+	struct Mesh_Part
+	{
+		// lods[0] is the full detail, every level after it has about half the triangles of the one before
+		Mesh_Lod lods[MAX_LOD_COUNT];
+		uint32_t lod_count;
+		// Indices of a part are local to it, this is added to them when drawing
+		int32_t vertex_offset;
+		uint32_t vertex_count;
+		glm::vec4 bounding_sphere;
+		Vertex_Quantization quantization;
+	};
+
+	struct Mesh
+	{
+		uint32_t first_part;
+		uint32_t part_count;
+	};
+
+	struct Instance
+	{
+		uint32_t mesh_index;
+		glm::mat4 transform;
+		// TextureTable index of the texture of the instance
+		uint32_t texture_index;
+	};
+
+	// Returns the index of the mesh to create instances with. Meshes with more than MAX_PART_VERTICES vertices are split
+	// into parts along the order of their triangles, the vertices shared by two parts are duplicated.
+	uint32_t add_mesh(const std::vector<Vertex>& mesh_vertices, const std::vector<uint32_t>& mesh_indices);
+	// For meshes whose bounding sphere is already known, e.g. from a mesh cache file
+	uint32_t add_mesh(const std::vector<Vertex>& mesh_vertices, const std::vector<uint32_t>& mesh_indices, const glm::vec4& bounding_sphere);
+	uint32_t add_instance(uint32_t mesh_index, const glm::mat4& transform, uint32_t texture_index = 0);
+	void clear();
+	// Levels of detail built for the meshes added after this, 1 turns them off
+	void set_lod_count(uint32_t count);
+
+	// The draw commands use the full detail of every part, lod_data has MAX_LOD_COUNT entries for every part
+	void build_draws(std::vector<Draw_Data>& draw_data, std::vector<VkDrawIndexedIndirectCommand>& draw_commands, std::vector<Lod_Data>& lod_data,
+		std::vector<Meshlet_Data>& meshlet_data) const;
+	// The vertices of every part quantized with its own Vertex_Quantization, in the same order as get_vertices
+	void build_compact_vertices(std::vector<Compact_Vertex>& compact_vertices) const;
+	// Only possible when get_index_type is VK_INDEX_TYPE_UINT16
+	void build_16bit_indices(std::vector<uint16_t>& indices_16bit) const;
+
+	// VK_INDEX_TYPE_UINT16 when every part has at most MAX_PART_VERTICES vertices, which add_mesh makes sure of
+	VkIndexType get_index_type() const;
+
+	const std::vector<Vertex>& get_vertices() const { return vertices; }
+	const std::vector<uint32_t>& get_indices() const { return indices; }
+	const std::vector<Mesh_Part>& get_parts() const { return parts; }
+	const std::vector<Meshlet>& get_meshlets() const { return meshlets; }
+	const std::vector<Mesh>& get_meshes() const { return meshes; }
+	const std::vector<Instance>& get_instances() const { return instances; }
+
+private:
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<Mesh_Part> parts;
+	// Of every level of detail of every part, their index ranges are into indices
+	std::vector<Meshlet> meshlets;
+	std::vector<Mesh> meshes;
+	std::vector<Instance> instances;
+	uint32_t lod_count = MAX_LOD_COUNT;
+
+	void add_part(const Vertex* part_vertices, size_t vertex_count, const uint32_t* part_indices, size_t index_count, const glm::vec4& bounding_sphere);
+};
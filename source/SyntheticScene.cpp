@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <cmath>
+
+#include "SyntheticScene.hpp"
+#include "TextureCooker.hpp"
+
+void SyntheticScene::generate_sphere(uint32_t triangle_count, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	// rings * segments quads with segments = 2 * rings, the quads touching the poles are a single triangle.
+	// That's 4 * rings * (rings - 1) triangles.
+	uint32_t rings = std::max(static_cast<uint32_t>(std::lround((1.0 + std::sqrt(1.0 + triangle_count)) * 0.5)), 2u);
+	uint32_t segments = 2 * rings;
+
+	const float PI = 3.14159265358979f;
+
+	vertices.clear();
+	indices.clear();
+
+	// The seam column is duplicated so the texture coordinates can wrap
+	for (uint32_t i = 0; i <= rings; i++)
+	{
+		float v = static_cast<float>(i) / rings;
+		float polar = v * PI;
+
+		for (uint32_t j = 0; j <= segments; j++)
+		{
+			float u = static_cast<float>(j) / segments;
+			float azimuth = u * 2.0f * PI;
+
+			Vertex vertex{};
+			vertex.pos = glm::vec3(std::sin(polar) * std::cos(azimuth), std::sin(polar) * std::sin(azimuth), std::cos(polar));
+			vertex.color = glm::vec3(1.0f);
+			vertex.tex_coord = glm::vec2(u * 4.0f, v * 2.0f);
+
+			vertices.push_back(vertex);
+		}
+	}
+
+	for (uint32_t i = 0; i < rings; i++)
+	{
+		for (uint32_t j = 0; j < segments; j++)
+		{
+			uint32_t top_left = i * (segments + 1) + j;
+			uint32_t bottom_left = top_left + segments + 1;
+
+			// Counter-clockwise seen from outside
+			if (i != 0)
+				indices.insert(indices.end(), { top_left, bottom_left, top_left + 1 });
+
+			if (i != rings - 1)
+				indices.insert(indices.end(), { top_left + 1, bottom_left, bottom_left + 1 });
+		}
+	}
+}
+
+void SyntheticScene::generate_texture(uint32_t index, uint32_t size, Texture_Data& texture)
+{
+	// The colors come from a multiplicative hash of the index
+	uint32_t hash = (index + 1) * 2654435761u;
+	uint8_t red = static_cast<uint8_t>(hash >> 24);
+	uint8_t green = static_cast<uint8_t>(hash >> 16);
+	uint8_t blue = static_cast<uint8_t>(hash >> 8);
+
+	// The second color is the inverse of the first
+	uint8_t colors[2][4] = {
+		{ red, green, blue, 255 },
+		{ static_cast<uint8_t>(255 - red), static_cast<uint8_t>(255 - green), static_cast<uint8_t>(255 - blue), 255 }
+	};
+
+	const uint32_t SQUARES = 8;
+	uint32_t square_size = std::max(size / SQUARES, 1u);
+
+	size_t level_size = static_cast<size_t>(size) * size * 4;
+
+	texture.format = VK_FORMAT_R8G8B8A8_SRGB;
+	texture.levels.assign(1, Texture_Level{ size, size, 0, level_size });
+	texture.data.resize(level_size);
+
+	for (uint32_t y = 0; y < size; y++)
+	{
+		for (uint32_t x = 0; x < size; x++)
+		{
+			const uint8_t* color = colors[(x / square_size + y / square_size) % 2];
+			std::copy(color, color + 4, &texture.data[(static_cast<size_t>(y) * size + x) * 4]);
+		}
+	}
+
+	// The box filter is enough for a checkerboard and keeps the setup of big benchmarks short
+	TextureCooker::generate_mip_chain(texture, MipFilter::Box);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ModelLoader.hpp"
+#include "TextureLoader.hpp"
+
+// Procedural meshes and textures for benchmarks, so runs don't depend on asset files and the same parameters always
+// give the same content.
+class SyntheticScene
+{
+public:
+
+	// A UV sphere of radius 1 around the origin with about triangle_count triangles, at least 8
+	static void generate_sphere(uint32_t triangle_count, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+	// A size x size R8G8B8A8_SRGB checkerboard with its full mip chain, the colors follow from index
+	static void generate_texture(uint32_t index, uint32_t size, Texture_Data& texture);
+};
@@ -0,0 +1,332 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "TextureCooker.hpp"
+
+const char* const TextureCooker::SOURCE_KEY = "VulkanEngineSource";
+
+// Of the Kaiser filter, in texels of the smaller level
+static const float KAISER_RADIUS = 2.0f;
+static const float KAISER_ALPHA = 4.0f;
+
+// Texels of the larger level that make up one texel of the smaller level, along one axis.
+// The weights of all of them are in one array, weight_offset is where the ones of this texel start.
+struct Filter_Contribution
+{
+	uint32_t first;
+	uint32_t count;
+	size_t weight_offset;
+};
+
+static float srgb_to_linear(float value)
+{
+	return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linear_to_srgb(float value)
+{
+	return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// Zeroth order modified Bessel function of the first kind, the series converges quickly for the alphas used here
+static float bessel_i0(float x)
+{
+	float sum = 1.0f;
+	float term = 1.0f;
+
+	for (int k = 1; k < 20; k++)
+	{
+		term *= (x * 0.5f / k) * (x * 0.5f / k);
+		sum += term;
+	}
+
+	return sum;
+}
+
+static float kaiser_filter(float t)
+{
+	if (std::abs(t) >= KAISER_RADIUS)
+		return 0.0f;
+
+	const float PI = 3.14159265358979f;
+	float sinc = t == 0.0f ? 1.0f : std::sin(PI * t) / (PI * t);
+	float window_position = t / KAISER_RADIUS;
+
+	return sinc * bessel_i0(KAISER_ALPHA * std::sqrt(1.0f - window_position * window_position)) / bessel_i0(KAISER_ALPHA);
+}
+
+static void compute_contributions(uint32_t source_size, uint32_t destination_size, MipFilter filter,
+	std::vector<Filter_Contribution>& contributions, std::vector<float>& weights)
+{
+	float scale = static_cast<float>(source_size) / destination_size;
+
+	contributions.resize(destination_size);
+	weights.clear();
+
+	std::vector<float> texel_weights;
+
+	for (uint32_t x = 0; x < destination_size; x++)
+	{
+		float begin = x * scale;
+		float end = (x + 1) * scale;
+
+		// The footprint stops at the edges, the weights that are left are normalized again
+		int first, last;
+
+		if (filter == MipFilter::Box)
+		{
+			first = static_cast<int>(std::floor(begin));
+			last = std::min(static_cast<int>(std::ceil(end)), static_cast<int>(source_size)) - 1;
+		}
+		else
+		{
+			float center = (begin + end) * 0.5f;
+			first = std::max(static_cast<int>(std::floor(center - KAISER_RADIUS * scale)), 0);
+			last = std::min(static_cast<int>(std::ceil(center + KAISER_RADIUS * scale)), static_cast<int>(source_size) - 1);
+		}
+
+		texel_weights.assign(last - first + 1, 0.0f);
+		float weight_sum = 0.0f;
+
+		for (int i = first; i <= last; i++)
+		{
+			float weight;
+
+			if (filter == MipFilter::Box)
+				weight = std::min(static_cast<float>(i + 1), end) - std::max(static_cast<float>(i), begin);
+			else
+				weight = kaiser_filter((i + 0.5f - (begin + end) * 0.5f) / scale);
+
+			texel_weights[i - first] = weight;
+			weight_sum += weight;
+		}
+
+		contributions[x].first = static_cast<uint32_t>(first);
+		contributions[x].count = static_cast<uint32_t>(texel_weights.size());
+		contributions[x].weight_offset = weights.size();
+
+		// The weights add up to 1, a flat color stays the same
+		for (float weight : texel_weights)
+			weights.push_back(weight / weight_sum);
+	}
+}
+
+// Separable filter, rows first and columns second. The inner loops are plain multiply-adds over contiguous floats,
+// the compiler turns them into SIMD code.
+static void downsample(const std::vector<float>& source, uint32_t source_width, uint32_t source_height,
+	std::vector<float>& destination, uint32_t destination_width, uint32_t destination_height, MipFilter filter)
+{
+	std::vector<Filter_Contribution> contributions;
+	std::vector<float> weights;
+
+	std::vector<float> rows(static_cast<size_t>(destination_width) * source_height * 4);
+	compute_contributions(source_width, destination_width, filter, contributions, weights);
+
+	for (uint32_t y = 0; y < source_height; y++)
+	{
+		const float* source_row = &source[static_cast<size_t>(y) * source_width * 4];
+		float* row = &rows[static_cast<size_t>(y) * destination_width * 4];
+
+		for (uint32_t x = 0; x < destination_width; x++)
+		{
+			const Filter_Contribution& contribution = contributions[x];
+			float texel[4] = {};
+
+			for (uint32_t i = 0; i < contribution.count; i++)
+			{
+				float weight = weights[contribution.weight_offset + i];
+				const float* source_texel = source_row + static_cast<size_t>(contribution.first + i) * 4;
+
+				for (int c = 0; c < 4; c++)
+					texel[c] += source_texel[c] * weight;
+			}
+
+			memcpy(row + static_cast<size_t>(x) * 4, texel, sizeof(texel));
+		}
+	}
+
+	destination.assign(static_cast<size_t>(destination_width) * destination_height * 4, 0.0f);
+	compute_contributions(source_height, destination_height, filter, contributions, weights);
+
+	size_t row_size = static_cast<size_t>(destination_width) * 4;
+
+	for (uint32_t y = 0; y < destination_height; y++)
+	{
+		const Filter_Contribution& contribution = contributions[y];
+		float* destination_row = &destination[y * row_size];
+
+		for (uint32_t i = 0; i < contribution.count; i++)
+		{
+			float weight = weights[contribution.weight_offset + i];
+			const float* row = &rows[(contribution.first + i) * row_size];
+
+			for (size_t j = 0; j < row_size; j++)
+				destination_row[j] += row[j] * weight;
+		}
+	}
+}
+
+void TextureCooker::load_texture(const std::string& image_path, Texture_Data& texture, MipFilter filter)
+{
+	std::string cooked_path = get_cooked_path(image_path);
+
+	File_Info source_info;
+	bool has_source = FileStream::get_file_info(image_path, source_info);
+	std::string source = make_source(source_info, filter);
+
+	if (read_cooked(cooked_path, has_source ? &source : nullptr, texture))
+		return;
+
+	decode_image(image_path, texture);
+	generate_mip_chain(texture, filter);
+
+	// A failed write only costs the cooking on the next launch again
+	try
+	{
+		TextureLoader::write_ktx2(cooked_path, texture, { { SOURCE_KEY, source } });
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "Failed to cache " << image_path << ": " << e.what() << "\n";
+	}
+}
+
+void TextureCooker::cook_texture(const std::string& image_path, const std::string& cooked_path, MipFilter filter)
+{
+	File_Info source_info;
+
+	if (!FileStream::get_file_info(image_path, source_info))
+		throw std::runtime_error("Failed to open " + image_path + ".");
+
+	Texture_Data texture;
+	decode_image(image_path, texture);
+	generate_mip_chain(texture, filter);
+
+	TextureLoader::write_ktx2(cooked_path, texture, { { SOURCE_KEY, make_source(source_info, filter) } });
+}
+
+void TextureCooker::decode_image(const std::string& image_path, Texture_Data& texture)
+{
+	// https://vulkan-tutorial.com/Texture_mapping/Images#page_Loading-an-image
+	int tex_width, tex_height, tex_channels;
+
+	stbi_uc* pixels = stbi_load(image_path.c_str(), &tex_width, &tex_height, &tex_channels, STBI_rgb_alpha);
+
+	if (!pixels)
+		throw std::runtime_error("Failed to load texture image.");
+
+	size_t image_size = static_cast<size_t>(tex_width) * tex_height * 4;
+
+	texture.format = VK_FORMAT_R8G8B8A8_SRGB;
+	texture.levels.assign(1, Texture_Level{ static_cast<uint32_t>(tex_width), static_cast<uint32_t>(tex_height), 0, image_size });
+	texture.data.assign(pixels, pixels + image_size);
+
+	stbi_image_free(pixels);
+}
+
+void TextureCooker::generate_mip_chain(Texture_Data& texture, MipFilter filter)
+{
+	if (texture.format != VK_FORMAT_R8G8B8A8_UNORM && texture.format != VK_FORMAT_R8G8B8A8_SRGB)
+		throw std::runtime_error("Mip maps can only be generated for R8G8B8A8 textures.");
+
+	bool srgb = texture.format == VK_FORMAT_R8G8B8A8_SRGB;
+
+	// Averaging sRGB values darkens the smaller levels, the colors are filtered in linear space.
+	// Alpha is linear either way.
+	float to_linear[256];
+
+	for (int i = 0; i < 256; i++)
+		to_linear[i] = srgb ? srgb_to_linear(i / 255.0f) : i / 255.0f;
+
+	Texture_Level base_level = texture.levels[0];
+	uint32_t width = base_level.width;
+	uint32_t height = base_level.height;
+
+	std::vector<float> level(static_cast<size_t>(width) * height * 4);
+	const uint8_t* base_texels = texture.data.data() + base_level.offset;
+
+	for (size_t i = 0; i < level.size(); i++)
+		level[i] = i % 4 == 3 ? base_texels[i] / 255.0f : to_linear[base_texels[i]];
+
+	std::vector<uint8_t> data(base_texels, base_texels + base_level.size);
+	std::vector<Texture_Level> levels = { Texture_Level{ width, height, 0, base_level.size } };
+	std::vector<float> next_level;
+
+	// Every level is filtered from the one above it, in floats so the errors of rounding don't add up
+	while (width > 1 || height > 1)
+	{
+		uint32_t next_width = std::max(width / 2, 1u);
+		uint32_t next_height = std::max(height / 2, 1u);
+
+		downsample(level, width, height, next_level, next_width, next_height, filter);
+
+		Texture_Level next{};
+		next.width = next_width;
+		next.height = next_height;
+		// Levels are aligned to 16 bytes like the ones TextureLoader reads
+		next.offset = (data.size() + 15) / 16 * 16;
+		next.size = static_cast<size_t>(next_width) * next_height * 4;
+
+		data.resize(next.offset + next.size);
+		uint8_t* texels = data.data() + next.offset;
+
+		// The Kaiser filter has negative lobes, it can overshoot
+		for (size_t i = 0; i < next_level.size(); i++)
+		{
+			float value = std::clamp(next_level[i], 0.0f, 1.0f);
+
+			if (srgb && i % 4 != 3)
+				value = linear_to_srgb(value);
+
+			texels[i] = static_cast<uint8_t>(std::lround(value * 255.0f));
+		}
+
+		levels.push_back(next);
+		level.swap(next_level);
+		width = next_width;
+		height = next_height;
+	}
+
+	texture.levels = std::move(levels);
+	texture.data = std::move(data);
+}
+
+std::string TextureCooker::get_cooked_path(const std::string& image_path)
+{
+	return FileStream::replace_extension(image_path, ".cooked.ktx2");
+}
+
+bool TextureCooker::read_cooked(const std::string& cooked_path, const std::string* source, Texture_Data& texture)
+{
+	std::map<std::string, std::string> key_values;
+
+	try
+	{
+		if (!TextureLoader::load_ktx2(cooked_path, texture, &key_values))
+			return false;
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "Cooked texture " << cooked_path << " can't be read, ignoring it: " << e.what() << "\n";
+		return false;
+	}
+
+	if (source == nullptr)
+		return true;
+
+	auto cooked_source = key_values.find(SOURCE_KEY);
+
+	return cooked_source != key_values.end() && cooked_source->second == *source;
+}
+
+std::string TextureCooker::make_source(const File_Info& source_info, MipFilter filter)
+{
+	return "size " + std::to_string(source_info.size) + " time " + std::to_string(source_info.modification_time)
+		+ " filter " + (filter == MipFilter::Box ? "box" : "kaiser") + " version " + std::to_string(COOK_VERSION);
+}
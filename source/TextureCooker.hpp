@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+
+#include "FileStream.hpp"
+#include "TextureLoader.hpp"
+
+// How the levels of a mip chain are filtered from the level above them
+enum class MipFilter
+{
+	// Average of the texels each texel covers, cheap but a little blurry
+	Box,
+	// Windowed sinc, keeps more detail in the smaller levels
+	Kaiser
+};
+
+// Turns images (PNG, JPG and the rest stb_image reads) into textures with their full mip chain, once.
+// The result is cached next to the image as a KTX2 file, so later launches only read it and upload every level,
+// instead of decoding the image and blitting the mip maps on the GPU.
+class TextureCooker
+{
+public:
+
+	// Loads the cooked texture of the image, cooking it first when it's missing or was made from a different version
+	// of the image or with a different filter. If the image isn't there the cooked file is used on its own.
+	static void load_texture(const std::string& image_path, Texture_Data& texture, MipFilter filter = MipFilter::Kaiser);
+	// Offline cooking of an image into a KTX2 file
+	static void cook_texture(const std::string& image_path, const std::string& cooked_path, MipFilter filter = MipFilter::Kaiser);
+
+	// The image as the single level of an R8G8B8A8_SRGB texture
+	static void decode_image(const std::string& image_path, Texture_Data& texture);
+	// Replaces the levels after the first one with the full chain down to 1x1. sRGB textures are filtered in linear space.
+	static void generate_mip_chain(Texture_Data& texture, MipFilter filter);
+
+	// textures/name.png -> textures/name.cooked.ktx2
+	static std::string get_cooked_path(const std::string& image_path);
+
+private:
+
+	// Key of the key/value data that identifies what a cooked file was made from
+	static const char* const SOURCE_KEY;
+	// Increased when the cooking changes, so older cooked files are made again
+	static const uint32_t COOK_VERSION = 1;
+
+	// Returns false when the file is missing, damaged or (if source is given) was cooked from something else
+	static bool read_cooked(const std::string& cooked_path, const std::string* source, Texture_Data& texture);
+	static std::string make_source(const File_Info& source_info, MipFilter filter);
+};
@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include "FileStream.hpp"
+#include "MappedFile.hpp"
+#include "TextureLoader.hpp"
+
+// Level offsets are aligned to this, a multiple of every block size and of the 4 vkCmdCopyBufferToImage needs
+static const size_t LEVEL_ALIGNMENT = 16;
+
+struct Ktx2_Header
+{
+	uint8_t identifier[12];
+	uint32_t vk_format;
+	uint32_t type_size;
+	uint32_t pixel_width;
+	uint32_t pixel_height;
+	uint32_t pixel_depth;
+	uint32_t layer_count;
+	uint32_t face_count;
+	uint32_t level_count;
+	uint32_t supercompression_scheme;
+	uint32_t dfd_byte_offset;
+	uint32_t dfd_byte_length;
+	uint32_t kvd_byte_offset;
+	uint32_t kvd_byte_length;
+	uint64_t sgd_byte_offset;
+	uint64_t sgd_byte_length;
+};
+
+struct Ktx2_Level_Index
+{
+	uint64_t byte_offset;
+	uint64_t byte_length;
+	uint64_t uncompressed_byte_length;
+};
+
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+bool TextureLoader::load_ktx2(const std::string& path, Texture_Data& texture, std::map<std::string, std::string>* key_values)
+{
+	MappedFile file;
+
+	if (!file.open(path))
+		return false;
+
+	const uint8_t* data = static_cast<const uint8_t*>(file.get_data());
+	Ktx2_Header header;
+
+	if (file.get_size() < sizeof(header))
+		throw std::runtime_error(path + " is not a KTX2 file.");
+
+	memcpy(&header, data, sizeof(header));
+
+	if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+		throw std::runtime_error(path + " is not a KTX2 file.");
+
+	if (header.supercompression_scheme != 0)
+		throw std::runtime_error(path + " is supercompressed, only KTX2 files with plain block compressed data are supported.");
+
+	// Cube maps, arrays and 3D textures aren't used by anything yet
+	if (header.pixel_height == 0 || header.pixel_depth > 1 || header.layer_count > 1 || header.face_count != 1)
+		throw std::runtime_error(path + " is not a 2D texture.");
+
+	VkFormat format = static_cast<VkFormat>(header.vk_format);
+	uint32_t block_width, block_height, block_size;
+
+	if (!get_block_info(format, block_width, block_height, block_size))
+		throw std::runtime_error(path + " has an unsupported format (" + std::to_string(header.vk_format) + ").");
+
+	// 0 asks the loader to generate the mip maps, there is only the base level then
+	uint32_t level_count = header.level_count == 0 ? 1 : header.level_count;
+
+	if (level_count > 32 || file.get_size() < sizeof(header) + sizeof(Ktx2_Level_Index) * level_count)
+		throw std::runtime_error(path + " is damaged.");
+
+	texture.format = format;
+	texture.levels.resize(level_count);
+	texture.data.clear();
+
+	size_t offset = 0;
+
+	for (uint32_t i = 0; i < level_count; i++)
+	{
+		Ktx2_Level_Index level_index;
+		memcpy(&level_index, data + sizeof(header) + sizeof(Ktx2_Level_Index) * i, sizeof(level_index));
+
+		Texture_Level& level = texture.levels[i];
+		level.width = std::max(header.pixel_width >> i, 1u);
+		level.height = std::max(header.pixel_height >> i, 1u);
+		level.offset = offset;
+		level.size = static_cast<size_t>((level.width + block_width - 1) / block_width) * ((level.height + block_height - 1) / block_height) * block_size;
+
+		if (level_index.byte_length != level.size || level_index.byte_offset > file.get_size() || level.size > file.get_size() - level_index.byte_offset)
+			throw std::runtime_error(path + " is damaged.");
+
+		offset = (offset + level.size + LEVEL_ALIGNMENT - 1) / LEVEL_ALIGNMENT * LEVEL_ALIGNMENT;
+	}
+
+	texture.data.resize(offset);
+
+	// The file stores the smallest level first, the levels are put in order here
+	for (uint32_t i = 0; i < level_count; i++)
+	{
+		Ktx2_Level_Index level_index;
+		memcpy(&level_index, data + sizeof(header) + sizeof(Ktx2_Level_Index) * i, sizeof(level_index));
+
+		memcpy(texture.data.data() + texture.levels[i].offset, data + level_index.byte_offset, texture.levels[i].size);
+	}
+
+	if (key_values == nullptr)
+		return true;
+
+	key_values->clear();
+
+	if (header.kvd_byte_offset > file.get_size() || header.kvd_byte_length > file.get_size() - header.kvd_byte_offset)
+		throw std::runtime_error(path + " is damaged.");
+
+	// Every entry is its length, the key ending with a 0 and the value, padded to 4 bytes
+	const uint8_t* entry = data + header.kvd_byte_offset;
+	const uint8_t* kvd_end = entry + header.kvd_byte_length;
+
+	while (kvd_end - entry >= 4)
+	{
+		uint32_t length;
+		memcpy(&length, entry, sizeof(length));
+		entry += sizeof(length);
+
+		if (length > static_cast<size_t>(kvd_end - entry))
+			throw std::runtime_error(path + " is damaged.");
+
+		const char* key_and_value = reinterpret_cast<const char*>(entry);
+		size_t key_length = strnlen(key_and_value, length);
+
+		if (key_length < length)
+			(*key_values)[std::string(key_and_value, key_length)] = std::string(key_and_value + key_length + 1, length - key_length - 1);
+
+		entry += (length + 3) / 4 * 4;
+	}
+
+	return true;
+}
+
+void TextureLoader::write_ktx2(const std::string& path, const Texture_Data& texture, const std::map<std::string, std::string>& key_values)
+{
+	if (texture.format != VK_FORMAT_R8G8B8A8_UNORM && texture.format != VK_FORMAT_R8G8B8A8_SRGB)
+		throw std::runtime_error("Only R8G8B8A8 textures can be written to KTX2 files.");
+
+	if (texture.levels.empty())
+		throw std::runtime_error("The texture has no levels to write.");
+
+	uint32_t level_count = static_cast<uint32_t>(texture.levels.size());
+
+	// Data format descriptor: the total size and a basic descriptor block with a sample for each of the 4 channels
+	const uint32_t DFD_BLOCK_SIZE = 24 + 16 * 4;
+	std::vector<uint32_t> dfd;
+	dfd.push_back(4 + DFD_BLOCK_SIZE);
+	dfd.push_back(0);
+	// Version 2 of the Khronos data format
+	dfd.push_back(2 | DFD_BLOCK_SIZE << 16);
+	// RGBSDA color model, BT.709 primaries, sRGB or linear transfer function
+	dfd.push_back(1 | 1 << 8 | (texture.format == VK_FORMAT_R8G8B8A8_SRGB ? 2 : 1) << 16);
+	dfd.push_back(0);
+	// 4 bytes per texel
+	dfd.push_back(4);
+	dfd.push_back(0);
+
+	for (uint32_t channel = 0; channel < 4; channel++)
+	{
+		// The alpha channel has the id 15 and is always linear
+		uint32_t channel_type = channel == 3 ? (15 | 0x10) : channel;
+
+		dfd.push_back(channel * 8 | 7 << 16 | channel_type << 24);
+		dfd.push_back(0);
+		dfd.push_back(0);
+		dfd.push_back(255);
+	}
+
+	std::vector<uint8_t> kvd;
+
+	// Sorted by key, like the format wants them, because the map is
+	for (const auto& [key, value] : key_values)
+	{
+		uint32_t length = static_cast<uint32_t>(key.size() + 1 + value.size());
+		const uint8_t* length_bytes = reinterpret_cast<const uint8_t*>(&length);
+
+		kvd.insert(kvd.end(), length_bytes, length_bytes + sizeof(length));
+		kvd.insert(kvd.end(), key.begin(), key.end());
+		kvd.push_back(0);
+		kvd.insert(kvd.end(), value.begin(), value.end());
+		kvd.resize((kvd.size() + 3) / 4 * 4, 0);
+	}
+
+	Ktx2_Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+	header.vk_format = static_cast<uint32_t>(texture.format);
+	header.type_size = 1;
+	header.pixel_width = texture.levels[0].width;
+	header.pixel_height = texture.levels[0].height;
+	header.face_count = 1;
+	header.level_count = level_count;
+	header.dfd_byte_offset = static_cast<uint32_t>(sizeof(header) + sizeof(Ktx2_Level_Index) * level_count);
+	header.dfd_byte_length = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+	header.kvd_byte_offset = kvd.empty() ? 0 : header.dfd_byte_offset + header.dfd_byte_length;
+	header.kvd_byte_length = static_cast<uint32_t>(kvd.size());
+
+	// The levels follow from the smallest to the largest, so a reader can stream the small ones in first
+	std::vector<Ktx2_Level_Index> level_indices(level_count);
+	uint64_t offset = header.dfd_byte_offset + header.dfd_byte_length + header.kvd_byte_length;
+
+	for (uint32_t i = level_count; i-- > 0;)
+	{
+		offset = (offset + LEVEL_ALIGNMENT - 1) / LEVEL_ALIGNMENT * LEVEL_ALIGNMENT;
+
+		level_indices[i].byte_offset = offset;
+		level_indices[i].byte_length = texture.levels[i].size;
+		level_indices[i].uncompressed_byte_length = texture.levels[i].size;
+
+		offset += texture.levels[i].size;
+	}
+
+	// Written under a temporary name and renamed, so a reader never sees half a file
+	std::string temporary_path = path + ".tmp";
+
+	{
+		std::ofstream output(temporary_path, std::ios::binary | std::ios::trunc);
+
+		if (!output.is_open())
+			throw std::runtime_error("Failed to open " + temporary_path + " for writing.");
+
+		output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		output.write(reinterpret_cast<const char*>(level_indices.data()), sizeof(Ktx2_Level_Index) * level_count);
+		output.write(reinterpret_cast<const char*>(dfd.data()), header.dfd_byte_length);
+		output.write(reinterpret_cast<const char*>(kvd.data()), kvd.size());
+
+		uint64_t position = header.dfd_byte_offset + header.dfd_byte_length + header.kvd_byte_length;
+		const char padding[LEVEL_ALIGNMENT] = {};
+
+		for (uint32_t i = level_count; i-- > 0;)
+		{
+			output.write(padding, static_cast<std::streamsize>(level_indices[i].byte_offset - position));
+			output.write(reinterpret_cast<const char*>(texture.data.data() + texture.levels[i].offset), texture.levels[i].size);
+			position = level_indices[i].byte_offset + level_indices[i].byte_length;
+		}
+
+		if (!output)
+			throw std::runtime_error("Failed to write " + temporary_path + ".");
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporary_path, path, error);
+
+	if (error)
+	{
+		std::filesystem::remove(temporary_path, error);
+		throw std::runtime_error("Failed to write " + path + ".");
+	}
+}
+
+bool TextureLoader::can_decompress(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void decode_565(uint16_t color, uint8_t* rgba)
+{
+	rgba[0] = static_cast<uint8_t>(((color >> 11) & 31) * 255 / 31);
+	rgba[1] = static_cast<uint8_t>(((color >> 5) & 63) * 255 / 63);
+	rgba[2] = static_cast<uint8_t>((color & 31) * 255 / 31);
+	rgba[3] = 255;
+}
+
+// The color part of every BC1 to BC3 block. BC1 has a mode with three colors and transparent black when color0 <= color1,
+// in BC2 and BC3 the colors always have four entries.
+static void decode_color_block(const uint8_t* block, bool allow_transparent, uint8_t colors_of_texels[16][4])
+{
+	uint16_t color0 = static_cast<uint16_t>(block[0] | block[1] << 8);
+	uint16_t color1 = static_cast<uint16_t>(block[2] | block[3] << 8);
+	uint32_t selectors = block[4] | block[5] << 8 | block[6] << 16 | static_cast<uint32_t>(block[7]) << 24;
+
+	uint8_t palette[4][4];
+	decode_565(color0, palette[0]);
+	decode_565(color1, palette[1]);
+
+	for (int c = 0; c < 3; c++)
+	{
+		if (color0 > color1 || !allow_transparent)
+		{
+			palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c] + 1) / 3);
+			palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c] + 1) / 3);
+		}
+		else
+		{
+			palette[2][c] = static_cast<uint8_t>((palette[0][c] + palette[1][c] + 1) / 2);
+			palette[3][c] = 0;
+		}
+	}
+
+	palette[2][3] = 255;
+	palette[3][3] = color0 > color1 || !allow_transparent ? 255 : 0;
+
+	for (int i = 0; i < 16; i++)
+		memcpy(colors_of_texels[i], palette[(selectors >> (i * 2)) & 3], 4);
+}
+
+static void decode_bc3_alpha(const uint8_t* block, uint8_t colors_of_texels[16][4])
+{
+	uint8_t alpha[8];
+	alpha[0] = block[0];
+	alpha[1] = block[1];
+
+	if (alpha[0] > alpha[1])
+	{
+		for (int i = 1; i < 7; i++)
+			alpha[i + 1] = static_cast<uint8_t>(((7 - i) * alpha[0] + i * alpha[1] + 3) / 7);
+	}
+	else
+	{
+		for (int i = 1; i < 5; i++)
+			alpha[i + 1] = static_cast<uint8_t>(((5 - i) * alpha[0] + i * alpha[1] + 2) / 5);
+
+		alpha[6] = 0;
+		alpha[7] = 255;
+	}
+
+	uint64_t selectors = 0;
+	for (int i = 0; i < 6; i++)
+		selectors |= static_cast<uint64_t>(block[2 + i]) << (i * 8);
+
+	for (int i = 0; i < 16; i++)
+		colors_of_texels[i][3] = alpha[(selectors >> (i * 3)) & 7];
+}
+
+void TextureLoader::decompress(Texture_Data& texture)
+{
+	if (!can_decompress(texture.format))
+		throw std::runtime_error("Texture format can't be decompressed (" + std::to_string(texture.format) + ").");
+
+	VkFormat format = texture.format;
+	bool srgb = format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK
+		|| format == VK_FORMAT_BC2_SRGB_BLOCK || format == VK_FORMAT_BC3_SRGB_BLOCK;
+	bool bc1 = format == VK_FORMAT_BC1_RGB_UNORM_BLOCK || format == VK_FORMAT_BC1_RGB_SRGB_BLOCK
+		|| format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK || format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	bool bc1_alpha = format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK || format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	bool bc2 = format == VK_FORMAT_BC2_UNORM_BLOCK || format == VK_FORMAT_BC2_SRGB_BLOCK;
+	size_t block_size = bc1 ? 8 : 16;
+
+	Texture_Data result;
+	result.format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+	result.levels.resize(texture.levels.size());
+
+	size_t offset = 0;
+
+	for (size_t i = 0; i < texture.levels.size(); i++)
+	{
+		result.levels[i].width = texture.levels[i].width;
+		result.levels[i].height = texture.levels[i].height;
+		result.levels[i].offset = offset;
+		result.levels[i].size = static_cast<size_t>(texture.levels[i].width) * texture.levels[i].height * 4;
+
+		offset = (offset + result.levels[i].size + LEVEL_ALIGNMENT - 1) / LEVEL_ALIGNMENT * LEVEL_ALIGNMENT;
+	}
+
+	result.data.resize(offset);
+
+	for (size_t i = 0; i < texture.levels.size(); i++)
+	{
+		const Texture_Level& level = texture.levels[i];
+		uint8_t* texels = result.data.data() + result.levels[i].offset;
+		uint32_t blocks_x = (level.width + 3) / 4;
+		uint32_t blocks_y = (level.height + 3) / 4;
+
+		for (uint32_t by = 0; by < blocks_y; by++)
+		{
+			for (uint32_t bx = 0; bx < blocks_x; bx++)
+			{
+				const uint8_t* block = texture.data.data() + level.offset + (static_cast<size_t>(by) * blocks_x + bx) * block_size;
+				uint8_t colors_of_texels[16][4];
+
+				if (bc1)
+				{
+					// BC1 without alpha has opaque black where the alpha variant is transparent
+					decode_color_block(block, true, colors_of_texels);
+
+					if (!bc1_alpha)
+					{
+						for (int t = 0; t < 16; t++)
+							colors_of_texels[t][3] = 255;
+					}
+				}
+				else
+				{
+					decode_color_block(block + 8, false, colors_of_texels);
+
+					if (bc2)
+					{
+						for (int t = 0; t < 16; t++)
+							colors_of_texels[t][3] = static_cast<uint8_t>(((block[t / 2] >> ((t % 2) * 4)) & 15) * 17);
+					}
+					else
+					{
+						decode_bc3_alpha(block, colors_of_texels);
+					}
+				}
+
+				// Blocks on the right and bottom edges can reach past the level
+				for (uint32_t y = 0; y < 4 && by * 4 + y < level.height; y++)
+				{
+					for (uint32_t x = 0; x < 4 && bx * 4 + x < level.width; x++)
+						memcpy(texels + ((static_cast<size_t>(by) * 4 + y) * level.width + bx * 4 + x) * 4, colors_of_texels[y * 4 + x], 4);
+				}
+			}
+		}
+	}
+
+	texture = std::move(result);
+}
+
+bool TextureLoader::get_block_info(VkFormat format, uint32_t& block_width, uint32_t& block_height, uint32_t& block_size)
+{
+	block_width = 4;
+	block_height = 4;
+	block_size = 16;
+
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		block_width = 1;
+		block_height = 1;
+		block_size = 4;
+		return true;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		block_size = 8;
+		return true;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+	case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+		return true;
+	case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
+		block_width = 5;
+		block_height = 5;
+		return true;
+	case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+		block_width = 6;
+		block_height = 6;
+		return true;
+	case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+	case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+		block_width = 8;
+		block_height = 8;
+		return true;
+	default:
+		return false;
+	}
+}
+
+std::string TextureLoader::get_ktx2_path(const std::string& image_path)
+{
+	return FileStream::replace_extension(image_path, ".ktx2");
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+struct Texture_Level
+{
+	uint32_t width;
+	uint32_t height;
+	// Range of Texture_Data::data, the offsets are aligned for vkCmdCopyBufferToImage
+	size_t offset;
+	size_t size;
+};
+
+// A texture with its mip chain in the layout it's uploaded in, level 0 is the full size
+struct Texture_Data
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	std::vector<Texture_Level> levels;
+	std::vector<uint8_t> data;
+};
+
+// Loads textures that are stored ready for the GPU. Block compressed formats are 4 to 8 times smaller than
+// R8G8B8A8 in memory and to upload, and their mip chain is made offline so nothing has to be generated at startup.
+class TextureLoader
+{
+public:
+
+	// Reads a KTX2 file (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html) with a 2D texture in one of the
+	// formats get_block_info knows. Returns false when the file can't be opened, throws when it can't be used.
+	// Supercompressed files (Basis Universal, Zstandard) aren't supported, they need a transcoder.
+	// key_values receives the key/value data of the file, the values are the raw bytes.
+	static bool load_ktx2(const std::string& path, Texture_Data& texture, std::map<std::string, std::string>* key_values = nullptr);
+	// Only R8G8B8A8 textures, nothing here compresses them
+	static void write_ktx2(const std::string& path, const Texture_Data& texture, const std::map<std::string, std::string>& key_values = {});
+
+	// Whether decompress can turn the format into R8G8B8A8, for devices that can't sample it
+	static bool can_decompress(VkFormat format);
+	// BC1, BC2 and BC3 to R8G8B8A8 in the same color space, for every level
+	static void decompress(Texture_Data& texture);
+
+	// Texels in a block and bytes per block, uncompressed formats have blocks of 1x1 texels.
+	// Returns false for formats textures can't be loaded in.
+	static bool get_block_info(VkFormat format, uint32_t& block_width, uint32_t& block_height, uint32_t& block_size);
+	// textures/name.png -> textures/name.ktx2
+	static std::string get_ktx2_path(const std::string& image_path);
+};
@@ -0,0 +1,528 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+#include "TextureCooker.hpp"
+#include "TextureStreamer.hpp"
+#include "Trace.hpp"
+
+void TextureStreamer::init(VkPhysicalDevice physical_device, VkDevice device, MemoryAllocator* allocator, UploadContext* upload_context,
+	uint32_t frames_in_flight, VkDeviceSize memory_budget, uint32_t decode_thread_count)
+{
+	this->physical_device = physical_device;
+	this->device = device;
+	this->allocator = allocator;
+	this->upload_context = upload_context;
+	this->frames_in_flight = frames_in_flight;
+	this->memory_budget = memory_budget;
+
+	stopping = false;
+	decode_pool.init(decode_thread_count);
+	loader_thread = std::thread(&TextureStreamer::loader_loop, this);
+
+	// Mid gray, so the textures that are still loading don't stand out
+	Texture_Data placeholder;
+	placeholder.format = VK_FORMAT_R8G8B8A8_SRGB;
+	placeholder.levels = { Texture_Level{ 1, 1, 0, 4 } };
+	placeholder.data = { 128, 128, 128, 255 };
+
+	create_image(placeholder, 0, placeholder_image, placeholder_allocation, placeholder_image_view);
+	record_level_copies(placeholder, 0, placeholder_image, VK_NULL_HANDLE, 1);
+}
+
+void TextureStreamer::cleanup()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	load_requested.notify_all();
+
+	if (loader_thread.joinable())
+		loader_thread.join();
+
+	decode_pool.cleanup();
+
+	destroy_retired_images(true);
+
+	for (Texture& texture : textures)
+	{
+		if (texture.image == VK_NULL_HANDLE)
+			continue;
+
+		vkDestroyImageView(device, texture.image_view, nullptr);
+		vkDestroyImage(device, texture.image, nullptr);
+		allocator->free(texture.allocation);
+	}
+
+	textures.clear();
+	resident_bytes = 0;
+
+	vkDestroyImageView(device, placeholder_image_view, nullptr);
+	vkDestroyImage(device, placeholder_image, nullptr);
+	allocator->free(placeholder_allocation);
+}
+
+uint32_t TextureStreamer::add_texture(const std::string& image_path)
+{
+	uint32_t texture = static_cast<uint32_t>(textures.size());
+	textures.emplace_back();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		load_requests.push_back(Load_Request{ texture, image_path });
+	}
+
+	load_requested.notify_one();
+
+	return texture;
+}
+
+uint32_t TextureStreamer::add_texture(Texture_Data data)
+{
+	uint32_t texture = static_cast<uint32_t>(textures.size());
+	textures.emplace_back();
+
+	// Handed to update like a texture the loader thread finished
+	std::lock_guard<std::mutex> lock(mutex);
+	load_results.push_back(Load_Result{ texture, std::move(data), std::string() });
+
+	return texture;
+}
+
+void TextureStreamer::request_detail(uint32_t texture, float screen_size)
+{
+	textures[texture].screen_size = std::max(textures[texture].screen_size, screen_size);
+}
+
+const std::vector<uint32_t>& TextureStreamer::update()
+{
+	TRACE_SCOPE("TextureStreamer::update");
+
+	frame_index++;
+	changed_textures.clear();
+	destroy_retired_images(false);
+
+	std::vector<Load_Result> results;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		results.swap(load_results);
+	}
+
+	for (Load_Result& result : results)
+	{
+		// The other textures still get uploaded, this one is drawn with the placeholder
+		if (!result.error.empty())
+		{
+			std::cout << result.error << "\n";
+			continue;
+		}
+
+		Texture& texture = textures[result.texture];
+		texture.data = std::move(result.data);
+
+		uint32_t level_count = static_cast<uint32_t>(texture.data.levels.size());
+		texture.tail_level = 0;
+
+		while (texture.tail_level + 1 < level_count && std::max(texture.data.levels[texture.tail_level].width,
+			texture.data.levels[texture.tail_level].height) > MIN_RESIDENT_SIZE)
+			texture.tail_level++;
+
+		// The small levels go up whatever the budget says, the texture can't be drawn without them
+		texture.resident_level = level_count;
+		set_resident_level(texture, texture.tail_level);
+	}
+
+	// A texture that covers n pixels needs about n texels across, the level with that size is wanted
+	std::vector<Texture*> streamed_textures;
+
+	for (Texture& texture : textures)
+	{
+		if (texture.data.levels.empty())
+			continue;
+
+		texture.wanted_level = texture.tail_level;
+
+		if (texture.screen_size > 0.0f)
+		{
+			const Texture_Level& base_level = texture.data.levels[0];
+			float texel_ratio = std::max(base_level.width, base_level.height) / texture.screen_size;
+			float level = std::floor(std::log2(std::max(texel_ratio, 1.0f)));
+
+			texture.wanted_level = std::min(static_cast<uint32_t>(level), texture.tail_level);
+			texture.last_used_frame = frame_index;
+		}
+
+		texture.screen_size = 0.0f;
+
+		if (texture.wanted_level < texture.resident_level)
+			streamed_textures.push_back(&texture);
+	}
+
+	// The textures used most recently and missing the most levels first
+	std::sort(streamed_textures.begin(), streamed_textures.end(), [](const Texture* a, const Texture* b)
+		{
+			if (a->last_used_frame != b->last_used_frame)
+				return a->last_used_frame > b->last_used_frame;
+
+			return a->resident_level - a->wanted_level > b->resident_level - b->wanted_level;
+		});
+
+	VkDeviceSize uploaded_bytes = 0;
+
+	for (Texture* texture : streamed_textures)
+	{
+		if (uploaded_bytes >= MAX_UPLOAD_BYTES_PER_UPDATE)
+			break;
+
+		uint32_t level = texture->wanted_level;
+		VkDeviceSize bytes = get_level_bytes(*texture, level, texture->resident_level);
+
+		if (resident_bytes + bytes > memory_budget)
+			make_room(resident_bytes + bytes - memory_budget, *texture);
+
+		// The finest levels are left out until the rest fits
+		while (level < texture->resident_level && resident_bytes + get_level_bytes(*texture, level, texture->resident_level) > memory_budget)
+			level++;
+
+		if (level == texture->resident_level)
+			continue;
+
+		uploaded_bytes += get_level_bytes(*texture, level, texture->resident_level);
+		set_resident_level(*texture, level);
+	}
+
+	// Textures that got levels and lost some to make room for another one in the same update are in there twice
+	std::sort(changed_textures.begin(), changed_textures.end());
+	changed_textures.erase(std::unique(changed_textures.begin(), changed_textures.end()), changed_textures.end());
+
+	return changed_textures;
+}
+
+VkImageView TextureStreamer::get_image_view(uint32_t texture) const
+{
+	return textures[texture].image_view != VK_NULL_HANDLE ? textures[texture].image_view : placeholder_image_view;
+}
+
+void TextureStreamer::loader_loop()
+{
+	TRACE_THREAD_NAME("Texture loader");
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		load_requested.wait(lock, [this] { return stopping || !load_requests.empty(); });
+
+		if (stopping)
+			return;
+
+		std::vector<Load_Request> requests;
+		requests.swap(load_requests);
+
+		lock.unlock();
+
+		std::vector<Load_Result> results(requests.size());
+
+		// Errors are kept per texture, update reports them on the main thread
+		decode_pool.run(static_cast<uint32_t>(requests.size()), [&](uint32_t task_index, uint32_t)
+			{
+				results[task_index].texture = requests[task_index].texture;
+
+				try
+				{
+					load_texture_data(requests[task_index].image_path, results[task_index].data);
+				}
+				catch (const std::exception& e)
+				{
+					results[task_index].error = "Failed to load " + requests[task_index].image_path + ": " + e.what();
+				}
+			});
+
+		lock.lock();
+
+		for (Load_Result& result : results)
+			load_results.push_back(std::move(result));
+	}
+}
+
+void TextureStreamer::load_texture_data(const std::string& image_path, Texture_Data& texture)
+{
+	TRACE_SCOPE("TextureStreamer::load_texture_data");
+
+	// A KTX2 file next to the image replaces it, with the format and the mip maps it was made with
+	std::string ktx2_path = TextureLoader::get_ktx2_path(image_path);
+
+	if (TextureLoader::load_ktx2(ktx2_path, texture) && !is_format_supported(texture.format))
+	{
+		if (TextureLoader::can_decompress(texture.format))
+		{
+			// Still saves the mip generation, only the memory savings are lost
+			TextureLoader::decompress(texture);
+		}
+		else
+		{
+			std::cout << "The GPU can't sample the format of " << ktx2_path << ", loading " << image_path << " instead.\n";
+			texture = Texture_Data{};
+		}
+	}
+
+	// Otherwise the image, with the mip chain cooked on the CPU once and cached
+	if (texture.levels.empty())
+		TextureCooker::load_texture(image_path, texture);
+}
+
+bool TextureStreamer::is_format_supported(VkFormat format)
+{
+	VkFormatProperties format_properties;
+	vkGetPhysicalDeviceFormatProperties(physical_device, format, &format_properties);
+
+	// The texture sampler filters linearly
+	VkFormatFeatureFlags required_features = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+	return (format_properties.optimalTilingFeatures & required_features) == required_features;
+}
+
+void TextureStreamer::set_resident_level(Texture& texture, uint32_t level)
+{
+	if (level == texture.resident_level)
+		return;
+
+	uint32_t level_count = static_cast<uint32_t>(texture.data.levels.size());
+
+	VkImage image;
+	MemoryAllocation allocation;
+	VkImageView image_view;
+
+	create_image(texture.data, level, image, allocation, image_view);
+	record_level_copies(texture.data, level, image, texture.image, texture.resident_level);
+
+	// Frames in flight may still sample the old image, and the descriptors of the other frames point at it until
+	// they are written again
+	if (texture.image != VK_NULL_HANDLE)
+		retired_images.push_back(Retired_Image{ texture.image, texture.allocation, texture.image_view, frame_index + frames_in_flight });
+
+	resident_bytes -= get_level_bytes(texture, texture.resident_level, level_count);
+	resident_bytes += get_level_bytes(texture, level, level_count);
+
+	texture.image = image;
+	texture.allocation = allocation;
+	texture.image_view = image_view;
+	texture.resident_level = level;
+
+	changed_textures.push_back(static_cast<uint32_t>(&texture - textures.data()));
+}
+
+void TextureStreamer::make_room(VkDeviceSize bytes, const Texture& streamed_texture)
+{
+	std::vector<Texture*> candidates;
+
+	for (Texture& texture : textures)
+	{
+		if (&texture != &streamed_texture && !texture.data.levels.empty() && texture.resident_level < texture.wanted_level)
+			candidates.push_back(&texture);
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const Texture* a, const Texture* b)
+		{
+			return a->last_used_frame < b->last_used_frame;
+		});
+
+	VkDeviceSize freed_bytes = 0;
+
+	for (Texture* texture : candidates)
+	{
+		if (freed_bytes >= bytes)
+			break;
+
+		freed_bytes += get_level_bytes(*texture, texture->resident_level, texture->wanted_level);
+		set_resident_level(*texture, texture->wanted_level);
+	}
+}
+
+VkDeviceSize TextureStreamer::get_level_bytes(const Texture& texture, uint32_t first_level, uint32_t end_level)
+{
+	VkDeviceSize bytes = 0;
+
+	for (uint32_t i = first_level; i < end_level; i++)
+		bytes += texture.data.levels[i].size;
+
+	return bytes;
+}
+
+void TextureStreamer::create_image(const Texture_Data& data, uint32_t first_level, VkImage& image, MemoryAllocation& allocation, VkImageView& image_view)
+{
+	uint32_t mip_levels = static_cast<uint32_t>(data.levels.size()) - first_level;
+
+	VkImageCreateInfo image_info{};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.extent.width = data.levels[first_level].width;
+	image_info.extent.height = data.levels[first_level].height;
+	image_info.extent.depth = 1;
+	image_info.mipLevels = mip_levels;
+	image_info.arrayLayers = 1;
+	image_info.format = data.format;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	// Copied from when the resident levels change again
+	image_info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+
+	if (vkCreateImage(device, &image_info, nullptr, &image) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create a texture image.");
+
+	allocation = allocator->allocate_for_image(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+
+	VkImageViewCreateInfo view_info{};
+	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image = image;
+	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format = data.format;
+	view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	view_info.subresourceRange.baseMipLevel = 0;
+	view_info.subresourceRange.levelCount = mip_levels;
+	view_info.subresourceRange.baseArrayLayer = 0;
+	view_info.subresourceRange.layerCount = 1;
+
+	if (vkCreateImageView(device, &view_info, nullptr, &image_view) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create texture image view.");
+}
+
+void TextureStreamer::record_level_copies(const Texture_Data& data, uint32_t first_level, VkImage image, VkImage old_image, uint32_t old_first_level)
+{
+	// The old image belongs to the graphics queue family, so the whole change is recorded there instead of
+	// going through the transfer queue and an ownership transfer
+	VkCommandBuffer command_buffer = upload_context->get_graphics_command_buffer();
+
+	uint32_t level_count = static_cast<uint32_t>(data.levels.size());
+	uint32_t first_copied_level = std::max(first_level, old_first_level);
+
+	std::array<VkImageMemoryBarrier, 2> barriers{};
+
+	for (VkImageMemoryBarrier& barrier : barriers)
+	{
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+	}
+
+	barriers[0].image = image;
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[0].srcAccessMask = 0;
+	barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	// Earlier frames sample the old image, the copy waits for them
+	barriers[1].image = old_image;
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barriers[1].srcAccessMask = 0;
+	barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	uint32_t barrier_count = old_image != VK_NULL_HANDLE ? 2 : 1;
+
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+		barrier_count, barriers.data());
+
+	// The levels the old image doesn't have come from the decoded data
+	if (first_level < std::min(old_first_level, level_count))
+	{
+		uint32_t end_level = std::min(old_first_level, level_count);
+		size_t begin_offset = SIZE_MAX;
+		size_t end_offset = 0;
+
+		for (uint32_t i = first_level; i < end_level; i++)
+		{
+			begin_offset = std::min(begin_offset, data.levels[i].offset);
+			end_offset = std::max(end_offset, data.levels[i].offset + data.levels[i].size);
+		}
+
+		VkBuffer staging_buffer = upload_context->create_staging_buffer(data.data.data() + begin_offset, end_offset - begin_offset);
+		std::vector<VkBufferImageCopy> regions(end_level - first_level);
+
+		for (uint32_t i = first_level; i < end_level; i++)
+		{
+			VkBufferImageCopy& region = regions[i - first_level];
+			region.bufferOffset = data.levels[i].offset - begin_offset;
+			region.bufferRowLength = 0;
+			region.bufferImageHeight = 0;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = i - first_level;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset = { 0, 0, 0 };
+			region.imageExtent = { data.levels[i].width, data.levels[i].height, 1 };
+		}
+
+		vkCmdCopyBufferToImage(command_buffer, staging_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()), regions.data());
+	}
+
+	// The rest is copied over from the old image
+	if (old_image != VK_NULL_HANDLE && first_copied_level < level_count)
+	{
+		std::vector<VkImageCopy> regions(level_count - first_copied_level);
+
+		for (uint32_t i = first_copied_level; i < level_count; i++)
+		{
+			VkImageCopy& region = regions[i - first_copied_level];
+			region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.srcSubresource.mipLevel = i - old_first_level;
+			region.srcSubresource.baseArrayLayer = 0;
+			region.srcSubresource.layerCount = 1;
+			region.srcOffset = { 0, 0, 0 };
+			region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.dstSubresource.mipLevel = i - first_level;
+			region.dstSubresource.baseArrayLayer = 0;
+			region.dstSubresource.layerCount = 1;
+			region.dstOffset = { 0, 0, 0 };
+			region.extent = { data.levels[i].width, data.levels[i].height, 1 };
+		}
+
+		vkCmdCopyImage(command_buffer, old_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()), regions.data());
+	}
+
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	// Frames recorded before their descriptors are written again still sample the old image
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[1].srcAccessMask = 0;
+	barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+		barrier_count, barriers.data());
+}
+
+void TextureStreamer::destroy_retired_images(bool all)
+{
+	auto is_unused = [&](const Retired_Image& retired_image) { return all || frame_index >= retired_image.destroy_frame; };
+
+	for (Retired_Image& retired_image : retired_images)
+	{
+		if (!is_unused(retired_image))
+			continue;
+
+		vkDestroyImageView(device, retired_image.image_view, nullptr);
+		vkDestroyImage(device, retired_image.image, nullptr);
+		allocator->free(retired_image.allocation);
+	}
+
+	retired_images.erase(std::remove_if(retired_images.begin(), retired_images.end(), is_unused), retired_images.end());
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "MemoryAllocator.hpp"
+#include "TextureLoader.hpp"
+#include "ThreadPool.hpp"
+#include "UploadContext.hpp"
+
+// Loads textures in the background and keeps only the mip levels that are needed on the GPU.
+//
+// Images are decoded (or their cooked files read) by a pool of worker threads, so adding textures never blocks.
+// Once a texture is decoded its small levels go up first and it can be drawn right away, until then it shows a
+// 1x1 placeholder. Finer levels are streamed in as the renderer asks for them with request_detail, and when the
+// resident levels of all the textures would go over the memory budget the levels nobody asked for recently are
+// dropped, least recently used texture first.
+//
+// Without sparse residency an image can't grow or shrink, so changing the resident levels creates a new image with
+// the new level count. The levels both have are copied on the GPU and the old image is destroyed once no frame in
+// flight can use it anymore. The decoded levels stay in system memory to be streamed from.
+class TextureStreamer
+{
+public:
+
+	void init(VkPhysicalDevice physical_device, VkDevice device, MemoryAllocator* allocator, UploadContext* upload_context,
+		uint32_t frames_in_flight, VkDeviceSize memory_budget, uint32_t decode_thread_count);
+	void cleanup();
+
+	// Returns the index of the texture, it's decoded in the background. See load_texture_data for the files it's read from.
+	uint32_t add_texture(const std::string& image_path);
+	// A texture made in memory, it goes up with the next update
+	uint32_t add_texture(Texture_Data data);
+
+	// The texture covers about this many pixels on the screen this frame, the largest request of a frame wins.
+	// Textures without requests keep only their small levels when memory runs out.
+	void request_detail(uint32_t texture, float screen_size);
+	// Call once per frame, after the fence of the frame was waited on. Uploads the textures that finished decoding and
+	// streams levels in and out, the copies go into the current upload batch. Returns the textures whose image view
+	// changed, sorted, their descriptors have to be written again before the next draw.
+	// A texture that failed to load is reported and keeps the placeholder.
+	const std::vector<uint32_t>& update();
+
+	// The placeholder until the texture has levels on the GPU
+	VkImageView get_image_view(uint32_t texture) const;
+	VkDeviceSize get_resident_bytes() const { return resident_bytes; }
+
+	// Levels this size or smaller are uploaded together as soon as the texture is decoded and are never dropped
+	static const uint32_t MIN_RESIDENT_SIZE = 128;
+	// Streaming stops for the frame after this much texture data was uploaded, at least one texture is always streamed
+	static const VkDeviceSize MAX_UPLOAD_BYTES_PER_UPDATE = 16 * 1024 * 1024;
+
+private:
+
+	struct Texture
+	{
+		// Empty until the texture is decoded
+		Texture_Data data;
+		VkImage image = VK_NULL_HANDLE;
+		MemoryAllocation allocation;
+		VkImageView image_view = VK_NULL_HANDLE;
+		// Finest level on the GPU, level 0 of the image. data.levels.size() when nothing is resident.
+		uint32_t resident_level = 0;
+		// Finest level that's always resident
+		uint32_t tail_level = 0;
+		// Finest level requested this frame, tail_level without requests
+		uint32_t wanted_level = 0;
+		uint64_t last_used_frame = 0;
+		// Screen size of the largest request this frame
+		float screen_size = 0.0f;
+	};
+
+	struct Load_Request
+	{
+		uint32_t texture;
+		std::string image_path;
+	};
+
+	struct Load_Result
+	{
+		uint32_t texture;
+		Texture_Data data;
+		// Empty when the texture loaded
+		std::string error;
+	};
+
+	// Destroyed once frame_index reaches destroy_frame
+	struct Retired_Image
+	{
+		VkImage image;
+		MemoryAllocation allocation;
+		VkImageView image_view;
+		uint64_t destroy_frame;
+	};
+
+	VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+	UploadContext* upload_context = nullptr;
+	uint32_t frames_in_flight = 0;
+	VkDeviceSize memory_budget = 0;
+
+	std::vector<Texture> textures;
+	std::vector<Retired_Image> retired_images;
+	VkDeviceSize resident_bytes = 0;
+	uint64_t frame_index = 0;
+	// Textures whose image view changed during the update
+	std::vector<uint32_t> changed_textures;
+
+	VkImage placeholder_image = VK_NULL_HANDLE;
+	MemoryAllocation placeholder_allocation;
+	VkImageView placeholder_image_view = VK_NULL_HANDLE;
+
+	// The loader thread hands the queued requests to the decode pool and waits for them, ThreadPool::run blocks
+	ThreadPool decode_pool;
+	std::thread loader_thread;
+	std::mutex mutex;
+	std::condition_variable load_requested;
+	std::vector<Load_Request> load_requests;
+	std::vector<Load_Result> load_results;
+	bool stopping = false;
+
+	void loader_loop();
+	// The authored KTX2 file of the image if the GPU can sample its format (or it can be decompressed),
+	// otherwise the image with its cooked mip chain, see TextureCooker
+	void load_texture_data(const std::string& image_path, Texture_Data& texture);
+	bool is_format_supported(VkFormat format);
+
+	// Sets the finest resident level of the texture, in both directions
+	void set_resident_level(Texture& texture, uint32_t level);
+	// Drops levels above the wanted ones, least recently used texture first, until bytes are free in the budget
+	void make_room(VkDeviceSize bytes, const Texture& streamed_texture);
+	static VkDeviceSize get_level_bytes(const Texture& texture, uint32_t first_level, uint32_t end_level);
+
+	// An image for the levels of data from first_level on, with a view of all of them
+	void create_image(const Texture_Data& data, uint32_t first_level, VkImage& image, MemoryAllocation& allocation, VkImageView& image_view);
+	// Fills image with the levels from first_level on. The ones old_image has (its level 0 being old_first_level) are copied
+	// from it, the others are uploaded. Leaves both images ready for sampling.
+	void record_level_copies(const Texture_Data& data, uint32_t first_level, VkImage image, VkImage old_image, uint32_t old_first_level);
+	void destroy_retired_images(bool all);
+};
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "TextureTable.hpp"
+
+void TextureTable::init(VkDevice device, uint32_t frames_in_flight)
+{
+	this->device = device;
+
+	VkDescriptorSetLayoutBinding binding{};
+	binding.binding = 0;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	binding.descriptorCount = MAX_TEXTURES;
+	binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	binding.pImmutableSamplers = nullptr;
+
+	// Only the entries the draws use have to be written
+	VkDescriptorBindingFlags binding_flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info{};
+	binding_flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	binding_flags_info.bindingCount = 1;
+	binding_flags_info.pBindingFlags = &binding_flags;
+
+	VkDescriptorSetLayoutCreateInfo layout_info{};
+	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.pNext = &binding_flags_info;
+	layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layout_info.bindingCount = 1;
+	layout_info.pBindings = &binding;
+
+	if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &layout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create texture table descriptor set layout.");
+
+	VkDescriptorPoolSize pool_size{};
+	pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	pool_size.descriptorCount = MAX_TEXTURES * frames_in_flight;
+
+	VkDescriptorPoolCreateInfo pool_info{};
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	pool_info.poolSizeCount = 1;
+	pool_info.pPoolSizes = &pool_size;
+	pool_info.maxSets = frames_in_flight;
+
+	if (vkCreateDescriptorPool(device, &pool_info, nullptr, &descriptor_pool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create texture table descriptor pool.");
+
+	std::vector<VkDescriptorSetLayout> layouts(frames_in_flight, layout);
+
+	VkDescriptorSetAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorPool = descriptor_pool;
+	alloc_info.descriptorSetCount = frames_in_flight;
+	alloc_info.pSetLayouts = layouts.data();
+
+	descriptor_sets.resize(frames_in_flight);
+
+	if (vkAllocateDescriptorSets(device, &alloc_info, descriptor_sets.data()) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate texture table descriptor sets.");
+
+	pending_writes.assign(frames_in_flight, {});
+}
+
+void TextureTable::cleanup()
+{
+	// Frees the sets too
+	vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+	vkDestroyDescriptorSetLayout(device, layout, nullptr);
+
+	descriptor_sets.clear();
+	entries.clear();
+	pending_writes.clear();
+}
+
+uint32_t TextureTable::add_texture(VkImageView image_view, VkSampler sampler)
+{
+	if (entries.size() == MAX_TEXTURES)
+		throw std::runtime_error("The texture table is full.");
+
+	uint32_t index = static_cast<uint32_t>(entries.size());
+	entries.push_back(Entry{ image_view, sampler });
+
+	for (std::vector<uint32_t>& frame_writes : pending_writes)
+		frame_writes.push_back(index);
+
+	return index;
+}
+
+void TextureTable::set_texture(uint32_t index, VkImageView image_view, VkSampler sampler)
+{
+	entries[index] = Entry{ image_view, sampler };
+
+	for (std::vector<uint32_t>& frame_writes : pending_writes)
+		frame_writes.push_back(index);
+}
+
+void TextureTable::update(uint32_t frame)
+{
+	std::vector<uint32_t>& frame_writes = pending_writes[frame];
+
+	if (frame_writes.empty())
+		return;
+
+	// A texture that changed more than once since the last update is written once, with what it is now
+	std::sort(frame_writes.begin(), frame_writes.end());
+	frame_writes.erase(std::unique(frame_writes.begin(), frame_writes.end()), frame_writes.end());
+
+	std::vector<VkDescriptorImageInfo> image_infos(frame_writes.size());
+	std::vector<VkWriteDescriptorSet> descriptor_writes(frame_writes.size());
+
+	for (size_t i = 0; i < frame_writes.size(); i++)
+	{
+		const Entry& entry = entries[frame_writes[i]];
+
+		image_infos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		image_infos[i].imageView = entry.image_view;
+		image_infos[i].sampler = entry.sampler;
+
+		descriptor_writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptor_writes[i].dstSet = descriptor_sets[frame];
+		descriptor_writes[i].dstBinding = 0;
+		descriptor_writes[i].dstArrayElement = frame_writes[i];
+		descriptor_writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptor_writes[i].descriptorCount = 1;
+		descriptor_writes[i].pImageInfo = &image_infos[i];
+	}
+
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptor_writes.size()), descriptor_writes.data(), 0, nullptr);
+
+	frame_writes.clear();
+}
+
+bool TextureTable::is_supported(const VkPhysicalDeviceVulkan12Features& features)
+{
+	return features.runtimeDescriptorArray && features.descriptorBindingPartiallyBound
+		&& features.descriptorBindingSampledImageUpdateAfterBind && features.shaderSampledImageArrayNonUniformIndexing;
+}
+
+void TextureTable::enable_features(VkPhysicalDeviceVulkan12Features& features)
+{
+	features.runtimeDescriptorArray = VK_TRUE;
+	features.descriptorBindingPartiallyBound = VK_TRUE;
+	features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+}
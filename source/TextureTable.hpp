@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Every texture in one big descriptor array (bindless), shaders pick theirs with the index stored with the draw.
+// Adding a texture is one descriptor write, the set layout, the sets and the pipelines never change.
+//
+// The array is update-after-bind, writing a descriptor doesn't invalidate the command buffers the set is bound in,
+// so cached command buffers stay valid while textures are added or streamed. A descriptor still can't change while
+// a frame using it executes, so there is a set per frame in flight and every change is written to each of them
+// on that frame's turn.
+class TextureTable
+{
+public:
+
+	void init(VkDevice device, uint32_t frames_in_flight);
+	void cleanup();
+
+	// Returns the index shaders use for the texture, throws when the table is full
+	uint32_t add_texture(VkImageView image_view, VkSampler sampler);
+	void set_texture(uint32_t index, VkImageView image_view, VkSampler sampler);
+	// Writes the textures that changed since the last update of the frame, call after its fence was waited on
+	void update(uint32_t frame);
+
+	uint32_t get_texture_count() const { return static_cast<uint32_t>(entries.size()); }
+	VkDescriptorSetLayout get_layout() const { return layout; }
+	VkDescriptorSet get_descriptor_set(uint32_t frame) const { return descriptor_sets[frame]; }
+
+	// The Vulkan 1.2 features the table needs
+	static bool is_supported(const VkPhysicalDeviceVulkan12Features& features);
+	static void enable_features(VkPhysicalDeviceVulkan12Features& features);
+
+	// Devices with the features above allow at least 500000 update-after-bind sampled images per stage
+	static const uint32_t MAX_TEXTURES = 4096;
+
+private:
+
+	struct Entry
+	{
+		VkImageView image_view;
+		VkSampler sampler;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> descriptor_sets;
+
+	std::vector<Entry> entries;
+	// Indices of the entries that changed since the set of each frame was updated
+	std::vector<std::vector<uint32_t>> pending_writes;
+};
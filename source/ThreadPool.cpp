@@ -0,0 +1,103 @@
+#include <string>
+
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+
+void ThreadPool::init(uint32_t thread_count)
+{
+	stopping = false;
+
+	for (uint32_t i = 0; i < thread_count; i++)
+		threads.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+void ThreadPool::cleanup()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	work_available.notify_all();
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	threads.clear();
+}
+
+void ThreadPool::run(uint32_t task_count, const Task& task)
+{
+	if (task_count == 0)
+		return;
+
+	if (threads.empty())
+	{
+		for (uint32_t i = 0; i < task_count; i++)
+			task(i, 0);
+
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	current_task = &task;
+	this->task_count = task_count;
+	next_task = 0;
+	finished_tasks = 0;
+	task_exception = nullptr;
+
+	work_available.notify_all();
+	work_finished.wait(lock, [this] { return finished_tasks == this->task_count; });
+
+	current_task = nullptr;
+
+	if (task_exception)
+	{
+		std::exception_ptr exception = task_exception;
+		task_exception = nullptr;
+		std::rethrow_exception(exception);
+	}
+}
+
+void ThreadPool::worker_loop(uint32_t thread_index)
+{
+	TRACE_THREAD_NAME("Worker " + std::to_string(thread_index));
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		work_available.wait(lock, [this] { return stopping || next_task < task_count; });
+
+		if (stopping)
+			return;
+
+		while (next_task < task_count)
+		{
+			uint32_t task_index = next_task++;
+			const Task& task = *current_task;
+
+			lock.unlock();
+
+			std::exception_ptr exception;
+
+			try
+			{
+				task(task_index, thread_index);
+			}
+			catch (...)
+			{
+				exception = std::current_exception();
+			}
+
+			lock.lock();
+
+			if (exception && !task_exception)
+				task_exception = exception;
+
+			if (++finished_tasks == task_count)
+				work_finished.notify_all();
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run an indexed batch of tasks and block the caller until all of them are done.
+// Every worker has a stable thread index, so tasks can use per-thread resources (e.g. command pools)
+// without any locking.
+class ThreadPool
+{
+public:
+
+	typedef std::function<void(uint32_t task_index, uint32_t thread_index)> Task;
+
+	// thread_count of 0 runs every task on the calling thread
+	void init(uint32_t thread_count);
+	void cleanup();
+
+	// Runs task for every task_index in [0, task_count). The first exception thrown by a task is rethrown here.
+	void run(uint32_t task_count, const Task& task);
+
+	// Number of distinct thread indices passed to the tasks
+	uint32_t get_thread_count() const { return threads.empty() ? 1 : static_cast<uint32_t>(threads.size()); }
+
+private:
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable work_finished;
+
+	const Task* current_task = nullptr;
+	uint32_t task_count = 0;
+	uint32_t next_task = 0;
+	uint32_t finished_tasks = 0;
+	bool stopping = false;
+	std::exception_ptr task_exception;
+
+	void worker_loop(uint32_t thread_index);
+};
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "Json.hpp"
+#include "Trace.hpp"
+
+// Every thread that traced, its buffer is kept after the thread exits so its events can still be written
+struct Trace::Registry
+{
+	std::mutex mutex;
+	std::vector<std::unique_ptr<Thread_Buffer>> buffers;
+};
+
+Trace::Registry& Trace::get_registry()
+{
+	static Registry registry;
+	return registry;
+}
+
+uint64_t Trace::get_time()
+{
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void Trace::record(const char* name, uint64_t begin, uint64_t end)
+{
+	Thread_Buffer& buffer = get_thread_buffer();
+
+	// This thread is the only writer, so the count doesn't change under it
+	uint64_t count = buffer.event_count.load(std::memory_order_relaxed);
+	buffer.events[count % EVENTS_PER_THREAD] = { name, begin, end };
+	buffer.event_count.store(count + 1, std::memory_order_release);
+}
+
+Trace::Thread_Buffer& Trace::get_thread_buffer()
+{
+	thread_local Thread_Buffer* thread_buffer = nullptr;
+
+	if (thread_buffer == nullptr)
+	{
+		Registry& registry = get_registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+
+		std::unique_ptr<Thread_Buffer> buffer(new Thread_Buffer());
+		buffer->thread_index = static_cast<uint32_t>(registry.buffers.size());
+		buffer->name = "Thread " + std::to_string(buffer->thread_index);
+		buffer->events.reset(new Event[EVENTS_PER_THREAD]);
+
+		thread_buffer = buffer.get();
+		registry.buffers.push_back(std::move(buffer));
+	}
+
+	return *thread_buffer;
+}
+
+void Trace::set_thread_name(const std::string& name)
+{
+	Thread_Buffer& buffer = get_thread_buffer();
+
+	std::lock_guard<std::mutex> lock(get_registry().mutex);
+	buffer.name = name;
+}
+
+// https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+// Every scope is a complete ("X") event, the viewer nests them by time
+void Trace::write_chrome_json(const std::string& path)
+{
+	std::ofstream file(path);
+
+	if (!file)
+		throw std::runtime_error("Failed to open " + path + " for writing.");
+
+	Registry& registry = get_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	bool first = true;
+	std::vector<Event> events;
+
+	for (const std::unique_ptr<Thread_Buffer>& buffer : registry.buffers)
+	{
+		file << (first ? "\n" : ",\n");
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_index
+			<< ",\"args\":{\"name\":\"" << Json::escape(buffer->name) << "\"}}";
+		first = false;
+
+		uint64_t end_index = buffer->event_count.load(std::memory_order_acquire);
+		uint64_t begin_index = end_index > EVENTS_PER_THREAD ? end_index - EVENTS_PER_THREAD : 0;
+
+		events.clear();
+
+		for (uint64_t i = begin_index; i < end_index; i++)
+			events.push_back(buffer->events[i % EVENTS_PER_THREAD]);
+
+		// The thread can still be tracing, the events it wrote meanwhile replaced the oldest ones that were copied.
+		// It may also be in the middle of writing the event after the count, over the slot of the oldest one that's left.
+		uint64_t overwritten_index = buffer->event_count.load(std::memory_order_acquire) + 1;
+		size_t skipped = 0;
+
+		if (overwritten_index > EVENTS_PER_THREAD && overwritten_index - EVENTS_PER_THREAD > begin_index)
+			skipped = static_cast<size_t>(std::min<uint64_t>(overwritten_index - EVENTS_PER_THREAD - begin_index, events.size()));
+
+		for (size_t i = skipped; i < events.size(); i++)
+		{
+			const Event& event = events[i];
+
+			file << ",\n{\"name\":\"" << Json::escape(event.name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_index
+				<< ",\"ts\":" << event.begin / 1000.0 << ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+		}
+	}
+
+	file << "\n]}\n";
+
+	if (!file)
+		throw std::runtime_error("Failed to write " + path + ".");
+}
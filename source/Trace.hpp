@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Scoped CPU trace markers, written as Chrome trace JSON (chrome://tracing, https://ui.perfetto.dev).
+//
+// The markers are only compiled in when VULKAN_ENGINE_TRACING is defined, which the Tracing configuration does. Otherwise
+// the macros expand to nothing and cost nothing. Every thread records into its own ring buffer of the last EVENTS_PER_THREAD
+// events, without any locking: a scope takes two clock reads and one store. The rings are only read when the trace is written.
+//
+//	void ModelLoader::load_model()
+//	{
+//		TRACE_SCOPE("ModelLoader::load_model");
+//		...
+//		{
+//			TRACE_SCOPE("Parse");
+//			...
+//		}
+//	}
+//
+// Names have to outlive the trace, e.g. string literals.
+#ifdef VULKAN_ENGINE_TRACING
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) Trace::set_thread_name(name)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_THREAD_NAME(name)
+#endif // VULKAN_ENGINE_TRACING
+
+class Trace
+{
+public:
+
+	class Scope
+	{
+	public:
+
+		explicit Scope(const char* name) : name(name), begin(get_time()) {}
+		~Scope() { record(name, begin, get_time()); }
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+
+		const char* name;
+		uint64_t begin;
+	};
+
+	// Older events of a thread are overwritten
+	static const uint32_t EVENTS_PER_THREAD = 1 << 16;
+
+	static constexpr bool is_enabled()
+	{
+#ifdef VULKAN_ENGINE_TRACING
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// Shown instead of the thread index in the trace
+	static void set_thread_name(const std::string& name);
+	// Writes the events in the rings of all the threads, including the ones that already exited. Other threads can keep
+	// tracing meanwhile, the events they overwrite while the rings are read are left out.
+	static void write_chrome_json(const std::string& path);
+
+private:
+
+	struct Event
+	{
+		const char* name;
+		// Nanoseconds since the first traced event
+		uint64_t begin;
+		uint64_t end;
+	};
+
+	// Only the owning thread writes events, the count is published after the event is written
+	struct Thread_Buffer
+	{
+		uint32_t thread_index = 0;
+		std::string name;
+		std::unique_ptr<Event[]> events;
+		std::atomic<uint64_t> event_count{ 0 };
+	};
+
+	// Every thread that traced, defined in Trace.cpp
+	struct Registry;
+
+	static Registry& get_registry();
+	static uint64_t get_time();
+	static void record(const char* name, uint64_t begin, uint64_t end);
+	static Thread_Buffer& get_thread_buffer();
+};
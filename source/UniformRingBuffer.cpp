@@ -0,0 +1,57 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "UniformRingBuffer.hpp"
+
+void UniformRingBuffer::init(VkPhysicalDevice physical_device, VkDevice device, MemoryAllocator* allocator, VkDeviceSize frame_size, uint32_t frame_count)
+{
+	this->device = device;
+	this->allocator = allocator;
+
+	// https://vulkan-tutorial.com/en/Uniform_buffers/Descriptor_pool_and_sets#page_Alignment-requirements
+	// Dynamic offsets have to be a multiple of minUniformBufferOffsetAlignment
+	VkPhysicalDeviceProperties properties{};
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	alignment = properties.limits.minUniformBufferOffsetAlignment;
+
+	this->frame_size = (frame_size + alignment - 1) / alignment * alignment;
+
+	VkBufferCreateInfo buffer_info{};
+	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_info.size = this->frame_size * frame_count;
+	buffer_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &buffer_info, nullptr, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create uniform ring buffer.");
+
+	allocation = allocator->allocate_for_buffer(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+
+	begin_frame(0);
+}
+
+void UniformRingBuffer::cleanup()
+{
+	vkDestroyBuffer(device, buffer, nullptr);
+	allocator->free(allocation);
+}
+
+void UniformRingBuffer::begin_frame(uint32_t frame_index)
+{
+	frame_begin = frame_size * frame_index;
+	head = frame_begin;
+}
+
+uint32_t UniformRingBuffer::push(const void* data, VkDeviceSize size)
+{
+	if (head + size > frame_begin + frame_size)
+		throw std::runtime_error("Uniform ring buffer frame region is full.");
+
+	VkDeviceSize offset = head;
+	memcpy(static_cast<char*>(allocation.mapped_data) + offset, data, static_cast<size_t>(size));
+
+	head += (size + alignment - 1) / alignment * alignment;
+
+	return static_cast<uint32_t>(offset);
+}
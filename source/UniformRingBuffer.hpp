@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+#include <vulkan/vulkan.h>
+
+#include "MemoryAllocator.hpp"
+
+// One persistently mapped uniform buffer split into a region per frame in flight.
+// Constants are bump-allocated from the region of the current frame and bound with dynamic offsets
+// (VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC), so there are no map/unmap calls and no buffers per object.
+// A region is only reused after the fence of its frame was waited on.
+class UniformRingBuffer
+{
+public:
+
+	void init(VkPhysicalDevice physical_device, VkDevice device, MemoryAllocator* allocator, VkDeviceSize frame_size, uint32_t frame_count);
+	void cleanup();
+
+	// Starts allocating from the beginning of the region that belongs to frame_index
+	void begin_frame(uint32_t frame_index);
+	// Copies the data into the current frame region and returns the dynamic offset to bind it with
+	uint32_t push(const void* data, VkDeviceSize size);
+
+	template<typename T>
+	uint32_t push(const T& value) { return push(&value, sizeof(T)); }
+
+	VkBuffer get_buffer() const { return buffer; }
+
+private:
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	MemoryAllocation allocation;
+
+	VkDeviceSize alignment = 0;
+	VkDeviceSize frame_size = 0;
+	VkDeviceSize frame_begin = 0;
+	VkDeviceSize head = 0;
+};
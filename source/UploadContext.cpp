@@ -0,0 +1,340 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "UploadContext.hpp"
+
+void UploadContext::init(VkDevice device, VkQueue graphics_queue, uint32_t graphics_family, VkQueue transfer_queue, uint32_t transfer_family,
+	MemoryAllocator* allocator)
+{
+	this->device = device;
+	this->graphics_queue = graphics_queue;
+	this->graphics_family = graphics_family;
+	this->transfer_queue = transfer_queue;
+	this->transfer_family = transfer_family;
+	this->allocator = allocator;
+
+	graphics_command_pool = create_command_pool(graphics_family);
+
+	if (has_dedicated_transfer_queue())
+		transfer_command_pool = create_command_pool(transfer_family);
+}
+
+void UploadContext::cleanup()
+{
+	if (is_recording)
+		submit();
+
+	wait_all();
+
+	for (auto& batch : free_batches)
+	{
+		vkDestroyFence(device, batch.fence, nullptr);
+
+		if (batch.transfer_finished != VK_NULL_HANDLE)
+			vkDestroySemaphore(device, batch.transfer_finished, nullptr);
+	}
+
+	free_batches.clear();
+
+	vkDestroyCommandPool(device, graphics_command_pool, nullptr);
+
+	if (transfer_command_pool != VK_NULL_HANDLE)
+		vkDestroyCommandPool(device, transfer_command_pool, nullptr);
+}
+
+VkCommandBuffer UploadContext::get_transfer_command_buffer()
+{
+	if (!is_recording)
+		begin_batch();
+
+	return recording_batch.transfer_command_buffer;
+}
+
+VkCommandBuffer UploadContext::get_graphics_command_buffer()
+{
+	if (!is_recording)
+		begin_batch();
+
+	return recording_batch.graphics_command_buffer;
+}
+
+VkBuffer UploadContext::create_staging_buffer(const void* data, VkDeviceSize size)
+{
+	if (!is_recording)
+		begin_batch();
+
+	VkBufferCreateInfo buffer_info{};
+	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_info.size = size;
+	buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer;
+	if (vkCreateBuffer(device, &buffer_info, nullptr, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create staging buffer.");
+
+	MemoryAllocation allocation = allocator->allocate_for_buffer(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+
+	memcpy(allocation.mapped_data, data, static_cast<size_t>(size));
+
+	recording_batch.staging_buffers.emplace_back(buffer, allocation);
+
+	return buffer;
+}
+
+// https://www.khronos.org/registry/vulkan/specs/1.2-extensions/html/vkspec.html#synchronization-queue-transfers
+void UploadContext::transfer_buffer_ownership(VkBuffer buffer)
+{
+	if (!has_dedicated_transfer_queue())
+		return;
+
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = transfer_family;
+	barrier.dstQueueFamilyIndex = graphics_family;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+
+	// Release on the transfer queue, the destination access is ignored here
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(get_transfer_command_buffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	// Acquire on the graphics queue, it runs after the semaphore wait so the source access is ignored
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	vkCmdPipelineBarrier(get_graphics_command_buffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void UploadContext::transfer_image_ownership(VkImage image, VkImageLayout layout, VkImageAspectFlags aspect_flags)
+{
+	if (!has_dedicated_transfer_queue())
+		return;
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = layout;
+	barrier.newLayout = layout;
+	barrier.srcQueueFamilyIndex = transfer_family;
+	barrier.dstQueueFamilyIndex = graphics_family;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = aspect_flags;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(get_transfer_command_buffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	// The graphics queue continues with blits and layout transitions, so the image is acquired for transfer access
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(get_graphics_command_buffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+UploadToken UploadContext::submit()
+{
+	if (!is_recording)
+		return last_submitted_token;
+
+	// Make the transfer writes available to every command submitted after this batch,
+	// so vertex/index fetches and shader reads later in the queue don't need a CPU wait
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+
+	vkCmdPipelineBarrier(recording_batch.graphics_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	if (vkEndCommandBuffer(recording_batch.graphics_command_buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to record upload command buffer.");
+
+	VkSubmitInfo graphics_submit_info{};
+	graphics_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	graphics_submit_info.commandBufferCount = 1;
+	graphics_submit_info.pCommandBuffers = &recording_batch.graphics_command_buffer;
+
+	VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+	if (has_dedicated_transfer_queue())
+	{
+		if (vkEndCommandBuffer(recording_batch.transfer_command_buffer) != VK_SUCCESS)
+			throw std::runtime_error("Failed to record upload command buffer.");
+
+		VkSubmitInfo transfer_submit_info{};
+		transfer_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		transfer_submit_info.commandBufferCount = 1;
+		transfer_submit_info.pCommandBuffers = &recording_batch.transfer_command_buffer;
+		transfer_submit_info.signalSemaphoreCount = 1;
+		transfer_submit_info.pSignalSemaphores = &recording_batch.transfer_finished;
+
+		if (vkQueueSubmit(transfer_queue, 1, &transfer_submit_info, VK_NULL_HANDLE) != VK_SUCCESS)
+			throw std::runtime_error("Failed to submit upload command buffer to the transfer queue.");
+
+		graphics_submit_info.waitSemaphoreCount = 1;
+		graphics_submit_info.pWaitSemaphores = &recording_batch.transfer_finished;
+		graphics_submit_info.pWaitDstStageMask = &wait_stage;
+	}
+
+	if (vkQueueSubmit(graphics_queue, 1, &graphics_submit_info, recording_batch.fence) != VK_SUCCESS)
+		throw std::runtime_error("Failed to submit upload command buffer.");
+
+	recording_batch.token = ++last_submitted_token;
+	pending_batches.push_back(std::move(recording_batch));
+
+	recording_batch = Batch{};
+	is_recording = false;
+
+	return last_submitted_token;
+}
+
+bool UploadContext::is_complete(UploadToken token)
+{
+	release_completed();
+
+	for (const auto& batch : pending_batches)
+	{
+		if (batch.token == token)
+			return false;
+	}
+
+	return token <= last_submitted_token;
+}
+
+void UploadContext::wait(UploadToken token)
+{
+	for (const auto& batch : pending_batches)
+	{
+		if (batch.token == token)
+		{
+			vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+			break;
+		}
+	}
+
+	release_completed();
+}
+
+void UploadContext::wait_all()
+{
+	for (const auto& batch : pending_batches)
+		vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+
+	release_completed();
+}
+
+void UploadContext::release_completed()
+{
+	for (size_t i = 0; i < pending_batches.size();)
+	{
+		// The graphics submission waits on the transfer one, so its fence covers both
+		if (vkGetFenceStatus(device, pending_batches[i].fence) == VK_SUCCESS)
+		{
+			release_batch(pending_batches[i]);
+			free_batches.push_back(std::move(pending_batches[i]));
+			pending_batches.erase(pending_batches.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+void UploadContext::begin_batch()
+{
+	if (!free_batches.empty())
+	{
+		recording_batch = std::move(free_batches.back());
+		free_batches.pop_back();
+
+		vkResetFences(device, 1, &recording_batch.fence);
+		vkResetCommandBuffer(recording_batch.graphics_command_buffer, 0);
+
+		if (has_dedicated_transfer_queue())
+			vkResetCommandBuffer(recording_batch.transfer_command_buffer, 0);
+	}
+	else
+	{
+		recording_batch.graphics_command_buffer = allocate_command_buffer(graphics_command_pool);
+
+		VkFenceCreateInfo fence_info{};
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		if (vkCreateFence(device, &fence_info, nullptr, &recording_batch.fence) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create upload fence.");
+
+		if (has_dedicated_transfer_queue())
+		{
+			recording_batch.transfer_command_buffer = allocate_command_buffer(transfer_command_pool);
+
+			VkSemaphoreCreateInfo semaphore_info{};
+			semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+			if (vkCreateSemaphore(device, &semaphore_info, nullptr, &recording_batch.transfer_finished) != VK_SUCCESS)
+				throw std::runtime_error("Failed to create upload semaphore.");
+		}
+		else
+		{
+			recording_batch.transfer_command_buffer = recording_batch.graphics_command_buffer;
+		}
+	}
+
+	VkCommandBufferBeginInfo begin_info{};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(recording_batch.graphics_command_buffer, &begin_info);
+
+	if (has_dedicated_transfer_queue())
+		vkBeginCommandBuffer(recording_batch.transfer_command_buffer, &begin_info);
+
+	is_recording = true;
+}
+
+void UploadContext::release_batch(Batch& batch)
+{
+	for (auto& staging_buffer : batch.staging_buffers)
+	{
+		vkDestroyBuffer(device, staging_buffer.first, nullptr);
+		allocator->free(staging_buffer.second);
+	}
+
+	batch.staging_buffers.clear();
+	batch.token = 0;
+}
+
+VkCommandPool UploadContext::create_command_pool(uint32_t queue_family)
+{
+	// Short lived command buffers, the implementation may be able to apply memory allocation optimizations for them
+	VkCommandPoolCreateInfo pool_info{};
+	pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_info.queueFamilyIndex = queue_family;
+	pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	VkCommandPool command_pool;
+	if (vkCreateCommandPool(device, &pool_info, nullptr, &command_pool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create upload command pool.");
+
+	return command_pool;
+}
+
+VkCommandBuffer UploadContext::allocate_command_buffer(VkCommandPool command_pool)
+{
+	VkCommandBufferAllocateInfo alloc_info{};
+	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	alloc_info.commandPool = command_pool;
+	alloc_info.commandBufferCount = 1;
+
+	VkCommandBuffer command_buffer;
+	if (vkAllocateCommandBuffers(device, &alloc_info, &command_buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate upload command buffer.");
+
+	return command_buffer;
+}
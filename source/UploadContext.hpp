@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "MemoryAllocator.hpp"
+
+// Identifies a submitted batch of uploads, 0 is never handed out so it can be used as "nothing to wait for"
+typedef uint64_t UploadToken;
+
+// Records many transfers into one command buffer and submits them together with a fence,
+// instead of submitting every copy separately and stalling on vkQueueWaitIdle.
+// https://vulkan-tutorial.com/en/Vertex_buffers/Staging_buffer#page_Using-a-staging-buffer
+//
+// When the device has a dedicated transfer queue family, copies are recorded into a command buffer for that queue,
+// so big uploads can run next to the rendering. The resources are then handed over to the graphics queue family
+// with a release/acquire barrier pair and the graphics part of the batch waits on a semaphore.
+// Without a dedicated family both command buffers are the same one and no ownership transfers are needed.
+class UploadContext
+{
+public:
+
+	void init(VkDevice device, VkQueue graphics_queue, uint32_t graphics_family, VkQueue transfer_queue, uint32_t transfer_family,
+		MemoryAllocator* allocator);
+	void cleanup();
+
+	// Command buffer for copies, executed on the transfer queue
+	VkCommandBuffer get_transfer_command_buffer();
+	// Command buffer for layout transitions and blits, executed on the graphics queue after the transfers
+	VkCommandBuffer get_graphics_command_buffer();
+	// Creates a host visible buffer filled with data, it's destroyed when the batch it's used in completes
+	VkBuffer create_staging_buffer(const void* data, VkDeviceSize size);
+
+	// Hand a resource written on the transfer queue over to the graphics queue family
+	void transfer_buffer_ownership(VkBuffer buffer);
+	void transfer_image_ownership(VkImage image, VkImageLayout layout, VkImageAspectFlags aspect_flags);
+
+	bool has_dedicated_transfer_queue() const { return graphics_family != transfer_family; }
+
+	// Submits the recorded transfers. Everything submitted to the graphics queue later on sees the uploaded data,
+	// so the token only has to be waited on when the CPU needs to know (e.g. before freeing the source data).
+	UploadToken submit();
+	bool is_complete(UploadToken token);
+	void wait(UploadToken token);
+	void wait_all();
+	// Recycles the command buffers and staging memory of the batches that finished, call it once per frame
+	void release_completed();
+
+private:
+
+	struct Batch
+	{
+		VkCommandBuffer transfer_command_buffer = VK_NULL_HANDLE;
+		VkCommandBuffer graphics_command_buffer = VK_NULL_HANDLE;
+		VkSemaphore transfer_finished = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		UploadToken token = 0;
+		std::vector<std::pair<VkBuffer, MemoryAllocation>> staging_buffers;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueue graphics_queue = VK_NULL_HANDLE;
+	VkQueue transfer_queue = VK_NULL_HANDLE;
+	uint32_t graphics_family = 0;
+	uint32_t transfer_family = 0;
+	VkCommandPool graphics_command_pool = VK_NULL_HANDLE;
+	VkCommandPool transfer_command_pool = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+
+	Batch recording_batch;
+	bool is_recording = false;
+	UploadToken last_submitted_token = 0;
+
+	std::vector<Batch> pending_batches;
+	std::vector<Batch> free_batches;
+
+	void begin_batch();
+	void release_batch(Batch& batch);
+	VkCommandPool create_command_pool(uint32_t queue_family);
+	VkCommandBuffer allocate_command_buffer(VkCommandPool command_pool);
+};
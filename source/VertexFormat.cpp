@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cmath>
+
+#include "VertexFormat.hpp"
+
+static int16_t quantize_snorm16(float value)
+{
+	return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+static uint16_t quantize_unorm16(float value)
+{
+	return static_cast<uint16_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+}
+
+static uint8_t quantize_unorm8(float value)
+{
+	return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+}
+
+Vertex_Quantization Vertex_Quantization::compute(const Vertex* vertices, size_t vertex_count)
+{
+	if (vertex_count == 0)
+		return identity();
+
+	glm::vec3 min_position = vertices[0].pos;
+	glm::vec3 max_position = vertices[0].pos;
+	glm::vec2 min_tex_coord = vertices[0].tex_coord;
+	glm::vec2 max_tex_coord = vertices[0].tex_coord;
+
+	for (size_t i = 0; i < vertex_count; i++)
+	{
+		min_position = glm::min(min_position, vertices[i].pos);
+		max_position = glm::max(max_position, vertices[i].pos);
+		min_tex_coord = glm::min(min_tex_coord, vertices[i].tex_coord);
+		max_tex_coord = glm::max(max_tex_coord, vertices[i].tex_coord);
+	}
+
+	glm::vec3 position_extent = (max_position - min_position) * 0.5f;
+	glm::vec2 tex_coord_extent = max_tex_coord - min_tex_coord;
+
+	// A flat mesh would divide by zero, any scale works for it
+	for (int i = 0; i < 3; i++)
+	{
+		if (position_extent[i] <= 0.0f)
+			position_extent[i] = 1.0f;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (tex_coord_extent[i] <= 0.0f)
+			tex_coord_extent[i] = 1.0f;
+	}
+
+	Vertex_Quantization quantization{};
+	quantization.position_scale = glm::vec4(position_extent, 0.0f);
+	quantization.position_offset = glm::vec4((min_position + max_position) * 0.5f, 0.0f);
+	quantization.tex_coord_transform = glm::vec4(tex_coord_extent.x, tex_coord_extent.y, min_tex_coord.x, min_tex_coord.y);
+
+	return quantization;
+}
+
+Vertex_Quantization Vertex_Quantization::identity()
+{
+	Vertex_Quantization quantization{};
+	quantization.position_scale = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+	quantization.position_offset = glm::vec4(0.0f);
+	quantization.tex_coord_transform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+
+	return quantization;
+}
+
+Compact_Vertex Compact_Vertex::quantize(const Vertex& vertex, const Vertex_Quantization& quantization)
+{
+	Compact_Vertex compact{};
+
+	for (int i = 0; i < 3; i++)
+		compact.pos[i] = quantize_snorm16((vertex.pos[i] - quantization.position_offset[i]) / quantization.position_scale[i]);
+
+	for (int i = 0; i < 3; i++)
+		compact.color[i] = quantize_unorm8(vertex.color[i]);
+
+	compact.color[3] = 255;
+
+	for (int i = 0; i < 2; i++)
+		compact.tex_coord[i] = quantize_unorm16((vertex.tex_coord[i] - quantization.tex_coord_transform[i + 2]) / quantization.tex_coord_transform[i]);
+
+	return compact;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include "ModelLoader.hpp"
+
+// Layout of the vertex buffer, the graphics pipeline is specialized for it
+enum class VertexFormat
+{
+	// Vertex, 32 bytes of floats
+	Full,
+	// Compact_Vertex, 16 bytes
+	Compact
+};
+
+// Maps the quantized attributes of a mesh back to its space, the vertex shader gets it through Draw_Data
+struct Vertex_Quantization
+{
+	// position = position_offset + position_scale * position in [-1, 1]
+	glm::vec4 position_scale;
+	glm::vec4 position_offset;
+	// tex_coord = zw + xy * tex_coord in [0, 1]
+	glm::vec4 tex_coord_transform;
+
+	// Fitted to the bounds of the positions and texture coordinates, so the whole range of the integers is used
+	static Vertex_Quantization compute(const Vertex* vertices, size_t vertex_count);
+	// What the shader gets for full vertices, which aren't quantized
+	static Vertex_Quantization identity();
+};
+
+// Position as 16-bit snorm relative to the mesh bounds, color as 8-bit unorm and texture coordinates as 16-bit unorm
+// relative to their bounds. Half the size of Vertex, the bounds live in Vertex_Quantization.
+struct Compact_Vertex
+{
+	// w is padding, the attribute reads four components to keep the stride and the alignment simple
+	int16_t pos[4];
+	uint8_t color[4];
+	uint16_t tex_coord[2];
+
+	static Compact_Vertex quantize(const Vertex& vertex, const Vertex_Quantization& quantization);
+
+	static VkVertexInputBindingDescription get_binding_description()
+	{
+		VkVertexInputBindingDescription binding_description{};
+		binding_description.binding = 0;
+		binding_description.stride = sizeof(Compact_Vertex);
+		binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return binding_description;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 3> get_attribute_descriptions()
+	{
+		std::array<VkVertexInputAttributeDescription, 3> attribute_descriptions{};
+
+		attribute_descriptions[0].binding = 0;
+		attribute_descriptions[0].location = 0;
+		attribute_descriptions[0].format = VK_FORMAT_R16G16B16A16_SNORM;
+		attribute_descriptions[0].offset = offsetof(Compact_Vertex, pos);
+
+		attribute_descriptions[1].binding = 0;
+		attribute_descriptions[1].location = 1;
+		attribute_descriptions[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+		attribute_descriptions[1].offset = offsetof(Compact_Vertex, color);
+
+		attribute_descriptions[2].binding = 0;
+		attribute_descriptions[2].location = 2;
+		attribute_descriptions[2].format = VK_FORMAT_R16G16_UNORM;
+		attribute_descriptions[2].offset = offsetof(Compact_Vertex, tex_coord);
+
+		return attribute_descriptions;
+	}
+};
+
+static_assert(sizeof(Compact_Vertex) == 16, "Compact_Vertex is meant to be half of Vertex");
@@ -0,0 +1,80 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "Hash.hpp"
+#include "VertexWelder.hpp"
+
+void VertexWelder::reset(size_t expected_vertices)
+{
+	// Kept at most 3/4 full, probe sequences get long quickly above that
+	size_t capacity = 16;
+	while (capacity * 3 / 4 < expected_vertices)
+		capacity *= 2;
+
+	slots.assign(capacity, EMPTY_SLOT);
+	mask = capacity - 1;
+	count = 0;
+}
+
+uint32_t VertexWelder::weld(const Vertex& vertex, std::vector<Vertex>& vertices)
+{
+	if ((count + 1) * 4 > slots.size() * 3)
+		grow(vertices);
+
+	uint64_t vertex_hash = hash(vertex);
+	uint64_t tag = vertex_hash & 0xFFFFFFFF00000000ull;
+
+	for (size_t slot = static_cast<size_t>(vertex_hash) & mask;; slot = (slot + 1) & mask)
+	{
+		uint64_t entry = slots[slot];
+
+		if (entry == EMPTY_SLOT)
+		{
+			if (vertices.size() >= UINT32_MAX)
+				throw std::runtime_error("Too many vertices for 32-bit indices.");
+
+			uint32_t index = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(vertex);
+			slots[slot] = tag | index;
+			count++;
+
+			return index;
+		}
+
+		// The tag rejects almost all the other vertices without touching the vertex array
+		if ((entry & 0xFFFFFFFF00000000ull) == tag)
+		{
+			uint32_t index = static_cast<uint32_t>(entry);
+
+			if (memcmp(&vertices[index], &vertex, sizeof(Vertex)) == 0)
+				return index;
+		}
+	}
+}
+
+void VertexWelder::grow(const std::vector<Vertex>& vertices)
+{
+	std::vector<uint64_t> old_slots;
+	old_slots.swap(slots);
+
+	slots.assign(old_slots.size() * 2, EMPTY_SLOT);
+	mask = slots.size() - 1;
+
+	for (uint64_t entry : old_slots)
+	{
+		if (entry == EMPTY_SLOT)
+			continue;
+
+		size_t slot = static_cast<size_t>(hash(vertices[static_cast<uint32_t>(entry)])) & mask;
+
+		while (slots[slot] != EMPTY_SLOT)
+			slot = (slot + 1) & mask;
+
+		slots[slot] = entry;
+	}
+}
+
+uint64_t VertexWelder::hash(const Vertex& vertex)
+{
+	return Hash::bytes(&vertex, sizeof(Vertex));
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "ModelLoader.hpp"
+
+// Merges identical vertices while building an index buffer.
+// Uses a flat open-addressing table (linear probing) keyed by a 64-bit hash of the raw vertex bytes,
+// so finding or inserting a vertex is a single probe sequence over one contiguous array.
+// Vertices are compared byte by byte, which is what the hash sees as well.
+class VertexWelder
+{
+public:
+
+	// Clears the table and sizes it for expected_vertices distinct vertices (the index count is a safe upper bound)
+	void reset(size_t expected_vertices);
+
+	// Returns the index of the vertex in vertices, appending it if an identical one wasn't welded since the last reset
+	uint32_t weld(const Vertex& vertex, std::vector<Vertex>& vertices);
+
+	size_t get_vertex_count() const { return count; }
+
+private:
+
+	static_assert(std::is_trivially_copyable<Vertex>::value, "Vertices are hashed and compared as raw bytes");
+
+	// Upper 32 bits of the hash and the vertex index, EMPTY_SLOT when unused
+	std::vector<uint64_t> slots;
+	size_t mask = 0;
+	size_t count = 0;
+
+	static constexpr uint64_t EMPTY_SLOT = ~0ull;
+
+	void grow(const std::vector<Vertex>& vertices);
+	static uint64_t hash(const Vertex& vertex);
+};
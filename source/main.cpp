@@ -1,18 +1,241 @@
-﻿#include "ModelLoader.hpp"
+﻿#include <chrono>
+#include <fstream>
+
+#include "Benchmark.hpp"
+#include "ModelLoader.hpp"
 #include "Renderer.hpp"
+#include "TextureCooker.hpp"
+#include "Trace.hpp"
+#include "ThreadPool.hpp"
 #include "Window.hpp"
 
-int main()
+// Binary PPM of RGBA8 pixels, the alpha is dropped
+static void write_ppm(const std::string& path, const std::vector<uint8_t>& pixels, uint32_t width, uint32_t height)
+{
+	std::ofstream file(path, std::ios::binary);
+
+	if (!file)
+		throw std::runtime_error("Failed to open " + path + " for writing.");
+
+	file << "P6\n" << width << " " << height << "\n255\n";
+
+	for (size_t i = 0; i < pixels.size(); i += 4)
+		file.write(reinterpret_cast<const char*>(&pixels[i]), 3);
+
+	if (!file)
+		throw std::runtime_error("Failed to write " + path + ".");
+}
+
+// The modes of the program, see main
+static int run(int argc, char* argv[])
 {
 	// TODO: move this to some config class/file?
 	const uint32_t WIDTH = 1920;
 	const uint32_t HEIGHT = 1080;
 	const std::string WINDOW_NAME = "Game engine";
 
+	// Offline conversion of OBJ files into mesh cache files, without creating a window
+	// VulkanEngine --convert-mesh <input.obj> [output.vmesh]
+	if (argc >= 3 && std::string(argv[1]) == "--convert-mesh")
+	{
+		std::string model_path = argv[2];
+		std::string mesh_path = argc >= 4 ? argv[3] : ModelLoader::get_mesh_cache_path(model_path);
+
+		ThreadPool thread_pool;
+		thread_pool.init(std::thread::hardware_concurrency());
+
+		int result = EXIT_SUCCESS;
+
+		try
+		{
+			ModelLoader::convert_model(model_path, mesh_path, &thread_pool);
+			std::cout << "Converted " << model_path << " to " << mesh_path << std::endl;
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			result = EXIT_FAILURE;
+		}
+
+		thread_pool.cleanup();
+
+		return result;
+	}
+
+	// Offline cooking of an image into a KTX2 file with its full mip chain
+	// VulkanEngine --cook-texture <image> [output.ktx2] [--box]
+	if (argc >= 3 && std::string(argv[1]) == "--cook-texture")
+	{
+		std::string image_path = argv[2];
+		std::string cooked_path = argc >= 4 && std::string(argv[3]) != "--box" ? argv[3] : TextureCooker::get_cooked_path(image_path);
+		MipFilter filter = std::string(argv[argc - 1]) == "--box" ? MipFilter::Box : MipFilter::Kaiser;
+
+		try
+		{
+			TextureCooker::cook_texture(image_path, cooked_path, filter);
+			std::cout << "Cooked " << image_path << " to " << cooked_path << std::endl;
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	// Vertex welding micro-benchmark
+	// VulkanEngine --bench-weld <input.obj> [iterations]
+	if (argc >= 3 && std::string(argv[1]) == "--bench-weld")
+	{
+		try
+		{
+			ModelLoader::benchmark_welding(argv[2], argc >= 4 ? static_cast<uint32_t>(std::max(1, std::atoi(argv[3]))) : 5);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	// Renders into offscreen images without a window or swap chain, e.g. on build machines without a display or GPU
+	// (lavapipe, SwiftShader). Frames aren't throttled by presentation. The last one can be saved as a PPM image.
+	// VulkanEngine --headless [frame count] [width] [height] [last_frame.ppm]
+	if (argc >= 2 && std::string(argv[1]) == "--headless")
+	{
+		uint32_t frame_count = argc >= 3 ? static_cast<uint32_t>(std::max(1, std::atoi(argv[2]))) : 100;
+		uint32_t width = argc >= 4 ? static_cast<uint32_t>(std::max(1, std::atoi(argv[3]))) : WIDTH;
+		uint32_t height = argc >= 5 ? static_cast<uint32_t>(std::max(1, std::atoi(argv[4]))) : HEIGHT;
+
+		Renderer renderer;
+
+		try
+		{
+			renderer.set_headless(width, height);
+			renderer.init_vulkan();
+
+			auto start = std::chrono::steady_clock::now();
+
+			for (uint32_t i = 0; i < frame_count; i++)
+				renderer.draw_frame();
+
+			vkDeviceWaitIdle(renderer.get_device());
+
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << "Rendered " << frame_count << " frames at " << width << "x" << height << " in " << seconds << " s, "
+				<< frame_count / seconds << " frames per second" << std::endl;
+			std::cout << renderer.get_gpu_profiler().get_report();
+
+			if (argc >= 6)
+			{
+				std::vector<uint8_t> pixels;
+				renderer.read_frame(pixels, width, height);
+				write_ppm(argv[5], pixels, width, height);
+			}
+
+			renderer.cleanup();
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	// Frame times of a synthetic scene drawn headless, written as JSON. The renderer logs to stdout, so the results go to a file.
+	// VulkanEngine --benchmark [--frames N] [--warmup N] [--objects N] [--triangles N] [--textures N] [--size W H]
+	//	[--mode immediate|cached|parallel] [--frames-in-flight N] [--low-latency] [--output benchmark.json]
+	if (argc >= 2 && std::string(argv[1]) == "--benchmark")
+	{
+		Benchmark_Config config;
+		std::string output_path = "benchmark.json";
+
+		try
+		{
+			for (int i = 2; i < argc; i++)
+			{
+				std::string option = argv[i];
+				bool has_value = i + 1 < argc;
+
+				auto next_count = [&]()
+				{
+					return static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+				};
+
+				if (option == "--frames" && has_value)
+					config.frame_count = next_count();
+				else if (option == "--warmup" && has_value)
+					config.warmup_frame_count = static_cast<uint32_t>(std::max(0, std::atoi(argv[++i])));
+				else if (option == "--objects" && has_value)
+					config.object_count = next_count();
+				else if (option == "--triangles" && has_value)
+					config.triangle_count = next_count();
+				else if (option == "--textures" && has_value)
+					config.texture_count = next_count();
+				else if (option == "--size" && i + 2 < argc)
+				{
+					config.width = next_count();
+					config.height = next_count();
+				}
+				else if (option == "--mode" && has_value)
+				{
+					if (!Benchmark::parse_recording_mode(argv[++i], config.recording_mode))
+						throw std::runtime_error(std::string("Unknown recording mode ") + argv[i] + ".");
+				}
+				else if (option == "--frames-in-flight" && has_value)
+					config.frames_in_flight = next_count();
+				else if (option == "--low-latency")
+					config.low_latency = true;
+				else if (option == "--output" && has_value)
+					output_path = argv[++i];
+				else
+					throw std::runtime_error("Unknown benchmark option " + option + ".");
+			}
+
+			std::ofstream output(output_path);
+
+			if (!output)
+				throw std::runtime_error("Failed to open " + output_path + " for writing.");
+
+			Benchmark::run(config, output);
+			std::cout << "Wrote the benchmark results to " << output_path << std::endl;
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	// --profile prints the GPU time of every pass once per second while the window is open
+	// VulkanEngine [--profile] [--frames-in-flight N] [--low-latency]
+	bool print_profile = false;
+
 	Renderer renderer;
 
 	try
 	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string option = argv[i];
+
+			if (option == "--profile")
+				print_profile = true;
+			else if (option == "--frames-in-flight" && i + 1 < argc)
+				renderer.set_frames_in_flight(static_cast<uint32_t>(std::max(0, std::atoi(argv[++i]))));
+			else if (option == "--low-latency")
+				renderer.set_low_latency(true);
+			else
+				throw std::runtime_error("Unknown option " + option + ".");
+		}
+
 		// Window initialization
 		Window window(WIDTH, HEIGHT, WINDOW_NAME);
 		GLFWwindow* glfw_window = window.get_glfw_window();
@@ -22,11 +245,19 @@ int main()
 		// Vulkan initalization
 		renderer.init_vulkan();
 		
+		auto last_profile_time = std::chrono::steady_clock::now();
+
 		// Main loop
 		while (!glfwWindowShouldClose(glfw_window))
 		{
 			glfwPollEvents();
 			renderer.draw_frame();
+
+			if (print_profile && std::chrono::steady_clock::now() - last_profile_time >= std::chrono::seconds(1))
+			{
+				std::cout << renderer.get_gpu_profiler().get_report() << std::endl;
+				last_profile_time = std::chrono::steady_clock::now();
+			}
 		}
 
 		// Cleanup
@@ -40,4 +271,43 @@ int main()
 	}
 
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+int main(int argc, char* argv[])
+{
+	// Writes the CPU trace markers to a Chrome trace JSON file once the program is done, can precede any of the modes.
+	// There are only markers when the program was built with VULKAN_ENGINE_TRACING defined.
+	// VulkanEngine --trace <trace.json> [mode]
+	std::string trace_path;
+
+	if (argc >= 3 && std::string(argv[1]) == "--trace")
+	{
+		trace_path = argv[2];
+
+		// The mode sees the remaining arguments after the program name
+		argv[2] = argv[0];
+		argv += 2;
+		argc -= 2;
+
+		if (!Trace::is_enabled())
+			std::cerr << "Tracing isn't compiled in, build the Tracing configuration to record markers." << std::endl;
+	}
+
+	int result = run(argc, argv);
+
+	if (!trace_path.empty())
+	{
+		try
+		{
+			Trace::write_chrome_json(trace_path);
+			std::cout << "Wrote the trace to " << trace_path << std::endl;
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	return result;
+}